@@ -0,0 +1,137 @@
+/*
+ * This file contains a startup benchmark for the translator.  It runs a
+ * command many times with a small input on stdin and measures the time from
+ * starting the process to receiving the first byte of its output, which is
+ * what editor hooks and pre-commit checks wait for:
+ *
+ *   coldstart [-n runs] [-b budget_us] <input> <command> [args...]
+ *
+ * The minimum, median and maximum are reported in microseconds.  If a budget
+ * is given, the exit status is 1 when the median is over it, so this can be
+ * used as a regression gate.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+/*
+ * Helper function returning the current time in microseconds.
+ */
+double _now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+/*
+ * Runs `argv` once with `input` on stdin and returns the microseconds until
+ * its first byte of output, or -1 if it wrote nothing or didn't exit
+ * successfully.
+ */
+double time_to_first_byte(const char* input, char** argv) {
+  int in = open(input, O_RDONLY | O_CLOEXEC);
+  int out[2];
+  if (in < 0 || pipe2(out, O_CLOEXEC) < 0) {
+    perror("Error: Could not set up run");
+    exit(2);
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+
+  double start = _now_us();
+  pid_t pid;
+  int error = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(in);
+  close(out[1]);
+  if (error) {
+    fprintf(stderr, "Error: Could not run %s: %s\n", argv[0], strerror(error));
+    exit(2);
+  }
+
+  char buf[65536];
+  ssize_t n = read(out[0], buf, 1);
+  double elapsed = _now_us() - start;
+  int got_output = n > 0;
+  while (n > 0) {
+    n = read(out[0], buf, sizeof(buf));
+  }
+  close(out[0]);
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+    return -1;
+  }
+  return got_output && n == 0 ? elapsed : -1;
+}
+
+
+int _double_cmp(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+
+int main(int argc, char** argv) {
+  int runs = 100;
+  double budget = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "+n:b:")) != -1) {
+    switch (opt) {
+      case 'n':
+        runs = atoi(optarg);
+        break;
+      case 'b':
+        budget = atof(optarg);
+        break;
+      default:
+        runs = 0;
+    }
+  }
+  if (runs <= 0 || argc - optind < 2) {
+    fprintf(stderr, "Usage: %s [-n runs] [-b budget_us] <input> <command> [args...]\n", argv[0]);
+    return 2;
+  }
+  const char* input = argv[optind];
+  char** command = argv + optind + 1;
+
+  /*
+   * One untimed run first, so the binary and input are in the page cache.
+   */
+  time_to_first_byte(input, command);
+
+  double* times = malloc(runs * sizeof(double));
+  for (int i = 0; i < runs; i++) {
+    times[i] = time_to_first_byte(input, command);
+    if (times[i] < 0) {
+      fprintf(stderr, "Error: %s failed or produced no output\n", command[0]);
+      return 2;
+    }
+  }
+  qsort(times, runs, sizeof(double), _double_cmp);
+
+  double median = times[runs / 2];
+  printf("%s: first output byte after %.0f us median (min %.0f, max %.0f, %d runs)\n",
+      command[0], median, times[0], times[runs - 1], runs);
+  free(times);
+
+  if (budget > 0 && median > budget) {
+    fprintf(stderr, "Error: median startup %.0f us is over the %.0f us budget\n", median, budget);
+    return 1;
+  }
+  return 0;
+}
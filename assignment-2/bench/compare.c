@@ -0,0 +1,609 @@
+/*
+ * This file contains a tool for deciding whether a change to the translator
+ * made it faster or slower.  It first records repeated benchmark results for
+ * a build of the translator as JSON, then compares two such files:
+ *
+ *   bench-compare run [-n runs] [-w warmup] [-c cpu] -o results.json <input> <command> [args...]
+ *   bench-compare [-t threshold_pct] old.json new.json
+ *
+ * Each recorded sample runs the command twice with `input` on stdin: once
+ * plain, timing the whole translation, and once with --stats, reading the
+ * scanner's throughput and the rate of hash operations from its phase table.
+ * The phase timings still include the cost of taking them (a clock read, and
+ * counter reads, at each of several phase boundaries per token), so they're
+ * only useful for comparing builds with each other.  The process is pinned to one CPU,
+ * and a few warmup samples are thrown away, to make the runs steadier.
+ *
+ * Comparing reports, for each metric, the median of each set, the relative
+ * change between them, and a bootstrap 95% confidence interval for that
+ * change.  A metric has regressed if the whole interval is on the slower side
+ * of the threshold (2% by default), in which case the exit status is 1.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+#define MAX_METRICS 16
+#define BOOTSTRAP_ROUNDS 2000
+
+/*
+ * This structure is used to hold the samples of one metric.
+ */
+struct metric {
+  char name[64];
+  int higher_is_better;
+  double* samples;
+  int num_samples;
+};
+
+/*
+ * This structure is used to hold a whole set of benchmark results.
+ */
+struct results {
+  struct metric metrics[MAX_METRICS];
+  int num_metrics;
+};
+
+/*
+ * Helper function returning the current time in milliseconds.
+ */
+double _now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int _double_cmp(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * Returns the median of `n` values, reordering them.
+ */
+double median(double* values, int n) {
+  qsort(values, n, sizeof(double), _double_cmp);
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+/*
+ * Returns the metric called `name` in `results`, adding it if it isn't there.
+ */
+struct metric* results_metric(struct results* results, const char* name, int higher_is_better) {
+  for (int i = 0; i < results->num_metrics; i++) {
+    if (strcmp(results->metrics[i].name, name) == 0) {
+      return &results->metrics[i];
+    }
+  }
+  if (results->num_metrics == MAX_METRICS) {
+    return NULL;
+  }
+  struct metric* metric = &results->metrics[results->num_metrics++];
+  snprintf(metric->name, sizeof(metric->name), "%s", name);
+  metric->higher_is_better = higher_is_better;
+  return metric;
+}
+
+void metric_add(struct metric* metric, double value) {
+  metric->samples = realloc(metric->samples, (metric->num_samples + 1) * sizeof(double));
+  metric->samples[metric->num_samples++] = value;
+}
+
+/*
+ * Pins this process, and so every command it runs, to `cpu`, or to the last
+ * CPU it's allowed on if `cpu` is negative.  Returns the CPU or -1.
+ */
+int pin_cpu(int cpu) {
+  cpu_set_t set;
+  if (cpu < 0) {
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+      return -1;
+    }
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &set)) {
+        cpu = i;
+      }
+    }
+  }
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0 ? cpu : -1;
+}
+
+/*
+ * Runs `argv` once with `input` on stdin and its output discarded.  If
+ * `errors` isn't NULL, whatever the command writes to stderr is returned
+ * there, NUL-terminated.  Returns the wall-clock time taken in milliseconds,
+ * or -1 if the command couldn't be run or failed.
+ */
+double run_command(const char* input, char** argv, char** errors) {
+  int in = open(input, O_RDONLY | O_CLOEXEC);
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  int err[2];
+  if (in < 0 || null < 0 || pipe2(err, O_CLOEXEC) < 0) {
+    perror("Error: Could not set up run");
+    exit(2);
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, null, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, errors ? err[1] : null, STDERR_FILENO);
+
+  double start = _now_ms();
+  pid_t pid;
+  int error = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(in);
+  close(null);
+  close(err[1]);
+  if (error) {
+    fprintf(stderr, "Error: Could not run %s: %s\n", argv[0], strerror(error));
+    exit(2);
+  }
+
+  size_t len = 0;
+  FILE* stream = errors ? open_memstream(errors, &len) : NULL;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(err[0], buf, sizeof(buf))) > 0) {
+    if (stream) {
+      fwrite(buf, 1, n, stream);
+    }
+  }
+  close(err[0]);
+
+  int status;
+  waitpid(pid, &status, 0);
+  double elapsed = _now_ms() - start;
+  if (stream) {
+    fclose(stream);
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? elapsed : -1;
+}
+
+/*
+ * Looks up the calls and CPU milliseconds of `phase` in a --stats phase
+ * table.  Returns 0 if the phase was found or -1 if it wasn't.
+ */
+int find_phase(const char* stats, const char* phase, double* calls, double* ms) {
+  for (const char* line = stats; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+    char name[16];
+    if (sscanf(line, " %15s %lf %lf", name, calls, ms) == 3 && strcmp(name, phase) == 0) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Helper function to write `str` as a JSON string.
+ */
+void _json_string(FILE* stream, const char* str) {
+  fputc('"', stream);
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\') {
+      fputc('\\', stream);
+    }
+    fputc(*str, stream);
+  }
+  fputc('"', stream);
+}
+
+/*
+ * Writes a set of results as JSON.
+ */
+void results_write(struct results* results, const char* input, char** command, int cpu, FILE* stream) {
+  fprintf(stream, "{\n  \"input\": ");
+  _json_string(stream, input);
+  fprintf(stream, ",\n  \"command\": [");
+  for (int i = 0; command[i]; i++) {
+    fprintf(stream, i ? ", " : "");
+    _json_string(stream, command[i]);
+  }
+  fprintf(stream, "],\n  \"cpu\": %d,\n  \"metrics\": {\n", cpu);
+  for (int i = 0; i < results->num_metrics; i++) {
+    struct metric* metric = &results->metrics[i];
+    fprintf(stream, "    \"%s\": {\n      \"better\": \"%s\",\n      \"samples\": [", metric->name,
+        metric->higher_is_better ? "higher" : "lower");
+    for (int j = 0; j < metric->num_samples; j++) {
+      fprintf(stream, "%s%.6g", j ? ", " : "", metric->samples[j]);
+    }
+    fprintf(stream, "]\n    }%s\n", i + 1 < results->num_metrics ? "," : "");
+  }
+  fprintf(stream, "  }\n}\n");
+}
+
+int record(int argc, char** argv) {
+  int runs = 20;
+  int warmup = 3;
+  int cpu = -1;
+  const char* out_path = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "+n:w:c:o:")) != -1) {
+    switch (opt) {
+      case 'n':
+        runs = atoi(optarg);
+        break;
+      case 'w':
+        warmup = atoi(optarg);
+        break;
+      case 'c':
+        cpu = atoi(optarg);
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      default:
+        runs = 0;
+    }
+  }
+  if (runs <= 0 || warmup < 0 || !out_path || argc - optind < 2) {
+    fprintf(stderr, "Usage: %s run [-n runs] [-w warmup] [-c cpu] -o results.json <input> <command> [args...]\n",
+        argv[0]);
+    return 2;
+  }
+  const char* input = argv[optind];
+  char** command = argv + optind + 1;
+  int num_args = argc - optind - 1;
+
+  struct stat st;
+  if (stat(input, &st) != 0) {
+    perror("Error: Could not read input");
+    return 2;
+  }
+
+  cpu = pin_cpu(cpu);
+  if (cpu < 0) {
+    fprintf(stderr, "Warning: Could not pin to a CPU, results may be noisier\n");
+  }
+
+  /*
+   * The same command with --stats added before its other arguments.
+   */
+  char** stats_command = calloc(num_args + 2, sizeof(char*));
+  stats_command[0] = command[0];
+  stats_command[1] = "--stats";
+  memcpy(stats_command + 2, command + 1, (num_args - 1) * sizeof(char*));
+
+  struct results results = { .num_metrics = 0 };
+  struct metric* translate = results_metric(&results, "translate_ms", 0);
+  struct metric* scan = results_metric(&results, "scan_mb_per_s", 1);
+  struct metric* hash = results_metric(&results, "hash_mops_per_s", 1);
+
+  for (int i = 0; i < warmup + runs; i++) {
+    char* stats;
+    double ms = run_command(input, command, NULL);
+    double stats_ms = run_command(input, stats_command, &stats);
+    double scan_calls, scan_ms, hash_calls, hash_ms;
+    if (ms < 0 || stats_ms < 0) {
+      fprintf(stderr, "Error: %s failed on %s\n", command[0], input);
+      return 2;
+    }
+    if (find_phase(stats, "scan", &scan_calls, &scan_ms) != 0
+        || find_phase(stats, "hash", &hash_calls, &hash_ms) != 0) {
+      fprintf(stderr, "Error: %s --stats didn't report phase times\n", command[0]);
+      return 2;
+    }
+    free(stats);
+
+    if (i >= warmup) {
+      metric_add(translate, ms);
+      metric_add(scan, scan_ms > 0 ? st.st_size / (scan_ms * 1e3) : 0);
+      metric_add(hash, hash_ms > 0 ? hash_calls / (hash_ms * 1e3) : 0);
+    }
+  }
+
+  FILE* out = fopen(out_path, "w");
+  if (!out) {
+    perror("Error: Could not write results");
+    return 2;
+  }
+  results_write(&results, input, command, cpu, out);
+  fclose(out);
+
+  printf("%s: %d runs on CPU %d, translate %.3f ms median\n", command[0], runs, cpu,
+      median(translate->samples, translate->num_samples));
+  free(stats_command);
+  return 0;
+}
+
+/*
+ * A minimal reader for the JSON written by results_write().  Only the
+ * "metrics" member is interpreted; anything else is skipped over.
+ */
+void _json_ws(const char** p) {
+  while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r') {
+    (*p)++;
+  }
+}
+
+int _json_expect(const char** p, char c) {
+  _json_ws(p);
+  if (**p != c) {
+    return -1;
+  }
+  (*p)++;
+  return 0;
+}
+
+int _json_read_string(const char** p, char* out, size_t size) {
+  if (_json_expect(p, '"') != 0) {
+    return -1;
+  }
+  size_t len = 0;
+  for (; **p && **p != '"'; (*p)++) {
+    if (**p == '\\' && (*p)[1]) {
+      (*p)++;
+    }
+    if (len + 1 < size) {
+      out[len++] = **p;
+    }
+  }
+  out[len] = '\0';
+  return _json_expect(p, '"');
+}
+
+int _json_skip(const char** p) {
+  _json_ws(p);
+  char c = **p;
+  if (c == '"') {
+    char ignored[1];
+    return _json_read_string(p, ignored, sizeof(ignored));
+  }
+  if (c == '{' || c == '[') {
+    char close = c == '{' ? '}' : ']';
+    (*p)++;
+    _json_ws(p);
+    if (**p == close) {
+      (*p)++;
+      return 0;
+    }
+    do {
+      if (c == '{') {
+        char ignored[1];
+        if (_json_read_string(p, ignored, sizeof(ignored)) != 0 || _json_expect(p, ':') != 0) {
+          return -1;
+        }
+      }
+      if (_json_skip(p) != 0) {
+        return -1;
+      }
+    } while (_json_expect(p, ',') == 0);
+    return _json_expect(p, close);
+  }
+  const char* start = *p;
+  while (**p && !strchr(",}] \t\r\n", **p)) {
+    (*p)++;
+  }
+  return *p > start ? 0 : -1;
+}
+
+int _json_read_metric(const char** p, struct results* results, const char* name) {
+  struct metric* metric = results_metric(results, name, 0);
+  if (!metric || _json_expect(p, '{') != 0) {
+    return -1;
+  }
+  char key[64];
+  do {
+    if (_json_read_string(p, key, sizeof(key)) != 0 || _json_expect(p, ':') != 0) {
+      return -1;
+    }
+    if (strcmp(key, "better") == 0) {
+      char better[16];
+      if (_json_read_string(p, better, sizeof(better)) != 0) {
+        return -1;
+      }
+      metric->higher_is_better = strcmp(better, "higher") == 0;
+    } else if (strcmp(key, "samples") == 0) {
+      if (_json_expect(p, '[') != 0) {
+        return -1;
+      }
+      do {
+        _json_ws(p);
+        char* end;
+        double value = strtod(*p, &end);
+        if (end == *p) {
+          return -1;
+        }
+        *p = end;
+        metric_add(metric, value);
+      } while (_json_expect(p, ',') == 0);
+      if (_json_expect(p, ']') != 0) {
+        return -1;
+      }
+    } else if (_json_skip(p) != 0) {
+      return -1;
+    }
+  } while (_json_expect(p, ',') == 0);
+  return _json_expect(p, '}');
+}
+
+/*
+ * Reads a set of results from the file at `path`.  Returns 0 on success or
+ * -1 if the file couldn't be read or parsed.
+ */
+int results_read(struct results* results, const char* path) {
+  FILE* in = fopen(path, "r");
+  if (!in) {
+    return -1;
+  }
+  char* text = NULL;
+  size_t size = 0;
+  FILE* buf = open_memstream(&text, &size);
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+    fwrite(chunk, 1, n, buf);
+  }
+  fclose(buf);
+  fclose(in);
+
+  const char* p = text;
+  int status = _json_expect(&p, '{');
+  char key[64];
+  while (status == 0) {
+    if (_json_read_string(&p, key, sizeof(key)) != 0 || _json_expect(&p, ':') != 0) {
+      status = -1;
+    } else if (strcmp(key, "metrics") == 0) {
+      status = _json_expect(&p, '{');
+      while (status == 0) {
+        char name[64];
+        if (_json_read_string(&p, name, sizeof(name)) != 0 || _json_expect(&p, ':') != 0
+            || _json_read_metric(&p, results, name) != 0) {
+          status = -1;
+        } else if (_json_expect(&p, ',') != 0) {
+          break;
+        }
+      }
+      status = status == 0 ? _json_expect(&p, '}') : status;
+    } else {
+      status = _json_skip(&p);
+    }
+    if (status == 0 && _json_expect(&p, ',') != 0) {
+      status = _json_expect(&p, '}');
+      break;
+    }
+  }
+  free(text);
+  return status;
+}
+
+/*
+ * Helper function returning a pseudo-random number below `n`.  A fixed seed
+ * keeps the confidence intervals reproducible from run to run.
+ */
+unsigned int _random_below(unsigned int n) {
+  static unsigned long long state = 0x9e3779b97f4a7c15ull;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state % n;
+}
+
+/*
+ * Helper function to return the median of a resample, with replacement, of
+ * `n` values, using `scratch` as space for the resample.
+ */
+double _resample_median(const double* values, int n, double* scratch) {
+  for (int i = 0; i < n; i++) {
+    scratch[i] = values[_random_below(n)];
+  }
+  return median(scratch, n);
+}
+
+/*
+ * Compares one metric, printing a line about it.  Returns 1 if it regressed
+ * beyond `threshold` (a fraction) or 0 if it didn't.
+ */
+int compare_metric(struct metric* old, struct metric* new, double threshold) {
+  int max = old->num_samples > new->num_samples ? old->num_samples : new->num_samples;
+  double* scratch = malloc(max * sizeof(double));
+  double* changes = malloc(BOOTSTRAP_ROUNDS * sizeof(double));
+  for (int i = 0; i < BOOTSTRAP_ROUNDS; i++) {
+    double a = _resample_median(old->samples, old->num_samples, scratch);
+    double b = _resample_median(new->samples, new->num_samples, scratch);
+    changes[i] = b / a - 1;
+  }
+  qsort(changes, BOOTSTRAP_ROUNDS, sizeof(double), _double_cmp);
+  double low = changes[(int)(BOOTSTRAP_ROUNDS * 0.025)];
+  double high = changes[(int)(BOOTSTRAP_ROUNDS * 0.975)];
+
+  memcpy(scratch, old->samples, old->num_samples * sizeof(double));
+  double old_median = median(scratch, old->num_samples);
+  memcpy(scratch, new->samples, new->num_samples * sizeof(double));
+  double new_median = median(scratch, new->num_samples);
+  double change = new_median / old_median - 1;
+
+  /*
+   * Flip the sign for metrics where lower is better, so a positive change is
+   * always an improvement.
+   */
+  double sign = old->higher_is_better ? 1 : -1;
+  double worst = old->higher_is_better ? low : -high;
+  double best = old->higher_is_better ? high : -low;
+  const char* verdict = "no significant change";
+  int regressed = 0;
+  if (best < -threshold) {
+    verdict = "REGRESSED";
+    regressed = 1;
+  } else if (worst > threshold) {
+    verdict = "improved";
+  } else if (worst > 0 || best < 0) {
+    verdict = sign * change > 0 ? "improved (below threshold)" : "slower (below threshold)";
+  }
+
+  printf("%-16s %12.4g %12.4g %+8.2f%%   [%+.2f%%, %+.2f%%]   %s\n", old->name, old_median,
+      new_median, 100 * change, 100 * low, 100 * high, verdict);
+  free(scratch);
+  free(changes);
+  return regressed;
+}
+
+int compare(int argc, char** argv) {
+  double threshold = 2;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:")) != -1) {
+    switch (opt) {
+      case 't':
+        threshold = atof(optarg);
+        break;
+      default:
+        threshold = -1;
+    }
+  }
+  if (threshold < 0 || argc - optind != 2) {
+    fprintf(stderr, "Usage: %s [-t threshold_pct] old.json new.json\n"
+        "       %s run [-n runs] [-w warmup] [-c cpu] -o results.json <input> <command> [args...]\n",
+        argv[0], argv[0]);
+    return 2;
+  }
+
+  struct results old = { .num_metrics = 0 }, new = { .num_metrics = 0 };
+  for (int i = 0; i < 2; i++) {
+    if (results_read(i ? &new : &old, argv[optind + i]) != 0) {
+      fprintf(stderr, "Error: Could not read results from %s\n", argv[optind + i]);
+      return 2;
+    }
+  }
+
+  printf("%-16s %12s %12s %9s   %-20s  %s\n", "metric", "old median", "new median", "change",
+      "95% CI", "verdict");
+  int regressions = 0;
+  for (int i = 0; i < old.num_metrics; i++) {
+    struct metric* a = &old.metrics[i];
+    struct metric* b = results_metric(&new, a->name, a->higher_is_better);
+    if (!b || a->num_samples == 0 || b->num_samples == 0) {
+      printf("%-16s missing from one of the results\n", a->name);
+      continue;
+    }
+    regressions += compare_metric(a, b, threshold / 100);
+  }
+
+  if (regressions) {
+    fprintf(stderr, "Error: %d metric%s regressed by more than %g%%\n", regressions,
+        regressions == 1 ? "" : "s", threshold);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "run") == 0) {
+    argv[1] = argv[0];
+    return record(argc - 1, argv + 1);
+  }
+  return compare(argc, argv);
+}
@@ -0,0 +1,275 @@
+/*
+ * This file contains a contention benchmark for the interner.  Threads intern
+ * names drawn from one shared vocabulary into one shared interner, with the
+ * skewed frequencies names have in real code, so the most common names are
+ * looked up by every thread at once:
+ *
+ *   interncontend [-n lookups] [-t max_threads] [-b batch_size]
+ *
+ * For each thread count from 1 up to max_threads (64 by default), doubling
+ * each time, the same total number of lookups is split between the threads,
+ * first as single intern_string() calls and then as intern_strings() batches.
+ * Throughput is reported in millions of lookups per second, with the speedup
+ * over one thread.  The interner is reset between runs, as it is between the
+ * batches of a translation.
+ *
+ * Every run also checks that the interner behaves: all threads must get the
+ * same copy (and so the same ID) for a name, and the interner must end up
+ * with exactly one string per distinct name.  The exit status is 1 if any
+ * check fails.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../intern/intern.h"
+
+/*
+ * The number of distinct names and the exponent of their Zipf distribution.
+ */
+#define VOCABULARY 20000
+#define ZIPF_EXPONENT 1.0
+
+/*
+ * The benchmark's shared state.  `expected` is the copy the first thread to
+ * intern each name got, which every later lookup must match.
+ */
+struct bench {
+  struct interner* names;
+  char** words;
+  size_t* lengths;
+  const char** expected;
+  unsigned int* sequence;
+  size_t lookups;
+  int num_threads;
+  size_t batch;
+  pthread_barrier_t start;
+  int failed;
+};
+
+/*
+ * The part of a run one thread does.
+ */
+struct bench_thread {
+  struct bench* bench;
+  size_t first;
+  size_t last;
+};
+
+
+/*
+ * Helper function returning the current time in seconds.
+ */
+double _now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Helper function to check the copy a thread got for the name with index
+ * `word`, recording it as the expected copy if it's the first.
+ */
+void _check(struct bench* bench, unsigned int word, const char* interned) {
+  const char* expected = NULL;
+  if (!__atomic_compare_exchange_n(&bench->expected[word], &expected, interned, 0,
+      __ATOMIC_RELAXED, __ATOMIC_RELAXED) && expected != interned) {
+    __atomic_store_n(&bench->failed, 1, __ATOMIC_RELAXED);
+  }
+}
+
+
+/*
+ * Helper function run by each thread, interning its share of the lookup
+ * sequence one name at a time.
+ */
+void* _run_single(void* arg) {
+  struct bench_thread* thread = arg;
+  struct bench* bench = thread->bench;
+  pthread_barrier_wait(&bench->start);
+  for (size_t i = thread->first; i < thread->last; i++) {
+    unsigned int word = bench->sequence[i];
+    _check(bench, word, intern_string(bench->names, bench->words[word], bench->lengths[word]));
+  }
+  return NULL;
+}
+
+
+/*
+ * Helper function run by each thread, interning its share of the lookup
+ * sequence in batches.
+ */
+void* _run_bulk(void* arg) {
+  struct bench_thread* thread = arg;
+  struct bench* bench = thread->bench;
+  const char** strs = malloc(bench->batch * sizeof(char*));
+  size_t* lens = malloc(bench->batch * sizeof(size_t));
+  const char** interned = malloc(bench->batch * sizeof(char*));
+
+  pthread_barrier_wait(&bench->start);
+  for (size_t i = thread->first; i < thread->last; i += bench->batch) {
+    size_t count = thread->last - i < bench->batch ? thread->last - i : bench->batch;
+    for (size_t j = 0; j < count; j++) {
+      strs[j] = bench->words[bench->sequence[i + j]];
+      lens[j] = bench->lengths[bench->sequence[i + j]];
+    }
+    intern_strings(bench->names, strs, lens, count, interned);
+    for (size_t j = 0; j < count; j++) {
+      _check(bench, bench->sequence[i + j], interned[j]);
+    }
+  }
+
+  free(strs);
+  free(lens);
+  free(interned);
+  return NULL;
+}
+
+
+/*
+ * Runs the lookup sequence on `num_threads` threads with `run` and returns
+ * the time it took in seconds, then checks and resets the interner.
+ */
+double run_threads(struct bench* bench, int num_threads, void* (*run)(void*)) {
+  pthread_t threads[num_threads];
+  struct bench_thread parts[num_threads];
+  memset(bench->expected, 0, VOCABULARY * sizeof(char*));
+  pthread_barrier_init(&bench->start, NULL, num_threads + 1);
+
+  for (int i = 0; i < num_threads; i++) {
+    parts[i].bench = bench;
+    parts[i].first = bench->lookups * i / num_threads;
+    parts[i].last = bench->lookups * (i + 1) / num_threads;
+    pthread_create(&threads[i], NULL, run, &parts[i]);
+  }
+  pthread_barrier_wait(&bench->start);
+  double start = _now();
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double secs = _now() - start;
+  pthread_barrier_destroy(&bench->start);
+
+  /*
+   * Every name that was looked up must have been interned exactly once, with
+   * an ID that leads back to it.
+   */
+  unsigned int distinct = 0;
+  for (unsigned int word = 0; word < VOCABULARY; word++) {
+    const char* interned = bench->expected[word];
+    if (interned) {
+      distinct++;
+      if (strcmp(interned, bench->words[word]) != 0
+          || intern_name(bench->names, intern_id(interned)) != interned) {
+        bench->failed = 1;
+      }
+    }
+  }
+  if (intern_count(bench->names) != distinct) {
+    bench->failed = 1;
+  }
+
+  intern_reset(bench->names);
+  return secs;
+}
+
+
+int main(int argc, char** argv) {
+  struct bench bench = { .lookups = 4000000, .num_threads = 64, .batch = 256 };
+  int opt;
+  while ((opt = getopt(argc, argv, "n:t:b:")) != -1) {
+    switch (opt) {
+      case 'n': bench.lookups = strtoull(optarg, NULL, 10); break;
+      case 't': bench.num_threads = atoi(optarg); break;
+      case 'b': bench.batch = strtoull(optarg, NULL, 10); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n lookups] [-t max_threads] [-b batch_size]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (bench.lookups == 0 || bench.num_threads < 1 || bench.batch == 0) {
+    fprintf(stderr, "Error: Lookups, threads and batch size must be positive\n");
+    return 2;
+  }
+
+  /*
+   * Build the vocabulary, a mix of keywords and identifiers, and a lookup
+   * sequence drawn from it by inverting the Zipf distribution's CDF.
+   */
+  static const char* const keywords[] = { "if", "elif", "else", "while", "for", "and", "or",
+    "not", "True", "False", "print", "break" };
+  int num_keywords = sizeof(keywords) / sizeof(keywords[0]);
+  bench.words = malloc(VOCABULARY * sizeof(char*));
+  bench.lengths = malloc(VOCABULARY * sizeof(size_t));
+  for (int i = 0; i < VOCABULARY; i++) {
+    if (i < num_keywords) {
+      bench.words[i] = strdup(keywords[i]);
+    } else {
+      asprintf(&bench.words[i], "%s%d", i % 3 ? "x" : "total_", i);
+    }
+    bench.lengths[i] = strlen(bench.words[i]);
+  }
+
+  double* cdf = malloc(VOCABULARY * sizeof(double));
+  double sum = 0;
+  for (int i = 0; i < VOCABULARY; i++) {
+    sum += 1 / pow(i + 1, ZIPF_EXPONENT);
+    cdf[i] = sum;
+  }
+  bench.sequence = malloc(bench.lookups * sizeof(unsigned int));
+  unsigned int seed = 12345;
+  for (size_t i = 0; i < bench.lookups; i++) {
+    double u = rand_r(&seed) / ((double)RAND_MAX + 1) * sum;
+    int lo = 0, hi = VOCABULARY - 1;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (cdf[mid] < u) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    bench.sequence[i] = lo;
+  }
+  free(cdf);
+
+  bench.names = intern_create();
+  bench.expected = malloc(VOCABULARY * sizeof(char*));
+
+  printf("%zu lookups of %d names, batches of %zu, %ld CPUs\n", bench.lookups, VOCABULARY,
+      bench.batch, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%8s %14s %9s %14s %9s\n", "threads", "single Mops/s", "speedup", "bulk Mops/s",
+      "speedup");
+  double single_base = 0, bulk_base = 0;
+  for (int threads = 1; threads <= bench.num_threads; threads *= 2) {
+    double single = bench.lookups / run_threads(&bench, threads, _run_single) / 1e6;
+    double bulk = bench.lookups / run_threads(&bench, threads, _run_bulk) / 1e6;
+    if (threads == 1) {
+      single_base = single;
+      bulk_base = bulk;
+    }
+    printf("%8d %14.2f %8.2fx %14.2f %8.2fx\n", threads, single, single / single_base, bulk,
+        bulk / bulk_base);
+  }
+
+  intern_free(bench.names);
+  for (int i = 0; i < VOCABULARY; i++) {
+    free(bench.words[i]);
+  }
+  free(bench.words);
+  free(bench.lengths);
+  free(bench.expected);
+  free(bench.sequence);
+
+  if (bench.failed) {
+    fprintf(stderr, "Error: The interner gave inconsistent results\n");
+  }
+  return bench.failed;
+}
@@ -0,0 +1,17 @@
+# Walks a counter through a chain of comparisons, taking a different branch
+# in each band of values.
+i = 0
+low = 0
+mid = 0
+high = 0
+other = 0
+while i < 2000000:
+    if i < 500000:
+        low = low + 1
+    elif i < 1000000:
+        mid = mid + 2
+    elif i <= 1500000:
+        high = high + 3
+    else:
+        other = other + 4
+    i = i + 1
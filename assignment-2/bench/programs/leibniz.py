@@ -0,0 +1,10 @@
+# Approximates pi with the Leibniz series, alternating signs with a branch.
+terms = 5000000
+k = 0
+sign = 1.0
+acc = 0.0
+while k < terms:
+    acc = acc + sign / (2 * k + 1)
+    sign = 0 - sign
+    k = k + 1
+pi = 4 * acc
@@ -0,0 +1,10 @@
+# Accumulates products over a triangular pair of nested loops.
+n = 2500
+i = 0
+acc = 0
+while i < n:
+    j = 0
+    while j < i:
+        acc = acc + i * j - j
+        j = j + 1
+    i = i + 1
@@ -0,0 +1,15 @@
+# Takes square roots of many numbers by Newton's method, with an inner loop
+# that stops once the estimate has converged.
+a = 1.0
+roots = 0.0
+steps = 0
+while a < 200000:
+    x = a
+    while True:
+        next = (x + a / x) / 2
+        steps = steps + 1
+        if x - next < 0.000001:
+            break
+        x = next
+    roots = roots + next
+    a = a + 1
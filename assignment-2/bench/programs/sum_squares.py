@@ -0,0 +1,7 @@
+# Sums the squares of the first few million integers in a tight loop.
+n = 3000000
+i = 0
+total = 0.0
+while i < n:
+    total = total + i * i
+    i = i + 1
@@ -0,0 +1,62 @@
+/*
+ * This file contains a small utility that runs a command once with a file on
+ * stdin, discarding its output, and prints the wall-clock time it took in
+ * seconds and its peak memory use in kilobytes:
+ *
+ *   runstat <input> <command> [args...]
+ *
+ * The exit status is the command's.  It's used by scaling.sh to measure how
+ * the translator's cost grows with its input.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <input> <command> [args...]\n", argv[0]);
+    return 2;
+  }
+
+  int in = open(argv[1], O_RDONLY);
+  int out = open("/dev/null", O_WRONLY);
+  if (in < 0 || out < 0) {
+    perror("Error: Could not open input");
+    return 2;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out, STDERR_FILENO);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid;
+  int error = posix_spawn(&pid, argv[2], &actions, NULL, argv + 2, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (error) {
+    fprintf(stderr, "Error: Could not run %s: %s\n", argv[2], strerror(error));
+    return 2;
+  }
+
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("%.6f %ld\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+      usage.ru_maxrss);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+}
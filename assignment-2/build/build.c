@@ -0,0 +1,855 @@
+/*
+ * This file contains the implementation of build mode.
+ *
+ * The cache has two levels.  The C code for a Python file is cached under a
+ * key covering the source text, the translator itself (a hash of the
+ * running executable, so rebuilding the translator invalidates it) and
+ * whether the output is compact, in c/<key>.c.  The compiled output is
+ * cached under a key covering the C code, the compiler (its resolved path,
+ * size, modification time and --version output) and the compiler flags, in
+ * bin/<key>.  Keying the second level on the C code rather than the first
+ * level's key means a translator change that doesn't change the generated
+ * code doesn't cause anything to be recompiled.
+ *
+ * Keys are 128-bit SipHash digests using a fixed key, so they're the same in
+ * every process.  Entries are written to a temporary file in the cache and
+ * renamed into place, so concurrent builds sharing a cache never see a
+ * partial entry, and two builds racing to insert the same entry both end up
+ * with a complete one.  Entries are retrieved by hard-linking them into the
+ * output directory, falling back to a copy if the output directory is on a
+ * different file system.  Outputs therefore share storage with the cache, and
+ * shouldn't be modified in place.
+ *
+ * Translation is done in this process, one file at a time, since it's fast.
+ * The files share one interner, which is reclaimed between files once it
+ * grows past INTERN_RECLAIM_BYTES.  Compilation is done by compiler processes running in parallel with
+ * each other and with translation, as many at once as -j allows or, when run
+ * from make -j, as many as make's jobserver gives tokens for.  Each
+ * compiler's stderr goes to a memory file, which is written out in one piece
+ * when it exits.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "build.h"
+#include "../parser.h"
+#include "../fileio/fileio.h"
+#include "../hash/hash.h"
+#include "../trace/trace.h"
+
+extern char** environ;
+
+/*
+ * The SipHash keys for cache keys.  Each digest is two 64-bit hashes of the
+ * same data under these two keys.
+ */
+static const uint64_t _cache_keys[2][2] = {
+  { 0x7079326320636163ULL, 0x6865206b65792031ULL },
+  { 0x3c1f8a0e5d2b9467ULL, 0xa4e6b2d0971c3f58ULL }
+};
+
+/*
+ * A running compile job.
+ */
+struct build_job {
+  pid_t pid;
+  int file;                     // index of the file being compiled
+  int diagnostics;              // memory file holding the compiler's stderr
+  char* tmp_path;               // where the compiler writes its output
+  char* bin_path;               // the cache entry that's renamed to
+  char* out_path;               // where it's retrieved to
+  char* out_c_path;             // the C file being compiled
+  struct timespec start;
+};
+
+/*
+ * What happened to each file, for the summary.  The cache results are 'h'
+ * for a hit, 'm' for a miss or 0 if that level wasn't reached.
+ */
+struct build_result {
+  double translate_ms;
+  double compile_ms;
+  char c_cache;
+  char bin_cache;
+  int failed;
+};
+
+/*
+ * This structure is used to represent the state of a build.
+ */
+struct build {
+  char** files;
+  struct build_result* results;
+  char* cache_dir;
+  char translator_id[33];       // digest of the translator executable
+  char compiler_id[33];         // digest of the compiler and its flags
+  char** cc_argv;               // compiler and flags, with room for -o out in
+  int cc_argc;
+  const char* suffix;           // suffix of compiled outputs ("" or ".o")
+  int compact;                  // whether translations are compact
+  int num_temps;                // temporary files created so far
+
+  struct build_job* jobs;
+  int num_jobs;
+  int max_jobs;
+  int jobserver_read;           // jobserver pipe (-1 if there's no jobserver)
+  int jobserver_write;
+  int jobserver_fifo;           // whether the pipe is a named pipe opened here
+  char* tokens;                 // tokens taken from the jobserver
+  int num_tokens;
+  int signals;                  // signalfd reporting SIGCHLD
+  posix_spawnattr_t spawn_attr;
+
+  int c_hits, c_misses;
+  int bin_hits, bin_misses;
+  double translate_secs, compile_secs;
+};
+
+
+/*
+ * Helper function returning the time elapsed since `start` in seconds.
+ */
+double _build_elapsed(struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+/*
+ * Helper function to compute the digest of `data` prefixed by the string
+ * `id`, as 32 hex digits in `hex`.
+ */
+void _build_digest(const char* id, const void* data, size_t len, char hex[33]) {
+  uint64_t inner[2] = {
+    hash_bytes_keyed(data, len, _cache_keys[0]),
+    hash_bytes_keyed(data, len, _cache_keys[1])
+  };
+
+  size_t id_len = strlen(id);
+  char buf[id_len + 1 + sizeof(inner)];
+  memcpy(buf, id, id_len + 1);
+  memcpy(buf + id_len + 1, inner, sizeof(inner));
+
+  snprintf(hex, 33, "%016llx%016llx",
+    (unsigned long long)hash_bytes_keyed(buf, sizeof(buf), _cache_keys[0]),
+    (unsigned long long)hash_bytes_keyed(buf, sizeof(buf), _cache_keys[1]));
+}
+
+
+/*
+ * Helper function to create a directory and any missing parents.  Returns 0
+ * on success or -1 otherwise.
+ */
+int _build_mkdirs(const char* path) {
+  char* copy = strdup(path);
+  for (char* p = copy + 1; *p; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      mkdir(copy, 0777);
+      *p = '/';
+    }
+  }
+  int status = mkdir(copy, 0777) == 0 || errno == EEXIST ? 0 : -1;
+  free(copy);
+  return status;
+}
+
+
+/*
+ * Helper function to make a name for a new temporary file in cache
+ * subdirectory `subdir`.
+ */
+char* _build_temp_path(struct build* build, const char* subdir) {
+  char* path;
+  asprintf(&path, "%s/%s/tmp.%d.%d", build->cache_dir, subdir, (int)getpid(),
+    build->num_temps++);
+  return path;
+}
+
+
+/*
+ * Helper function to insert `len` bytes of `data` into the cache at `path`.
+ * Returns 0 on success or -1 otherwise.
+ */
+int _build_insert(struct build* build, const char* path, const char* data, size_t len) {
+  char* tmp_path = _build_temp_path(build, "c");
+  FILE* f = fopen(tmp_path, "wb");
+  int ok = f && fwrite(data, 1, len, f) == len;
+  if (f && fclose(f) != 0) {
+    ok = 0;
+  }
+  if (ok) {
+    ok = rename(tmp_path, path) == 0;
+  }
+  if (!ok) {
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  return ok ? 0 : -1;
+}
+
+
+/*
+ * Helper function to make `dst` a copy of the cache entry at `src`, as a hard
+ * link if possible.  Returns 0 on success or -1 otherwise.
+ */
+int _build_retrieve(const char* src, const char* dst) {
+  unlink(dst);
+  if (link(src, dst) == 0) {
+    return 0;
+  }
+  if (errno != EXDEV && errno != EPERM) {
+    return -1;
+  }
+
+  size_t len;
+  char* data = fileio_read_file(src, &len);
+  struct stat st;
+  if (!data || stat(src, &st) != 0) {
+    free(data);
+    return -1;
+  }
+  int fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+  int ok = fd >= 0 && write(fd, data, len) == (ssize_t)len;
+  if (fd >= 0 && close(fd) != 0) {
+    ok = 0;
+  }
+  free(data);
+  return ok ? 0 : -1;
+}
+
+
+/*
+ * Helper function to compute the digest identifying the running translator,
+ * from the contents of its executable, and the options that change its
+ * output.
+ */
+void _build_translator_id(char hex[33], int compact) {
+  const char* id = compact ? "translator --fast-compile" : "translator";
+  size_t len;
+  char* exe = fileio_read_file("/proc/self/exe", &len);
+  if (exe) {
+    _build_digest(id, exe, len, hex);
+  } else {
+    _build_digest(id, __DATE__ " " __TIME__, sizeof(__DATE__ " " __TIME__), hex);
+  }
+  free(exe);
+}
+
+
+/*
+ * Helper function to find the program `name` on the PATH, the same way it
+ * will be found when it's run.  Returns its resolved path in a newly-allocated
+ * string, or NULL if it can't be found.
+ */
+char* _build_which(const char* name) {
+  if (strchr(name, '/')) {
+    return realpath(name, NULL);
+  }
+
+  char* resolved = NULL;
+  const char* path = getenv("PATH");
+  char* dirs = strdup(path ? path : "/usr/bin:/bin");
+  for (char* dir = strtok(dirs, ":"); dir && !resolved; dir = strtok(NULL, ":")) {
+    char* candidate;
+    asprintf(&candidate, "%s/%s", dir, name);
+    if (access(candidate, X_OK) == 0) {
+      resolved = realpath(candidate, NULL);
+    }
+    free(candidate);
+  }
+  free(dirs);
+  return resolved;
+}
+
+
+/*
+ * Helper function to compute the digest identifying the compiler `cc` and
+ * the flags `cflags`.
+ */
+void _build_compiler_id(const char* cc, const char* cflags, char hex[33]) {
+  char* resolved = _build_which(cc);
+
+  char* id;
+  size_t id_len;
+  FILE* stream = open_memstream(&id, &id_len);
+  struct stat st;
+  if (resolved && stat(resolved, &st) == 0) {
+    fprintf(stream, "%s %lld %lld\n", resolved, (long long)st.st_size, (long long)st.st_mtime);
+  } else {
+    fprintf(stream, "%s\n", cc);
+  }
+
+  char* command;
+  asprintf(&command, "%s --version 2>/dev/null", resolved ? resolved : cc);
+  FILE* version = popen(command, "r");
+  if (version) {
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), version)) > 0) {
+      fwrite(buf, 1, n, stream);
+    }
+    pclose(version);
+  }
+  fprintf(stream, "\n%s", cflags);
+  fclose(stream);
+
+  _build_digest("compiler", id, id_len, hex);
+  free(command);
+  free(id);
+  free(resolved);
+}
+
+
+/*
+ * Helper function to connect to the jobserver of a parent GNU make, if there
+ * is one.  make passes it in MAKEFLAGS, either as a named pipe (make 4.4 and
+ * later) or as the file descriptors of an anonymous pipe.  Either way, reads
+ * go through a file description of our own that doesn't block, so waiting for
+ * a token never stops jobs from being reaped.  If make didn't pass the pipe
+ * on (because the command isn't marked as recursive with +), the descriptors
+ * aren't open and the jobserver is ignored.
+ */
+void _build_jobserver_open(struct build* build) {
+  build->jobserver_read = build->jobserver_write = -1;
+  const char* flags = getenv("MAKEFLAGS");
+  const char* auth = NULL;
+  for (const char* p = flags; p && (p = strstr(p, "--jobserver-")) != NULL; p++) {
+    if (strncmp(p, "--jobserver-auth=", 17) == 0) {
+      auth = p + 17;
+    } else if (strncmp(p, "--jobserver-fds=", 16) == 0) {
+      auth = p + 16;
+    }
+  }
+  if (!auth) {
+    return;
+  }
+
+  int read_fd, write_fd;
+  if (strncmp(auth, "fifo:", 5) == 0) {
+    char* path = strndup(auth + 5, strcspn(auth + 5, " "));
+    build->jobserver_read = build->jobserver_write = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    build->jobserver_fifo = 1;
+    free(path);
+  } else if (sscanf(auth, "%d,%d", &read_fd, &write_fd) == 2
+      && fcntl(read_fd, F_GETFD) >= 0 && fcntl(write_fd, F_GETFD) >= 0) {
+    char* path;
+    asprintf(&path, "/proc/self/fd/%d", read_fd);
+    build->jobserver_read = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    build->jobserver_write = build->jobserver_read >= 0 ? write_fd : -1;
+    free(path);
+  }
+}
+
+
+/*
+ * Helper function to stop taking tokens from the jobserver, if reading from it
+ * fails.  The write end stays open, since tokens already taken must still be
+ * given back.
+ */
+void _build_jobserver_stop(struct build* build) {
+  if (build->jobserver_read >= 0 && !build->jobserver_fifo) {
+    close(build->jobserver_read);
+  }
+  build->jobserver_read = -1;
+}
+
+
+/*
+ * Helper function to disconnect from the jobserver, once every token taken
+ * from it has been given back.
+ */
+void _build_jobserver_close(struct build* build) {
+  assert(build->num_tokens == 0);
+  _build_jobserver_stop(build);
+  if (build->jobserver_fifo && build->jobserver_write >= 0) {
+    close(build->jobserver_write);
+  }
+  build->jobserver_write = -1;
+}
+
+
+/*
+ * Helper function to finish a compile job whose compiler has exited with
+ * `wstatus`: the compiler's diagnostics are written out in one piece, so
+ * they're never interleaved with another job's, and the output is moved into
+ * the cache and retrieved.
+ */
+void _build_finish_job(struct build* build, struct build_job* job, int wstatus) {
+  struct build_result* result = &build->results[job->file];
+  result->compile_ms = _build_elapsed(&job->start) * 1e3;
+  build->compile_secs += result->compile_ms / 1e3;
+
+  off_t len = lseek(job->diagnostics, 0, SEEK_END);
+  if (len > 0) {
+    char* buf = malloc(len);
+    if (pread(job->diagnostics, buf, len, 0) == len) {
+      write(STDERR_FILENO, buf, len);
+    }
+    free(buf);
+  }
+  close(job->diagnostics);
+
+  if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0 || rename(job->tmp_path, job->bin_path) != 0) {
+    fprintf(stderr, "Error: Could not compile %s\n", job->out_c_path);
+    unlink(job->tmp_path);
+    result->failed = 1;
+  } else if (_build_retrieve(job->bin_path, job->out_path) != 0) {
+    fprintf(stderr, "Error: Could not write %s: %s\n", job->out_path, strerror(errno));
+    result->failed = 1;
+  }
+
+  free(job->tmp_path);
+  free(job->bin_path);
+  free(job->out_path);
+  free(job->out_c_path);
+}
+
+
+/*
+ * Helper function to finish every compile job that has exited, giving back a
+ * jobserver token for each one.
+ */
+void _build_reap(struct build* build) {
+  struct signalfd_siginfo info;
+  while (read(build->signals, &info, sizeof(info)) > 0);
+
+  for (int i = 0; i < build->num_jobs; i++) {
+    int wstatus;
+    if (waitpid(build->jobs[i].pid, &wstatus, WNOHANG) <= 0) {
+      continue;
+    }
+    _build_finish_job(build, &build->jobs[i], wstatus);
+    build->jobs[i--] = build->jobs[--build->num_jobs];
+    if (build->num_tokens > 0) {
+      write(build->jobserver_write, &build->tokens[--build->num_tokens], 1);
+    }
+  }
+}
+
+
+/*
+ * Helper function to wait for every job compiling into the cache entry at
+ * `bin_path` to finish, so identical files in the same build are only
+ * compiled once.
+ */
+void _build_wait_for_entry(struct build* build, const char* bin_path) {
+  for (;;) {
+    _build_reap(build);
+    int running = 0;
+    for (int i = 0; i < build->num_jobs && !running; i++) {
+      running = strcmp(build->jobs[i].bin_path, bin_path) == 0;
+    }
+    if (!running) {
+      return;
+    }
+    struct pollfd fd = { .fd = build->signals, .events = POLLIN };
+    poll(&fd, 1, -1);
+  }
+}
+
+
+/*
+ * Helper function to wait until another compile job may start, finishing
+ * jobs as they exit in the meantime.  One job can always run, on the token
+ * make gave us when it started us.  Each other job needs a token from the
+ * jobserver if there is one, and there can be no more than the maximum
+ * number of jobs either way.
+ */
+void _build_wait_for_slot(struct build* build) {
+  for (;;) {
+    _build_reap(build);
+    if (build->num_jobs == 0) {
+      return;
+    }
+
+    int want_token = build->num_jobs < build->max_jobs;
+    if (want_token && build->jobserver_read < 0) {
+      return;
+    }
+    if (want_token) {
+      char token;
+      ssize_t n = read(build->jobserver_read, &token, 1);
+      if (n == 1) {
+        build->tokens[build->num_tokens++] = token;
+        return;
+      }
+      if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        _build_jobserver_stop(build);
+        continue;
+      }
+    }
+
+    struct pollfd fds[2] = {
+      { .fd = build->signals, .events = POLLIN },
+      { .fd = build->jobserver_read, .events = POLLIN }
+    };
+    poll(fds, want_token ? 2 : 1, -1);
+  }
+}
+
+
+/*
+ * Helper function to start compiling the C file at `out_c_path` into the
+ * cache at `bin_path`, to be retrieved to `out_path`.  It's compiled from the
+ * output directory rather than from the cache, so diagnostics name the file
+ * the user has.
+ */
+void _build_start_job(struct build* build, int file, const char* out_c_path,
+    const char* bin_path, const char* out_path) {
+  _build_wait_for_slot(build);
+
+  struct build_job* job = &build->jobs[build->num_jobs];
+  job->file = file;
+  job->tmp_path = _build_temp_path(build, "bin");
+  job->bin_path = strdup(bin_path);
+  job->out_path = strdup(out_path);
+  job->out_c_path = strdup(out_c_path);
+  job->diagnostics = memfd_create("diagnostics", MFD_CLOEXEC);
+
+  int argc = build->cc_argc;
+  build->cc_argv[argc++] = "-o";
+  build->cc_argv[argc++] = job->tmp_path;
+  build->cc_argv[argc++] = job->out_c_path;
+  build->cc_argv[argc] = NULL;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (job->diagnostics >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, job->diagnostics, STDERR_FILENO);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &job->start);
+  int error = posix_spawnp(&job->pid, build->cc_argv[0], &actions, &build->spawn_attr,
+    build->cc_argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (error) {
+    fprintf(stderr, "Error: Could not run %s: %s\n", build->cc_argv[0], strerror(error));
+    build->results[file].failed = 1;
+    if (job->diagnostics >= 0) {
+      close(job->diagnostics);
+    }
+    free(job->tmp_path);
+    free(job->bin_path);
+    free(job->out_path);
+    free(job->out_c_path);
+    if (build->num_tokens > 0) {
+      write(build->jobserver_write, &build->tokens[--build->num_tokens], 1);
+    }
+    return;
+  }
+  build->num_jobs++;
+}
+
+
+/*
+ * Helper function to make the path in `outdir` of an output for the Python
+ * file at `py_path`, which is named after the file's base name without its
+ * .py extension, followed by `suffix`.
+ */
+char* _build_output_path(const char* outdir, const char* py_path, const char* suffix) {
+  const char* base = strrchr(py_path, '/');
+  base = base ? base + 1 : py_path;
+  int base_len = strlen(base);
+  if (base_len > 3 && strcmp(base + base_len - 3, ".py") == 0) {
+    base_len -= 3;
+  }
+  char* path;
+  asprintf(&path, "%s/%.*s%s", outdir, base_len, base, suffix);
+  return path;
+}
+
+
+/*
+ * Helper function to check that no two files would be built into the same
+ * output, as files with the same name in different directories would be.
+ * Their translations would overwrite each other, and their compile jobs would
+ * race to write the same file.  Returns 0 if the outputs are all distinct or
+ * -1 otherwise, after reporting each collision.
+ */
+int _build_check_outputs(struct build* build, const char* outdir, int num_files) {
+  struct hash* outputs = hash_create();
+  int collided = 0;
+  for (int i = 0; i < num_files; i++) {
+    char* paths[2] = {
+      _build_output_path(outdir, build->files[i], ".c"),
+      _build_output_path(outdir, build->files[i], build->suffix)
+    };
+    int reported = 0;
+    for (int j = 0; j < 2; j++) {
+      if (hash_contains(outputs, paths[j])) {
+        if (!reported) {
+          fprintf(stderr, "Error: %s and %s would both be built into %s\n",
+            (char*)hash_get(outputs, paths[j]), build->files[i], paths[j]);
+        }
+        reported = collided = 1;
+      } else {
+        hash_insert(outputs, paths[j], strdup(build->files[i]));
+      }
+      free(paths[j]);
+    }
+  }
+  hash_free(outputs);
+  return collided ? -1 : 0;
+}
+
+
+/*
+ * Helper function to build one Python file.  The translation is done right
+ * away, and if the compiled output isn't cached a compile job is started for
+ * it.
+ */
+void _build_file(struct build* build, struct interner* names, const char* outdir, int file) {
+  const char* py_path = build->files[file];
+  struct build_result* result = &build->results[file];
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  /*
+   * Outputs left over from an earlier build are removed first, so a file
+   * that fails to build doesn't leave stale outputs behind.
+   */
+  char* out_c_path = _build_output_path(outdir, py_path, ".c");
+  char* out_path = _build_output_path(outdir, py_path, build->suffix);
+  unlink(out_c_path);
+  unlink(out_path);
+
+  size_t source_len;
+  char* source = fileio_read_file(py_path, &source_len);
+  if (!source) {
+    fprintf(stderr, "Error: Could not read %s: %s\n", py_path, strerror(errno));
+    result->failed = 1;
+    free(out_c_path);
+    free(out_path);
+    return;
+  }
+
+  char key[33];
+  char* c_path;
+  _build_digest(build->translator_id, source, source_len, key);
+  asprintf(&c_path, "%s/c/%s.c", build->cache_dir, key);
+
+  char* output = NULL;
+  size_t output_len;
+  if ((output = fileio_read_file(c_path, &output_len)) != NULL) {
+    build->c_hits++;
+    result->c_cache = 'h';
+    TRACE2(cache_hit, py_path, TRACE_ENABLED(cache_hit) ? _build_elapsed(&start) * 1e6 : 0);
+  } else {
+    build->c_misses++;
+    result->c_cache = 'm';
+    struct py2c_ctx* ctx = py2c_create(names);
+    ctx->compact = build->compact;
+    py2c_feed(ctx, source, source_len, true);
+    result->failed = py2c_finish(ctx);
+    FILE* stream = open_memstream(&output, &output_len);
+    if (!result->failed) {
+      py2c_write(ctx, stream);
+    }
+    fclose(stream);
+    py2c_free(ctx);
+    intern_reclaim(names, INTERN_RECLAIM_BYTES);
+    if (result->failed) {
+      fprintf(stderr, "Error: Could not translate %s\n", py_path);
+    } else if (_build_insert(build, c_path, output, output_len) != 0) {
+      fprintf(stderr, "Error: Could not write to cache %s: %s\n", build->cache_dir, strerror(errno));
+      result->failed = 1;
+    }
+    TRACE2(cache_miss, py_path, TRACE_ENABLED(cache_miss) ? _build_elapsed(&start) * 1e6 : 0);
+  }
+  result->translate_ms = _build_elapsed(&start) * 1e3;
+  build->translate_secs += result->translate_ms / 1e3;
+
+  if (!result->failed && _build_retrieve(c_path, out_c_path) != 0) {
+    fprintf(stderr, "Error: Could not write %s: %s\n", out_c_path, strerror(errno));
+    result->failed = 1;
+  }
+
+  if (!result->failed) {
+    char* bin_path;
+    _build_digest(build->compiler_id, output, output_len, key);
+    asprintf(&bin_path, "%s/bin/%s%s", build->cache_dir, key, build->suffix);
+
+    _build_wait_for_entry(build, bin_path);
+    if (access(bin_path, F_OK) == 0) {
+      build->bin_hits++;
+      result->bin_cache = 'h';
+      if (_build_retrieve(bin_path, out_path) != 0) {
+        fprintf(stderr, "Error: Could not write %s: %s\n", out_path, strerror(errno));
+        result->failed = 1;
+      }
+    } else {
+      build->bin_misses++;
+      result->bin_cache = 'm';
+      _build_start_job(build, file, out_c_path, bin_path, out_path);
+    }
+    free(bin_path);
+  }
+
+  free(output);
+  free(c_path);
+  free(out_path);
+  free(out_c_path);
+  free(source);
+}
+
+
+/*
+ * Helper function to print how long each file took to translate and
+ * compile, and whether each level of the cache had it.
+ */
+void _build_print_summary(struct build* build, int num_files, FILE* stream) {
+  static const char* cache_names[] = { ['h'] = "hit", ['m'] = "miss", [0] = "-" };
+  fprintf(stream, "%-32s %12s %12s %6s %9s\n", "File", "translate ms", "compile ms", "C", "compiled");
+  for (int i = 0; i < num_files; i++) {
+    struct build_result* result = &build->results[i];
+    fprintf(stream, "%-32s %12.3f %12.3f %6s %9s%s\n", build->files[i], result->translate_ms,
+      result->compile_ms, cache_names[(int)result->c_cache], cache_names[(int)result->bin_cache],
+      result->failed ? "   FAILED" : "");
+  }
+}
+
+
+int build_files(struct interner* names, const struct build_options* options,
+    char** files, int num_files) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct build build = { 0 };
+  build.files = files;
+  build.results = calloc(num_files, sizeof(struct build_result));
+  if (options->cache_dir) {
+    build.cache_dir = strdup(options->cache_dir);
+  } else if (getenv("PY2C_CACHE_DIR")) {
+    build.cache_dir = strdup(getenv("PY2C_CACHE_DIR"));
+  } else if (getenv("XDG_CACHE_HOME")) {
+    asprintf(&build.cache_dir, "%s/py2c", getenv("XDG_CACHE_HOME"));
+  } else {
+    asprintf(&build.cache_dir, "%s/.cache/py2c", getenv("HOME") ? getenv("HOME") : ".");
+  }
+
+  const char* cc = options->cc ? options->cc : getenv("CC") ? getenv("CC") : "gcc";
+  char* fast_cflags = NULL;
+  if (options->fast_compile) {
+    char* gold = _build_which("ld.gold");
+    asprintf(&fast_cflags, "%s%s", FAST_COMPILE_CFLAGS, gold ? " -fuse-ld=gold" : "");
+    free(gold);
+  }
+  const char* cflags = options->cflags ? options->cflags
+    : fast_cflags ? fast_cflags : getenv("CFLAGS") ? getenv("CFLAGS") : "";
+  build.compact = options->fast_compile;
+
+  /*
+   * Split the flags into the compiler's arguments, leaving room for the
+   * output and input paths.
+   */
+  char* flags = strdup(cflags);
+  build.cc_argv = malloc((strlen(cflags) / 2 + 6) * sizeof(char*));
+  build.cc_argv[build.cc_argc++] = (char*)cc;
+  build.suffix = "";
+  for (char* flag = strtok(flags, " \t"); flag; flag = strtok(NULL, " \t")) {
+    build.cc_argv[build.cc_argc++] = flag;
+    if (strcmp(flag, "-c") == 0) {
+      build.suffix = ".o";
+    }
+  }
+
+  /*
+   * Under a jobserver, make decides how many jobs run at once, unless -j
+   * says otherwise.  Without one, the default is a job per CPU.
+   */
+  _build_jobserver_open(&build);
+  build.max_jobs = options->jobs;
+  if (build.max_jobs <= 0) {
+    build.max_jobs = build.jobserver_read >= 0 ? num_files : sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (build.max_jobs > num_files) {
+    build.max_jobs = num_files > 0 ? num_files : 1;
+  }
+  build.jobs = calloc(build.max_jobs, sizeof(struct build_job));
+  build.tokens = malloc(build.max_jobs);
+
+  /*
+   * Exits of compilers are waited for with a signalfd, so SIGCHLD is blocked
+   * here, but not in the compilers.
+   */
+  sigset_t sigchld, old_mask;
+  sigemptyset(&sigchld);
+  sigaddset(&sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &sigchld, &old_mask);
+  build.signals = signalfd(-1, &sigchld, SFD_NONBLOCK | SFD_CLOEXEC);
+  posix_spawnattr_init(&build.spawn_attr);
+  posix_spawnattr_setsigmask(&build.spawn_attr, &old_mask);
+  posix_spawnattr_setflags(&build.spawn_attr, POSIX_SPAWN_SETSIGMASK);
+
+  char* subdir;
+  int status = 0;
+  for (int i = 0; i < 2 && !status; i++) {
+    asprintf(&subdir, "%s/%s", build.cache_dir, i == 0 ? "c" : "bin");
+    status = _build_mkdirs(subdir);
+    free(subdir);
+  }
+  if (status || _build_mkdirs(options->outdir) != 0) {
+    fprintf(stderr, "Error: Could not create %s: %s\n", status ? build.cache_dir : options->outdir,
+      strerror(errno));
+    status = 1;
+  } else if (_build_check_outputs(&build, options->outdir, num_files) != 0) {
+    status = 1;
+  } else {
+    _build_translator_id(build.translator_id, build.compact);
+    _build_compiler_id(cc, cflags, build.compiler_id);
+    for (int i = 0; i < num_files; i++) {
+      _build_file(&build, names, options->outdir, i);
+    }
+    while (build.num_jobs > 0) {
+      _build_reap(&build);
+      if (build.num_jobs > 0) {
+        struct pollfd fd = { .fd = build.signals, .events = POLLIN };
+        poll(&fd, 1, -1);
+      }
+    }
+    for (int i = 0; i < num_files; i++) {
+      status |= build.results[i].failed;
+    }
+  }
+
+  if (options->stats) {
+    _build_print_summary(&build, num_files, stderr);
+    fprintf(stderr, "Build: %d files in %.3f s (%.3f s translating, %.3f s compiling over %d %s)\n",
+      num_files, _build_elapsed(&start), build.translate_secs, build.compile_secs, build.max_jobs,
+      build.jobserver_write >= 0 ? "jobs at most, sharing make's jobserver" : "jobs at most");
+    fprintf(stderr, "C cache: %d hits, %d misses; compiled cache: %d hits, %d misses (%s)\n",
+      build.c_hits, build.c_misses, build.bin_hits, build.bin_misses, build.cache_dir);
+  }
+
+  posix_spawnattr_destroy(&build.spawn_attr);
+  close(build.signals);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  _build_jobserver_close(&build);
+  free(build.tokens);
+  free(build.jobs);
+  free(build.results);
+  free(build.cc_argv);
+  free(flags);
+  free(fast_cflags);
+  free(build.cache_dir);
+  return status;
+}
@@ -0,0 +1,57 @@
+/*
+ * This file contains the declarations for build mode, which translates Python
+ * files and compiles the translations, caching both the generated C code and
+ * the compiled executables (or objects) so an unchanged file is never
+ * translated or compiled twice.  See build.c for implementation details.
+ */
+
+#ifndef __BUILD_H
+#define __BUILD_H
+
+struct interner;
+
+/*
+ * The compiler flags used by default with fast_compile.  They were picked by
+ * timing gcc on small and large translations: -Og compiles the one big
+ * main() of a large translation much faster than -O0 (whose register
+ * allocation dominates) and still compiles tiny ones as fast, and -pipe and
+ * leaving out unwind tables shave a little off every compile.  -fuse-ld=gold
+ * is added when gold is installed, since linking is most of the time taken
+ * for a tiny program.
+ */
+#define FAST_COMPILE_CFLAGS "-Og -pipe -fno-asynchronous-unwind-tables"
+
+/*
+ * Options for a build.  Any of the strings may be NULL for the default: the
+ * cache directory is $PY2C_CACHE_DIR, or py2c in $XDG_CACHE_HOME or ~/.cache;
+ * the compiler is $CC, or gcc; and the compiler flags are $CFLAGS, or none.
+ * If the flags include -c, objects are built instead of executables.
+ * `fast_compile` makes the translations compact (see --fast-compile) and the
+ * default flags FAST_COMPILE_CFLAGS.
+ *
+ * `jobs` limits how many compilers run at once.  If it's 0, the limit is the
+ * number of CPUs, or, when a parent GNU make passes on its jobserver (make -j
+ * with the command marked as recursive with +), just the jobserver's tokens.
+ */
+struct build_options {
+  const char* outdir;
+  const char* cache_dir;
+  const char* cc;
+  const char* cflags;
+  int jobs;
+  int fast_compile;
+  int stats;
+};
+
+/*
+ * Translates each of `num_files` Python files to a .c file in `outdir` and
+ * compiles it to an executable (or a .o object) named after the file.  Names
+ * are interned in `names`.  Diagnostics are written to stderr, a file at a
+ * time, and with the stats option a summary of the time spent on each file.
+ * Nothing is built if two files would have the same outputs.  Returns 0 if
+ * every file was built successfully or 1 otherwise.
+ */
+int build_files(struct interner* names, const struct build_options* options,
+    char** files, int num_files);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ * This file contains the implementation of bundles.  A bundle being read is
+ * mapped into memory once, and entries are returned as pointers into the
+ * mapping, so translating a bundle doesn't need any further system calls.  A
+ * bundle being built keeps its entries in memory until it's saved, since the
+ * index has to be written before the data.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "bundle.h"
+
+#define BUNDLE_MAGIC "PY2CBNDL"
+#define BUNDLE_VERSION 1
+#define BUNDLE_HEADER_SIZE 16
+#define BUNDLE_RECORD_SIZE 32
+
+/*
+ * This structure is used to represent a mapped bundle.
+ */
+struct bundle {
+  const unsigned char* base;
+  size_t size;
+  size_t count;
+};
+
+/*
+ * This structure is used to represent a bundle being built.  Names and data
+ * are stored back to back in `buf`; each entry records where its name and data start.
+ */
+struct bundle_entry {
+  size_t name_offset;
+  size_t name_len;
+  size_t data_offset;
+  size_t data_len;
+};
+
+struct bundle_writer {
+  struct bundle_entry* entries;
+  size_t count;
+  size_t capacity;
+  char* buf;
+  size_t buf_len;
+  size_t buf_capacity;
+};
+
+
+/*
+ * Helper functions to read and write little-endian integers.
+ */
+uint64_t _get_le(const unsigned char* p, int bytes) {
+  uint64_t v = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+void _put_le(unsigned char* p, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    p[i] = v & 0xff;
+    v >>= 8;
+  }
+}
+
+
+/*
+ * Helper function to return the index record for entry `i`.
+ */
+const unsigned char* _record(struct bundle* b, size_t i) {
+  return b->base + BUNDLE_HEADER_SIZE + i * BUNDLE_RECORD_SIZE;
+}
+
+
+/*
+ * Helper function to check that a range lies within the bundle.
+ */
+int _in_bounds(struct bundle* b, uint64_t offset, uint64_t len) {
+  return offset <= b->size && len <= b->size - offset;
+}
+
+
+/*
+ * Maps the bundle at `path` and validates its header and index.
+ */
+struct bundle* bundle_open(const char* path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  struct bundle* b = calloc(1, sizeof(struct bundle));
+  assert(b);
+  b->size = st.st_size;
+  if (b->size < BUNDLE_HEADER_SIZE) {
+    close(fd);
+    free(b);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  void* base = mmap(NULL, b->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    free(b);
+    return NULL;
+  }
+  madvise(base, b->size, MADV_SEQUENTIAL);
+  b->base = base;
+
+  int valid = memcmp(b->base, BUNDLE_MAGIC, 8) == 0
+      && _get_le(b->base + 8, 4) == BUNDLE_VERSION;
+  if (valid) {
+    b->count = _get_le(b->base + 12, 4);
+    valid = _in_bounds(b, BUNDLE_HEADER_SIZE, (uint64_t)b->count * BUNDLE_RECORD_SIZE);
+  }
+  for (size_t i = 0; valid && i < b->count; i++) {
+    const unsigned char* r = _record(b, i);
+    valid = _in_bounds(b, _get_le(r, 8), _get_le(r + 24, 4))
+        && _in_bounds(b, _get_le(r + 8, 8), _get_le(r + 16, 8));
+  }
+
+  if (!valid) {
+    bundle_close(b);
+    errno = EINVAL;
+    return NULL;
+  }
+  return b;
+}
+
+
+/*
+ * Unmaps a bundle.
+ */
+void bundle_close(struct bundle* b) {
+  assert(b);
+  munmap((void*)b->base, b->size);
+  free(b);
+}
+
+
+/*
+ * Returns the number of entries in a bundle.
+ */
+size_t bundle_count(struct bundle* b) {
+  assert(b);
+  return b->count;
+}
+
+
+/*
+ * Returns the name of entry `i`.
+ */
+const char* bundle_name(struct bundle* b, size_t i, size_t* len) {
+  assert(b);
+  assert(i < b->count);
+  const unsigned char* r = _record(b, i);
+  *len = _get_le(r + 24, 4);
+  return (const char*)b->base + _get_le(r, 8);
+}
+
+
+/*
+ * Returns the data of entry `i`.
+ */
+const char* bundle_data(struct bundle* b, size_t i, size_t* len) {
+  assert(b);
+  assert(i < b->count);
+  const unsigned char* r = _record(b, i);
+  *len = _get_le(r + 16, 8);
+  return (const char*)b->base + _get_le(r + 8, 8);
+}
+
+
+/*
+ * Create a new, empty bundle writer.
+ */
+struct bundle_writer* bundle_writer_create() {
+  struct bundle_writer* w = calloc(1, sizeof(struct bundle_writer));
+  assert(w);
+  return w;
+}
+
+
+/*
+ * Free a bundle writer.
+ */
+void bundle_writer_free(struct bundle_writer* w) {
+  assert(w);
+  free(w->entries);
+  free(w->buf);
+  free(w);
+}
+
+
+/*
+ * Helper function to append bytes to a writer's buffer, returning the offset
+ * at which they were stored.
+ */
+size_t _writer_append(struct bundle_writer* w, const char* data, size_t len) {
+  if (w->buf_len + len > w->buf_capacity) {
+    while (w->buf_len + len > w->buf_capacity) {
+      w->buf_capacity = w->buf_capacity ? 2 * w->buf_capacity : 65536;
+    }
+    w->buf = realloc(w->buf, w->buf_capacity);
+    assert(w->buf);
+  }
+
+  size_t offset = w->buf_len;
+  memcpy(w->buf + offset, data, len);
+  w->buf_len += len;
+  return offset;
+}
+
+
+/*
+ * Adds an entry to a bundle writer.
+ */
+void bundle_writer_add(struct bundle_writer* w, const char* name, size_t name_len,
+    const char* data, size_t len) {
+  assert(w);
+  if (w->count == w->capacity) {
+    w->capacity = w->capacity ? 2 * w->capacity : 64;
+    w->entries = realloc(w->entries, w->capacity * sizeof(struct bundle_entry));
+    assert(w->entries);
+  }
+
+  struct bundle_entry* e = &w->entries[w->count++];
+  e->name_offset = _writer_append(w, name, name_len);
+  e->name_len = name_len;
+  e->data_offset = _writer_append(w, data, len);
+  e->data_len = len;
+}
+
+
+/*
+ * Writes a bundle.  The header and index are built in one buffer, so saving
+ * takes two writes however many entries there are.
+ */
+int bundle_writer_save(struct bundle_writer* w, const char* path) {
+  assert(w);
+  size_t index_size = BUNDLE_HEADER_SIZE + w->count * BUNDLE_RECORD_SIZE;
+  unsigned char* index = calloc(1, index_size);
+  assert(index);
+
+  memcpy(index, BUNDLE_MAGIC, 8);
+  _put_le(index + 8, BUNDLE_VERSION, 4);
+  _put_le(index + 12, w->count, 4);
+  for (size_t i = 0; i < w->count; i++) {
+    unsigned char* r = index + BUNDLE_HEADER_SIZE + i * BUNDLE_RECORD_SIZE;
+    struct bundle_entry* e = &w->entries[i];
+    _put_le(r, index_size + e->name_offset, 8);
+    _put_le(r + 8, index_size + e->data_offset, 8);
+    _put_le(r + 16, e->data_len, 8);
+    _put_le(r + 24, e->name_len, 4);
+  }
+
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    free(index);
+    return -1;
+  }
+  fwrite(index, 1, index_size, f);
+  fwrite(w->buf, 1, w->buf_len, f);
+  free(index);
+
+  int failed = ferror(f);
+  if (fclose(f) != 0 || failed) {
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * This file contains the declarations for bundles, single files holding many
+ * named source (or output) files, so a whole corpus can be translated without
+ * opening each file separately.
+ *
+ * A bundle is a 16-byte header (the magic string "PY2CBNDL", a 32-bit format
+ * version and a 32-bit entry count), followed by an index with one 32-byte
+ * record per entry (64-bit offsets of the entry's name and data, the 64-bit
+ * data length, the 32-bit name length and 4 bytes of padding), followed by
+ * the names and data themselves, concatenated.  Offsets are from the start of
+ * the bundle and all integers are little-endian.  See bundle.c for
+ * implementation details.
+ */
+
+#ifndef __BUNDLE_H
+#define __BUNDLE_H
+
+#include <stddef.h>
+
+/*
+ * Structure used to represent a bundle opened for reading.
+ */
+struct bundle;
+
+/*
+ * Structure used to represent a bundle being built.
+ */
+struct bundle_writer;
+
+/*
+ * Maps the bundle at `path` into memory.  Returns NULL, with errno set, if
+ * the file can't be read or isn't a valid bundle (EINVAL).
+ */
+struct bundle* bundle_open(const char* path);
+
+/*
+ * Unmaps a bundle.  Names and data returned for its entries are no longer
+ * valid afterwards.
+ */
+void bundle_close(struct bundle* b);
+
+/*
+ * Returns the number of entries in a bundle.
+ */
+size_t bundle_count(struct bundle* b);
+
+/*
+ * Returns the name of entry `i` and stores its length in `len`.  The name
+ * points into the mapped bundle and isn't NUL-terminated.
+ */
+const char* bundle_name(struct bundle* b, size_t i, size_t* len);
+
+/*
+ * Returns the data of entry `i` and stores its length in `len`.  The data
+ * points into the mapped bundle and isn't NUL-terminated.
+ */
+const char* bundle_data(struct bundle* b, size_t i, size_t* len);
+
+/*
+ * Create a new, empty bundle writer.
+ */
+struct bundle_writer* bundle_writer_create();
+
+/*
+ * Free a bundle writer and all of the entries added to it.
+ */
+void bundle_writer_free(struct bundle_writer* w);
+
+/*
+ * Adds an entry to a bundle writer.  The name and data are copied.
+ */
+void bundle_writer_add(struct bundle_writer* w, const char* name, size_t name_len,
+    const char* data, size_t len);
+
+/*
+ * Writes every entry added so far as a bundle to the file at `path`.  Returns
+ * 0 on success or -1, with errno set, on failure.
+ */
+int bundle_writer_save(struct bundle_writer* w, const char* path);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * This file contains a small utility for converting between directories of
+ * files and bundles:
+ *
+ *   bundletool pack <dir> <bundle>     bundles every regular file in <dir>
+ *   bundletool unpack <bundle> <dir>   writes every entry of <bundle> to <dir>
+ *
+ * Entries are packed in name order.  See bundle.h for the bundle format.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "bundle.h"
+#include "../fileio/fileio.h"
+
+/*
+ * Bundles every regular file in `dir`.
+ */
+int pack(const char* dir, const char* path) {
+  struct dirent** names;
+  int n = scandir(dir, &names, NULL, alphasort);
+  if (n < 0) {
+    fprintf(stderr, "Error: Could not read %s: %s\n", dir, strerror(errno));
+    return 1;
+  }
+
+  struct bundle_writer* w = bundle_writer_create();
+  int status = 0;
+  for (int i = 0; i < n; i++) {
+    char* file;
+    asprintf(&file, "%s/%s", dir, names[i]->d_name);
+
+    struct stat st;
+    size_t len;
+    char* data;
+    if (stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
+      if ((data = fileio_read_file(file, &len)) != NULL) {
+        bundle_writer_add(w, names[i]->d_name, strlen(names[i]->d_name), data, len);
+        free(data);
+      } else {
+        fprintf(stderr, "Error: Could not read %s\n", file);
+        status = 1;
+      }
+    }
+
+    free(file);
+    free(names[i]);
+  }
+  free(names);
+
+  if (bundle_writer_save(w, path) != 0) {
+    fprintf(stderr, "Error: Could not write %s: %s\n", path, strerror(errno));
+    status = 1;
+  }
+  bundle_writer_free(w);
+  return status;
+}
+
+
+/*
+ * Writes every entry of the bundle at `path` to a file in `dir`.  Entries
+ * whose names could escape `dir` are skipped.
+ */
+int unpack(const char* path, const char* dir) {
+  struct bundle* b = bundle_open(path);
+  if (!b) {
+    fprintf(stderr, "Error: Could not open bundle %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  mkdir(dir, 0755);
+
+  int status = 0;
+  for (size_t i = 0; i < bundle_count(b); i++) {
+    size_t name_len, len;
+    const char* name = bundle_name(b, i, &name_len);
+    const char* data = bundle_data(b, i, &len);
+
+    if (name_len == 0 || memchr(name, '/', name_len) || memchr(name, '\0', name_len)
+        || (name_len <= 2 && strncmp(name, "..", name_len) == 0)) {
+      fprintf(stderr, "Error: Skipping entry with invalid name\n");
+      status = 1;
+      continue;
+    }
+
+    char* file;
+    asprintf(&file, "%s/%.*s", dir, (int)name_len, name);
+    FILE* f = fopen(file, "wb");
+    int failed = !f;
+    if (f) {
+      failed = fwrite(data, 1, len, f) != len;
+      failed |= fclose(f) != 0;
+    }
+    if (failed) {
+      fprintf(stderr, "Error: Could not write %s\n", file);
+      status = 1;
+    }
+    free(file);
+  }
+
+  bundle_close(b);
+  return status;
+}
+
+
+int main(int argc, char** argv) {
+  if (argc == 4 && strcmp(argv[1], "pack") == 0) {
+    return pack(argv[2], argv[3]);
+  } else if (argc == 4 && strcmp(argv[1], "unpack") == 0) {
+    return unpack(argv[2], argv[3]);
+  }
+
+  fprintf(stderr, "Usage: %s pack <dir> <bundle>\n"
+      "       %s unpack <bundle> <dir>\n", argv[0], argv[0]);
+  return 1;
+}
@@ -0,0 +1,144 @@
+#!/bin/bash
+
+#
+# Measures how much less time gcc takes on --fast-compile output than on the
+# translator's normal output, separating the effect of the output format from
+# the effect of the flags build mode uses for --fast-compile.  Each program
+# that translates in testing_code/, and each program in a generated corpus of
+# larger programs, is translated both ways and compiled three times: the
+# normal output with no flags (the way test.sh compiles it), the compact
+# output with no flags, and the compact output with the --fast-compile flags.
+# The report gives the median gcc wall time of each, the reduction the format
+# gives (normal vs. compact, both with no flags), the reduction the flags give
+# (compact with no flags vs. with the flags) and the overall reduction, for
+# each file and for each corpus as a whole.  All three binaries must print the
+# same values.  A report is written as JSON to output_files/compiletime.json.
+#
+# The exit status is 1 if any program fails to compile or prints different
+# values from the normal output.
+#
+
+output_dir="output_files"
+work_dir="$output_dir/compiletime"
+synthetic_dir="$work_dir/synthetic"
+report="$output_dir/compiletime.json"
+RUNS=${RUNS:-5}
+SYNTHETIC_FILES=${SYNTHETIC_FILES:-12}
+
+fast_flags=$(sed -n 's/^#define FAST_COMPILE_CFLAGS "\(.*\)"$/\1/p' build/build.h)
+if command -v ld.gold > /dev/null; then
+    fast_flags="$fast_flags -fuse-ld=gold"
+fi
+gcc=$(command -v gcc)
+
+rm -rf $synthetic_dir
+mkdir -p $synthetic_dir
+
+echo "Compiling Parser..."
+make parse runstat || exit 1
+
+#
+# Generates the synthetic corpus: programs of straight-line arithmetic with
+# the odd conditional, from a few dozen to a few thousand statements.
+#
+python3 -c '
+import random, sys
+random.seed(1)
+for n in range(int(sys.argv[2])):
+    size = int(40 * 1.5 ** n)
+    lines = ["v0 = 1"]
+    for i in range(1, size):
+        a, b = random.randrange(i), random.randrange(i)
+        lines.append("v%d = v%d * %d + v%d - %d / 3" % (i, a, i % 7 + 1, b, i))
+        if i % 50 == 0:
+            lines.append("if v%d > v%d:\n    v%d = v%d + 1\nelse:\n    v%d = 2" % (a, b, a, b, a))
+    open("%s/synthetic%02d.py" % (sys.argv[1], n), "w").write("\n".join(lines) + "\n")
+' $synthetic_dir $SYNTHETIC_FILES
+
+#
+# Prints the median wall-clock seconds of running command $@.
+#
+measure() {
+    for ((r = 0; r < RUNS; r++)); do
+        ./runstat /dev/null "$@"
+    done | sort -n | awk -v runs=$RUNS 'NR == int(runs / 2) + 1 { print $1 }'
+}
+
+#
+# Prints the percentage by which time $2 is less than time $1.
+#
+reduction() {
+    awk -v a=$1 -v b=$2 'BEGIN { print (a > 0 ? 100 * (a - b) / a : 0) }'
+}
+
+#
+# Prints seconds $1 in milliseconds.
+#
+ms() {
+    awk -v t=$1 'BEGIN { print t * 1e3 }'
+}
+
+status=0
+echo "[" > $report
+first=1
+
+echo
+echo "Flags for the compact output: gcc $fast_flags"
+
+for corpus in testing_code $synthetic_dir; do
+    printf "\n%-18s %6s %10s %10s %10s %8s %8s %8s\n" "Program" "lines" \
+        "normal ms" "compact ms" "flags ms" "format" "flags" "total"
+    total_normal=0
+    total_compact=0
+    total_fast=0
+
+    for program in $corpus/*.py; do
+        name=$(basename $program .py)
+        ./parse < $program > $work_dir/$name.c 2> /dev/null || continue
+        ./parse --fast-compile < $program > $work_dir/$name.fast.c
+        rm -f $work_dir/$name $work_dir/$name.compact $work_dir/$name.fast
+
+        normal_time=$(measure $gcc $work_dir/$name.c -o $work_dir/$name)
+        compact_time=$(measure $gcc $work_dir/$name.fast.c -o $work_dir/$name.compact)
+        fast_time=$(measure $gcc $fast_flags $work_dir/$name.fast.c -o $work_dir/$name.fast)
+        if [[ ! -x $work_dir/$name || ! -x $work_dir/$name.compact || ! -x $work_dir/$name.fast ]]; then
+            printf "%-18s FAIL (could not compile)\n" $name
+            status=1
+            continue
+        fi
+
+        matched=true
+        if ! cmp -s <($work_dir/$name) <($work_dir/$name.compact) \
+                || ! cmp -s <($work_dir/$name) <($work_dir/$name.fast); then
+            matched=false
+            status=1
+        fi
+
+        printf "%-18s %6d %10.1f %10.1f %10.1f %7.1f%% %7.1f%% %7.1f%%" $name $(wc -l < $program) \
+            $(ms $normal_time) $(ms $compact_time) $(ms $fast_time) \
+            $(reduction $normal_time $compact_time) $(reduction $compact_time $fast_time) \
+            $(reduction $normal_time $fast_time)
+        [[ $matched == true ]] || printf "   MISMATCH"
+        printf "\n"
+
+        total_normal=$(awk -v a=$total_normal -v b=$normal_time 'BEGIN { print a + b }')
+        total_compact=$(awk -v a=$total_compact -v b=$compact_time 'BEGIN { print a + b }')
+        total_fast=$(awk -v a=$total_fast -v b=$fast_time 'BEGIN { print a + b }')
+
+        [[ $first -eq 1 ]] || echo "," >> $report
+        first=0
+        printf '  {"corpus": "%s", "program": "%s", "normal_seconds": %s, "compact_seconds": %s, "fast_seconds": %s, "values_match": %s}' \
+            $(basename $corpus) $name $normal_time $compact_time $fast_time $matched >> $report
+    done
+
+    printf "%-18s %6s %10.1f %10.1f %10.1f %7.1f%% %7.1f%% %7.1f%%\n" "total" "" \
+        $(ms $total_normal) $(ms $total_compact) $(ms $total_fast) \
+        $(reduction $total_normal $total_compact) $(reduction $total_compact $total_fast) \
+        $(reduction $total_normal $total_fast)
+done
+
+printf "\n]\n" >> $report
+
+echo
+echo "Report written to $report"
+exit $status
@@ -0,0 +1,496 @@
+/*
+ * This file contains the implementation of hash-consed expression trees.
+ * Node fields are stored column by column in flat arrays indexed by node ID,
+ * and children are referred to by ID.  Every node is also entered in an
+ * open-addressing lookup table keyed on its fields.  Since children are
+ * themselves shared, comparing a candidate node against a stored one only
+ * needs to compare child IDs, never whole subtrees.
+ *
+ * A child is parenthesized in the C code only when C's precedence table says
+ * it has to be: when it binds less tightly than its parent, or (since every C
+ * operator used here but ?: is left-associative) when it's a right operand
+ * that binds exactly as tightly.  So whether a child is wrapped depends only
+ * on the child and its parent, and each node's C code, not counting
+ * parentheses around the node itself, is the same wherever it's used.
+ *
+ * Python's `and` and `or` give the value of one of their operands, not 0 or 1
+ * as C's && and || do, so they're written with ?:, as `a ? b : a` and
+ * `a ? a : b`.  Since `a` is written twice, a chain of them would double in
+ * length with every operator if it leaned left, so the parser builds chains
+ * leaning right, which gives the same value.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "expr.h"
+#include "../hash/hash.h"
+#include "../intern/intern.h"
+
+/*
+ * The initial capacity of the node arrays and of the lookup table (which
+ * must be a power of 2).
+ */
+#define INITIAL_CAPACITY 256
+
+/*
+ * Markers used in expr_to_string()'s stack.  Node IDs never have either of
+ * the high two bits set.
+ */
+#define PENDING_TEXT 0x80000000u
+#define WRAPPED 0x40000000u
+#define CLOSE_PAREN 0xffffffffu
+#define COLON 0xfffffffeu
+
+/*
+ * The C spelling of each operator, indexed by enum expr_op.  For `and` and
+ * `or` it's the part of ?: after the condition.
+ */
+static const char* _op_text[] = {
+  " + ", " - ", " * ", " / ", " == ", " != ", " > ", " >= ", " < ", " <= ",
+  " ? ", " ? ", " && ", "!"
+};
+
+/*
+ * How tightly each C operator binds (higher is tighter), indexed by enum
+ * expr_op, and how tightly a leaf does.
+ */
+static const uint8_t _op_precedence[] = {
+  [OP_TIMES] = 13, [OP_DIVIDEDBY] = 13,
+  [OP_PLUS] = 12, [OP_MINUS] = 12,
+  [OP_GT] = 10, [OP_GTE] = 10, [OP_LT] = 10, [OP_LTE] = 10,
+  [OP_EQ] = 9, [OP_NEQ] = 9,
+  [OP_CHAIN] = 5,
+  [OP_AND] = 3, [OP_OR] = 3,
+  [OP_NOT] = 14
+};
+#define LEAF_PRECEDENCE 16
+
+/*
+ * This structure is used to represent the expression table itself.  The
+ * node columns are:
+ *   - `kinds`, `ops`: the node's enum expr_kind and enum expr_op
+ *   - `lefts`, `rights`: the IDs of the node's children, if it has them
+ *   - `texts`: the interned ID of a leaf's text
+ *   - `lengths`: the length of the C code for the whole subtree
+ * `slots` holds node ID + 1 for each occupied lookup table slot, or 0 for an
+ * empty one.
+ */
+struct expr_table {
+  struct interner* interner;
+  uint8_t* kinds;
+  uint8_t* ops;
+  uint32_t* lefts;
+  uint32_t* rights;
+  uint32_t* texts;
+  uint32_t* lengths;
+  uint32_t size;
+  uint32_t capacity;
+  uint32_t* slots;
+  uint32_t num_slots;
+  size_t requests;
+};
+
+
+/*
+ * Helper function to (re)allocate the node columns to a given capacity.
+ */
+void _expr_columns_alloc(struct expr_table* table, uint32_t capacity) {
+  table->kinds = realloc(table->kinds, capacity * sizeof(uint8_t));
+  table->ops = realloc(table->ops, capacity * sizeof(uint8_t));
+  table->lefts = realloc(table->lefts, capacity * sizeof(uint32_t));
+  table->rights = realloc(table->rights, capacity * sizeof(uint32_t));
+  table->texts = realloc(table->texts, capacity * sizeof(uint32_t));
+  table->lengths = realloc(table->lengths, capacity * sizeof(uint32_t));
+  assert(table->kinds && table->ops && table->lefts && table->rights
+      && table->texts && table->lengths);
+  table->capacity = capacity;
+}
+
+
+/*
+ * Create a new expression table.
+ */
+struct expr_table* expr_table_create(struct interner* interner) {
+  struct expr_table* table = calloc(1, sizeof(struct expr_table));
+  assert(table);
+  table->interner = interner;
+  _expr_columns_alloc(table, INITIAL_CAPACITY);
+  table->num_slots = 2 * INITIAL_CAPACITY;
+  table->slots = calloc(table->num_slots, sizeof(uint32_t));
+  assert(table->slots);
+  return table;
+}
+
+
+/*
+ * Free the memory associated with an expression table, including every node
+ * created through it.
+ */
+void expr_table_free(struct expr_table* table) {
+  assert(table);
+  free(table->kinds);
+  free(table->ops);
+  free(table->lefts);
+  free(table->rights);
+  free(table->texts);
+  free(table->lengths);
+  free(table->slots);
+  free(table);
+}
+
+
+/*
+ * Helper function to compute the hash value of a node's fields.
+ */
+uint32_t _expr_hash(uint8_t kind, uint8_t op, uint32_t left, uint32_t right,
+    uint32_t text) {
+  uint32_t key[4] = { (uint32_t)kind << 8 | op, left, right, text };
+  return (uint32_t)hash_bytes(key, sizeof(key));
+}
+
+
+/*
+ * Helper function to double the size of the lookup table.  Node IDs are
+ * re-inserted in a single sweep over the node columns.
+ */
+void _expr_slots_resize(struct expr_table* table) {
+  free(table->slots);
+  table->num_slots *= 2;
+  table->slots = calloc(table->num_slots, sizeof(uint32_t));
+  assert(table->slots);
+
+  uint32_t mask = table->num_slots - 1;
+  for (uint32_t id = 0; id < table->size; id++) {
+    uint32_t idx = _expr_hash(table->kinds[id], table->ops[id], table->lefts[id],
+        table->rights[id], table->texts[id]) & mask;
+    while (table->slots[idx] != 0) {
+      idx = (idx + 1) & mask;
+    }
+    table->slots[idx] = id + 1;
+  }
+}
+
+
+/*
+ * Helper function that returns the index of the lookup table slot holding the
+ * node with the given fields, or of the empty slot where it would go.
+ */
+uint32_t _expr_slot(struct expr_table* table, uint8_t kind, uint8_t op,
+    uint32_t left, uint32_t right, uint32_t text) {
+  uint32_t mask = table->num_slots - 1;
+  uint32_t idx = _expr_hash(kind, op, left, right, text) & mask;
+  while (table->slots[idx] != 0) {
+    uint32_t id = table->slots[idx] - 1;
+    if (table->kinds[id] == kind && table->ops[id] == op && table->lefts[id] == left
+        && table->rights[id] == right && table->texts[id] == text) {
+      break;
+    }
+    idx = (idx + 1) & mask;
+  }
+  return idx;
+}
+
+
+/*
+ * Helper function that returns the ID of the stored node with the given
+ * fields, appending it to the node columns if there isn't one yet.
+ */
+expr_id _expr_intern(struct expr_table* table, uint8_t kind, uint8_t op,
+    uint32_t left, uint32_t right, uint32_t text, uint32_t length) {
+  table->requests++;
+
+  uint32_t idx = _expr_slot(table, kind, op, left, right, text);
+  if (table->slots[idx] != 0) {
+    return table->slots[idx] - 1;
+  }
+
+  if (table->size == table->capacity) {
+    assert(table->capacity < WRAPPED);
+    _expr_columns_alloc(table, 2 * table->capacity);
+  }
+
+  uint32_t id = table->size++;
+  table->kinds[id] = kind;
+  table->ops[id] = op;
+  table->lefts[id] = left;
+  table->rights[id] = right;
+  table->texts[id] = text;
+  table->lengths[id] = length;
+  table->slots[idx] = id + 1;
+
+  /*
+   * Keep the lookup table at most half full.
+   */
+  if (2 * table->size > table->num_slots) {
+    _expr_slots_resize(table);
+  }
+
+  return id;
+}
+
+
+/*
+ * Returns a leaf node with the given C text.
+ */
+expr_id expr_leaf(struct expr_table* table, const char* text) {
+  assert(table);
+  size_t l = strlen(text);
+  uint32_t text_id = intern_id(intern_string(table->interner, text, l));
+  return _expr_intern(table, EXPR_LEAF, 0, 0, 0, text_id, l);
+}
+
+
+/*
+ * Returns a node for a parenthesized expression.
+ */
+expr_id expr_paren(struct expr_table* table, expr_id inner) {
+  assert(table);
+  assert(inner < table->size);
+  return _expr_intern(table, EXPR_PAREN, 0, inner, 0, 0, table->lengths[inner]);
+}
+
+
+/*
+ * Helper function returning how tightly the C code for a node binds.
+ */
+uint8_t _expr_precedence(struct expr_table* table, expr_id id) {
+  while (table->kinds[id] == EXPR_PAREN) {
+    id = table->lefts[id];
+  }
+  return table->kinds[id] == EXPR_LEAF ? LEAF_PRECEDENCE : _op_precedence[table->ops[id]];
+}
+
+
+/*
+ * Helper function returning whether `child` needs to be parenthesized as an
+ * operand of `op`.  `right` is set for the right operand of a binary
+ * operator.
+ */
+int _expr_wrapped(struct expr_table* table, enum expr_op op, expr_id child, int right) {
+  uint8_t precedence = _expr_precedence(table, child);
+  return precedence < _op_precedence[op] || (right && precedence == _op_precedence[op]);
+}
+
+
+/*
+ * Returns a node applying a binary operator to two expressions.  For `and`
+ * and `or`, the left operand is both the condition of the ?:, where it's
+ * wrapped as a right operand would be (since ?: groups to the right), and one
+ * of its results.  The middle result is never wrapped, and the last one is
+ * wrapped as a left operand would be.
+ */
+expr_id expr_binary(struct expr_table* table, enum expr_op op, expr_id left,
+    expr_id right) {
+  assert(table);
+  assert(left < table->size && right < table->size);
+  uint64_t length;
+  if (op == OP_AND || op == OP_OR) {
+    expr_id last = op == OP_AND ? left : right;
+    length = 2 * (uint64_t)table->lengths[left] + strlen(_op_text[op]) + strlen(" : ")
+      + table->lengths[right] + 2 * _expr_wrapped(table, op, left, 1)
+      + 2 * _expr_wrapped(table, op, last, 0);
+  } else {
+    length = (uint64_t)table->lengths[left] + strlen(_op_text[op]) + table->lengths[right]
+      + 2 * _expr_wrapped(table, op, left, 0) + 2 * _expr_wrapped(table, op, right, 1);
+  }
+  if (length > EXPR_MAX_LENGTH) {
+    return EXPR_NONE;
+  }
+  return _expr_intern(table, EXPR_BINARY, op, left, right, 0, length);
+}
+
+
+/*
+ * Returns a node applying a unary operator to an expression.
+ */
+expr_id expr_unary(struct expr_table* table, enum expr_op op, expr_id operand) {
+  assert(table);
+  assert(operand < table->size);
+  uint32_t length = strlen(_op_text[op]) + table->lengths[operand]
+    + 2 * _expr_wrapped(table, op, operand, 0);
+  return _expr_intern(table, EXPR_UNARY, op, operand, 0, 0, length);
+}
+
+
+/*
+ * Returns a node comparing two expressions, continuing a chain of
+ * comparisons in `left` if there is one.  A chain is built as a left-leaning
+ * tree of ands of comparisons, so the last comparison in `left` is either
+ * `left` itself or its right operand.
+ */
+expr_id expr_compare(struct expr_table* table, enum expr_op op, expr_id left,
+    expr_id right) {
+  assert(table);
+  assert(left < table->size && right < table->size);
+
+  expr_id last = left;
+  if (table->kinds[last] == EXPR_BINARY && table->ops[last] == OP_CHAIN) {
+    last = table->rights[last];
+  }
+  if (table->kinds[last] != EXPR_BINARY || table->ops[last] < OP_EQ || table->ops[last] > OP_LTE) {
+    return expr_binary(table, op, left, right);
+  }
+  expr_id comparison = expr_binary(table, op, table->rights[last], right);
+  return comparison == EXPR_NONE ? EXPR_NONE : expr_binary(table, OP_CHAIN, left, comparison);
+}
+
+
+/*
+ * Returns the node applying a binary operator to two expressions if one has
+ * already been built, or EXPR_NONE if not.
+ */
+expr_id expr_find_binary(struct expr_table* table, enum expr_op op, expr_id left,
+    expr_id right) {
+  assert(table);
+  uint32_t idx = _expr_slot(table, EXPR_BINARY, op, left, right, 0);
+  return table->slots[idx] ? table->slots[idx] - 1 : EXPR_NONE;
+}
+
+
+/*
+ * Returns the length of the C code for an expression.
+ */
+size_t expr_length(struct expr_table* table, expr_id expr) {
+  assert(table);
+  assert(expr < table->size);
+  return table->lengths[expr];
+}
+
+
+/*
+ * Writes the C code for an expression to `out`.
+ *
+ * The expression is written out in order using an explicit stack of pending
+ * work instead of recursion.  A stack entry is either a node ID still to be
+ * written, with WRAPPED set if it needs parentheses, or, when its high bit is
+ * set, the index of an operator string (or a closing parenthesis, or the
+ * colon of a ?:) to write once the node's left side is done.  Nothing in the
+ * table is changed, so any number of threads can write expressions from a
+ * table at once as long as no nodes are being added to it.
+ */
+void expr_write(struct expr_table* table, expr_id expr, char* out) {
+  assert(table);
+  assert(expr < table->size);
+
+  size_t stack_capacity = 64, top = 0;
+  uint32_t* stack = malloc(stack_capacity * sizeof(uint32_t));
+  assert(stack);
+  stack[top++] = expr;
+
+  while (top > 0) {
+    uint32_t item = stack[--top];
+    if (item == CLOSE_PAREN) {
+      *out++ = ')';
+      continue;
+    } else if (item == COLON) {
+      memcpy(out, " : ", 3);
+      out += 3;
+      continue;
+    } else if (item & PENDING_TEXT) {
+      const char* op = _op_text[item & ~PENDING_TEXT];
+      size_t l = strlen(op);
+      memcpy(out, op, l);
+      out += l;
+      continue;
+    }
+
+    /*
+     * Make room for the (at most six) entries pushed below.
+     */
+    if (top + 6 > stack_capacity) {
+      stack_capacity *= 2;
+      stack = realloc(stack, stack_capacity * sizeof(uint32_t));
+      assert(stack);
+    }
+
+    if (item & WRAPPED) {
+      item &= ~WRAPPED;
+      *out++ = '(';
+      stack[top++] = CLOSE_PAREN;
+    }
+
+    enum expr_op op = table->ops[item];
+    switch (table->kinds[item]) {
+      case EXPR_LEAF:
+        memcpy(out, intern_name(table->interner, table->texts[item]), table->lengths[item]);
+        out += table->lengths[item];
+        break;
+      case EXPR_PAREN:
+        stack[top++] = table->lefts[item];
+        break;
+      case EXPR_UNARY:
+        memcpy(out, _op_text[op], strlen(_op_text[op]));
+        out += strlen(_op_text[op]);
+        stack[top++] = table->lefts[item]
+          | (_expr_wrapped(table, op, table->lefts[item], 0) ? WRAPPED : 0);
+        break;
+      case EXPR_BINARY:
+        if (op == OP_AND) {
+          stack[top++] = table->lefts[item]
+            | (_expr_wrapped(table, op, table->lefts[item], 0) ? WRAPPED : 0);
+          stack[top++] = COLON;
+          stack[top++] = table->rights[item];
+        } else if (op == OP_OR) {
+          stack[top++] = table->rights[item]
+            | (_expr_wrapped(table, op, table->rights[item], 0) ? WRAPPED : 0);
+          stack[top++] = COLON;
+          stack[top++] = table->lefts[item];
+        } else {
+          stack[top++] = table->rights[item]
+            | (_expr_wrapped(table, op, table->rights[item], 1) ? WRAPPED : 0);
+        }
+        stack[top++] = PENDING_TEXT | op;
+        stack[top++] = table->lefts[item]
+          | (_expr_wrapped(table, op, table->lefts[item], op == OP_AND || op == OP_OR) ? WRAPPED : 0);
+        break;
+    }
+  }
+
+  free(stack);
+}
+
+
+/*
+ * Returns a newly-allocated string containing the C code for an expression.
+ * Since each node's length is known up front, the string is allocated once.
+ */
+char* expr_to_string(struct expr_table* table, expr_id expr) {
+  assert(table);
+  assert(expr < table->size);
+  char* str = malloc(table->lengths[expr] + 1);
+  assert(str);
+  expr_write(table, expr, str);
+  str[table->lengths[expr]] = '\0';
+  return str;
+}
+
+
+/*
+ * Returns the number of nodes requested from a table.
+ */
+size_t expr_table_requests(struct expr_table* table) {
+  assert(table);
+  return table->requests;
+}
+
+
+/*
+ * Returns the number of distinct nodes stored in a table.
+ */
+size_t expr_table_size(struct expr_table* table) {
+  assert(table);
+  return table->size;
+}
+
+
+/*
+ * Returns the number of bytes of memory used by a table's nodes and lookup
+ * table.
+ */
+size_t expr_table_bytes(struct expr_table* table) {
+  assert(table);
+  size_t per_node = 2 * sizeof(uint8_t) + 4 * sizeof(uint32_t);
+  return table->capacity * per_node + table->num_slots * sizeof(uint32_t);
+}
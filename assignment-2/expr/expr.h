@@ -0,0 +1,175 @@
+/*
+ * This file contains the declarations for the expression trees built by the
+ * parser.  Expressions are hash-consed: constructing an expression that's
+ * structurally identical to one that already exists returns the existing
+ * node, so identical subexpressions share a single node and two expressions
+ * are equal exactly when their IDs are.
+ *
+ * Nodes are stored in flat arrays, one per field, and are referred to by
+ * 32-bit IDs (their index in those arrays) rather than by pointers.  A node is
+ * always created after its children, so the arrays are in post-order.
+ *
+ * Only expressions are stored this way.  Statements never become nodes: the
+ * parser generates each statement's C code as a string as soon as it's
+ * reduced, and keeps the statements of a block in a region list (see
+ * region.h) until the block's statement is complete, so there's no statement
+ * tree to walk.
+ *
+ * The tree's shape comes from Python's precedence rules (in the parser), and
+ * its C code gets exactly the parentheses C's precedence rules need to keep
+ * that shape, whatever parentheses the source had.  See expr.c for
+ * implementation details.
+ */
+
+#ifndef __EXPR_H
+#define __EXPR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct interner;
+
+/*
+ * The kinds of expression nodes.  Leaves hold their C text (a number, a
+ * variable name, or 0/1 for a boolean).  Parenthesized expressions are kept
+ * as nodes, since they stop comparisons from chaining, but they don't affect
+ * the C code.
+ */
+enum expr_kind {
+  EXPR_LEAF,
+  EXPR_PAREN,
+  EXPR_UNARY,
+  EXPR_BINARY
+};
+
+/*
+ * The operators.  OP_NOT is the only unary one.  OP_AND and OP_OR are
+ * Python's `and` and `or`, which give the value of one of their operands, and
+ * OP_CHAIN joins the comparisons of a chain (see expr_compare()).
+ */
+enum expr_op {
+  OP_PLUS,
+  OP_MINUS,
+  OP_TIMES,
+  OP_DIVIDEDBY,
+  OP_EQ,
+  OP_NEQ,
+  OP_GT,
+  OP_GTE,
+  OP_LT,
+  OP_LTE,
+  OP_AND,
+  OP_OR,
+  OP_CHAIN,
+  OP_NOT
+};
+
+/*
+ * The ID of an expression node.
+ */
+typedef uint32_t expr_id;
+
+/*
+ * An ID that no node has.
+ */
+#define EXPR_NONE UINT32_MAX
+
+/*
+ * The longest C code an expression may have.  The C code for `and` and `or`
+ * repeats an operand, so it can grow much faster than the source.
+ */
+#define EXPR_MAX_LENGTH (1u << 28)
+
+/*
+ * Structure used to represent the table that owns and shares expression
+ * nodes.
+ */
+struct expr_table;
+
+/*
+ * Create a new expression table.  Leaf text is interned in `interner`, which
+ * must outlive the table.
+ */
+struct expr_table* expr_table_create(struct interner* interner);
+
+/*
+ * Free the memory associated with an expression table, including every node
+ * created through it.
+ */
+void expr_table_free(struct expr_table* table);
+
+/*
+ * Returns a leaf node with the given C text.
+ */
+expr_id expr_leaf(struct expr_table* table, const char* text);
+
+/*
+ * Returns a node for a parenthesized expression.
+ */
+expr_id expr_paren(struct expr_table* table, expr_id inner);
+
+/*
+ * Returns a node applying a binary operator to two expressions, or EXPR_NONE
+ * if its C code would be longer than EXPR_MAX_LENGTH.
+ */
+expr_id expr_binary(struct expr_table* table, enum expr_op op, expr_id left,
+    expr_id right);
+
+/*
+ * Returns a node applying a unary operator to an expression.
+ */
+expr_id expr_unary(struct expr_table* table, enum expr_op op, expr_id operand);
+
+/*
+ * Returns a node comparing two expressions with one of the comparison
+ * operators.  Comparisons chain as they do in Python: if `left` is itself an
+ * unparenthesized comparison, as in `a < b < c`, the result is `a < b && b <
+ * c`, with the node for b shared.  Returns EXPR_NONE like expr_binary().
+ */
+expr_id expr_compare(struct expr_table* table, enum expr_op op, expr_id left,
+    expr_id right);
+
+/*
+ * Returns the node applying a binary operator to two expressions if one has
+ * already been built, or EXPR_NONE if not.  Unlike expr_binary(), this never
+ * adds a node.
+ */
+expr_id expr_find_binary(struct expr_table* table, enum expr_op op, expr_id left,
+    expr_id right);
+
+/*
+ * Returns the length in bytes of the C code for an expression.
+ */
+size_t expr_length(struct expr_table* table, expr_id expr);
+
+/*
+ * Writes the expr_length() bytes of the C code for an expression to `out`,
+ * without a terminating NUL.  Several threads may write expressions from the
+ * same table at once, as long as none is adding nodes to it.
+ */
+void expr_write(struct expr_table* table, expr_id expr, char* out);
+
+/*
+ * Returns a newly-allocated string containing the C code for an expression.
+ * The caller is responsible for freeing it.
+ */
+char* expr_to_string(struct expr_table* table, expr_id expr);
+
+/*
+ * Returns the number of nodes requested from a table, i.e. the number of
+ * nodes there would be if nothing were shared.
+ */
+size_t expr_table_requests(struct expr_table* table);
+
+/*
+ * Returns the number of distinct nodes stored in a table.
+ */
+size_t expr_table_size(struct expr_table* table);
+
+/*
+ * Returns the number of bytes of memory used by a table's nodes and lookup
+ * table.
+ */
+size_t expr_table_bytes(struct expr_table* table);
+
+#endif
@@ -0,0 +1,668 @@
+/*
+ * This file contains the implementation of the asynchronous file I/O layer.
+ *
+ * With io_uring, files are opened synchronously, but the reads, writes and
+ * closes are placed in the submission ring and handed to the kernel in
+ * batches, with one io_uring_enter() call covering many files.  The rings are
+ * set up with raw system calls, so no liburing is needed.
+ *
+ * Without io_uring, jobs are put on a queue served by a few worker threads
+ * that use ordinary open/pread/pwrite/close calls.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "fileio.h"
+
+/*
+ * The number of submission ring entries, and the number of worker threads
+ * used by the fallback backend.
+ */
+#define QUEUE_DEPTH 64
+#define NUM_THREADS 4
+
+/*
+ * This structure is used to represent a single read or write.
+ */
+struct fileio_job {
+  int is_write;
+  char* path;
+  char* data;
+  size_t len;
+  int fd;
+  int done;
+  int error;
+  struct fileio_job* next;
+};
+
+/*
+ * This structure holds the mapped io_uring rings.  `in_flight` counts
+ * operations submitted but not yet completed, which is kept below the size of
+ * the completion ring so completions can never be dropped.
+ */
+struct uring {
+  int fd;
+  void* sq_ptr;
+  size_t sq_size;
+  void* cq_ptr;
+  size_t cq_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned sq_entries;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+  unsigned cq_entries;
+  unsigned to_submit;
+  unsigned in_flight;
+};
+
+/*
+ * This structure is used to represent the I/O queue itself.
+ */
+struct fileio {
+  enum fileio_backend backend;
+  size_t syscalls;
+  struct uring ring;
+  pthread_t threads[NUM_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  struct fileio_job* queue_head;
+  struct fileio_job* queue_tail;
+  int stopping;
+};
+
+
+/*
+ * Helper function to count a system call.  Worker threads count calls too,
+ * so the counter is updated atomically.
+ */
+void _count_syscalls(struct fileio* io, size_t n) {
+  __atomic_fetch_add(&io->syscalls, n, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Helper function to allocate a job.
+ */
+struct fileio_job* _job_create(int is_write, const char* path, char* data, size_t len) {
+  struct fileio_job* job = calloc(1, sizeof(struct fileio_job));
+  assert(job);
+  job->is_write = is_write;
+  job->path = strdup(path);
+  job->data = data;
+  job->len = len;
+  job->fd = -1;
+  return job;
+}
+
+
+/*
+ * Helper function to finish a read or write synchronously from byte `done`
+ * onward.  Used by the thread backend, and by io_uring after a short
+ * transfer or if the kernel doesn't support an operation.
+ */
+int _transfer_rest(struct fileio* io, struct fileio_job* job, size_t done) {
+  while (done < job->len) {
+    ssize_t n = job->is_write
+        ? pwrite(job->fd, job->data + done, job->len - done, done)
+        : pread(job->fd, job->data + done, job->len - done, done);
+    _count_syscalls(io, 1);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      return errno;
+    } else if (n == 0) {
+      job->len = done;
+      break;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+
+/*
+ * Helper function to open a job's file and, for reads, allocate a buffer the
+ * size of the file.  Returns 0 on success or an errno value.
+ */
+int _job_open(struct fileio* io, struct fileio_job* job) {
+  if (job->is_write) {
+    job->fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    _count_syscalls(io, 1);
+    return job->fd < 0 ? errno : 0;
+  }
+
+  job->fd = open(job->path, O_RDONLY | O_CLOEXEC);
+  _count_syscalls(io, 1);
+  if (job->fd < 0) {
+    return errno;
+  }
+
+  struct stat st;
+  _count_syscalls(io, 1);
+  if (fstat(job->fd, &st) < 0) {
+    int error = errno;
+    close(job->fd);
+    _count_syscalls(io, 1);
+    job->fd = -1;
+    return error;
+  }
+
+  job->len = st.st_size;
+  job->data = malloc(job->len + 1);
+  assert(job->data);
+  return 0;
+}
+
+
+/*****************************************************************************
+ **
+ ** io_uring backend
+ **
+ *****************************************************************************/
+
+/*
+ * Helper function wrapping the io_uring_enter() system call.
+ */
+int _uring_enter(struct fileio* io, unsigned min_complete, unsigned flags) {
+  struct uring* ring = &io->ring;
+  int n;
+  do {
+    n = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, min_complete, flags, NULL, 0);
+    _count_syscalls(io, 1);
+  } while (n < 0 && errno == EINTR);
+
+  if (n > 0) {
+    ring->to_submit -= n;
+  }
+  return n;
+}
+
+
+/*
+ * Helper function to set up an io_uring instance and map its rings.  Returns
+ * 0 on success or -1 if io_uring isn't available.
+ */
+int _uring_setup(struct fileio* io) {
+  struct uring* ring = &io->ring;
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  ring->fd = syscall(__NR_io_uring_setup, QUEUE_DEPTH, &p);
+  _count_syscalls(io, 1);
+  if (ring->fd < 0) {
+    return -1;
+  }
+
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_size > ring->sq_size) {
+      ring->sq_size = ring->cq_size;
+    }
+    ring->cq_size = 0;
+  }
+
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ptr = ring->cq_size == 0 ? ring->sq_ptr : mmap(NULL, ring->cq_size,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  _count_syscalls(io, ring->cq_size == 0 ? 2 : 3);
+
+  if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->sq_head = (unsigned*)((char*)ring->sq_ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned*)((char*)ring->sq_ptr + p.sq_off.tail);
+  ring->sq_mask = (unsigned*)((char*)ring->sq_ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)((char*)ring->sq_ptr + p.sq_off.array);
+  ring->sq_entries = p.sq_entries;
+  ring->cq_head = (unsigned*)((char*)ring->cq_ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned*)((char*)ring->cq_ptr + p.cq_off.tail);
+  ring->cq_mask = (unsigned*)((char*)ring->cq_ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ptr + p.cq_off.cqes);
+  ring->cq_entries = p.cq_entries;
+  ring->to_submit = 0;
+  ring->in_flight = 0;
+
+  return 0;
+}
+
+
+void _uring_reap(struct fileio* io);
+
+
+/*
+ * Helper function returning a zeroed submission queue entry.  Pending entries
+ * are submitted first if the submission ring is full, and completions are
+ * waited for if the completion ring could otherwise overflow.
+ */
+struct io_uring_sqe* _uring_get_sqe(struct fileio* io) {
+  struct uring* ring = &io->ring;
+
+  while (ring->in_flight + 1 > ring->cq_entries) {
+    _uring_enter(io, 1, IORING_ENTER_GETEVENTS);
+    _uring_reap(io);
+  }
+
+  unsigned tail = *ring->sq_tail;
+  if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+    _uring_enter(io, 0, 0);
+  }
+
+  unsigned idx = tail & *ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sq_array[idx] = idx;
+  return sqe;
+}
+
+
+/*
+ * Helper function to make a filled-in submission queue entry visible to the
+ * kernel.  It's submitted on the next io_uring_enter() call.
+ */
+void _uring_push_sqe(struct fileio* io) {
+  struct uring* ring = &io->ring;
+  __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+  ring->in_flight++;
+}
+
+
+/*
+ * Helper function to queue closing a file descriptor.  Closes are tagged in
+ * their user data with the low bit set (jobs are always aligned, so their
+ * addresses never have it set), carrying the descriptor in case the kernel
+ * can't close it for us.
+ */
+void _uring_queue_close(struct fileio* io, int fd) {
+  struct io_uring_sqe* sqe = _uring_get_sqe(io);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fd;
+  sqe->user_data = ((uint64_t)fd << 1) | 1;
+  _uring_push_sqe(io);
+}
+
+
+/*
+ * Helper function to queue the read or write for an opened job.
+ */
+void _uring_queue_transfer(struct fileio* io, struct fileio_job* job) {
+  struct io_uring_sqe* sqe = _uring_get_sqe(io);
+  sqe->opcode = job->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+  sqe->fd = job->fd;
+  sqe->addr = (uint64_t)(uintptr_t)job->data;
+  sqe->len = job->len;
+  sqe->off = 0;
+  sqe->user_data = (uint64_t)(uintptr_t)job;
+  _uring_push_sqe(io);
+}
+
+
+/*
+ * Helper function to handle one completion.
+ */
+void _uring_complete(struct fileio* io, uint64_t user_data, int res) {
+  if (user_data & 1) {
+    /*
+     * A close.  If the kernel couldn't do it, do it ourselves.
+     */
+    if (res < 0) {
+      close((int)(user_data >> 1));
+      _count_syscalls(io, 1);
+    }
+    return;
+  }
+
+  struct fileio_job* job = (struct fileio_job*)(uintptr_t)user_data;
+  if (res == -EINVAL || res == -EOPNOTSUPP) {
+    /*
+     * The kernel doesn't support this operation; fall back to doing it
+     * synchronously.
+     */
+    job->error = _transfer_rest(io, job, 0);
+  } else if (res < 0) {
+    job->error = -res;
+  } else {
+    job->error = _transfer_rest(io, job, res);
+  }
+
+  if (!job->is_write && !job->error) {
+    job->data[job->len] = '\0';
+  }
+  _uring_queue_close(io, job->fd);
+  job->fd = -1;
+  job->done = 1;
+}
+
+
+/*
+ * Helper function to handle every completion currently available.
+ */
+void _uring_reap(struct fileio* io) {
+  struct uring* ring = &io->ring;
+  unsigned head = *ring->cq_head;
+  while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    uint64_t user_data = cqe->user_data;
+    int res = cqe->res;
+    head++;
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    ring->in_flight--;
+    _uring_complete(io, user_data, res);
+  }
+}
+
+
+/*****************************************************************************
+ **
+ ** Thread backend
+ **
+ *****************************************************************************/
+
+/*
+ * The function run by each worker thread.  It takes jobs off the queue and
+ * performs them with ordinary blocking system calls.
+ */
+void* _worker(void* arg) {
+  struct fileio* io = arg;
+
+  while (1) {
+    pthread_mutex_lock(&io->lock);
+    while (io->queue_head == NULL && !io->stopping) {
+      pthread_cond_wait(&io->work_cond, &io->lock);
+    }
+    if (io->queue_head == NULL) {
+      pthread_mutex_unlock(&io->lock);
+      return NULL;
+    }
+    struct fileio_job* job = io->queue_head;
+    io->queue_head = job->next;
+    if (io->queue_head == NULL) {
+      io->queue_tail = NULL;
+    }
+    pthread_mutex_unlock(&io->lock);
+
+    int error = job->fd < 0 ? _job_open(io, job) : 0;
+    if (!error) {
+      error = _transfer_rest(io, job, 0);
+      if (!job->is_write) {
+        job->data[job->len] = '\0';
+      }
+      close(job->fd);
+      _count_syscalls(io, 1);
+      job->fd = -1;
+    }
+
+    pthread_mutex_lock(&io->lock);
+    job->error = error;
+    job->done = 1;
+    pthread_cond_broadcast(&io->done_cond);
+    pthread_mutex_unlock(&io->lock);
+  }
+}
+
+
+/*
+ * Helper function to put a job on the worker threads' queue.
+ */
+void _threads_queue(struct fileio* io, struct fileio_job* job) {
+  pthread_mutex_lock(&io->lock);
+  if (io->queue_tail != NULL) {
+    io->queue_tail->next = job;
+  } else {
+    io->queue_head = job;
+  }
+  io->queue_tail = job;
+  pthread_cond_signal(&io->work_cond);
+  pthread_mutex_unlock(&io->lock);
+}
+
+
+/*****************************************************************************
+ **
+ ** Public interface
+ **
+ *****************************************************************************/
+
+/*
+ * Create a new I/O queue using the given backend.
+ */
+struct fileio* fileio_create(enum fileio_backend backend) {
+  struct fileio* io = calloc(1, sizeof(struct fileio));
+  assert(io);
+
+  if (backend != FILEIO_THREADS) {
+    if (_uring_setup(io) == 0) {
+      io->backend = FILEIO_URING;
+      return io;
+    } else if (backend == FILEIO_URING) {
+      free(io);
+      return NULL;
+    }
+  }
+
+  io->backend = FILEIO_THREADS;
+  pthread_mutex_init(&io->lock, NULL);
+  pthread_cond_init(&io->work_cond, NULL);
+  pthread_cond_init(&io->done_cond, NULL);
+  for (int i = 0; i < NUM_THREADS; i++) {
+    pthread_create(&io->threads[i], NULL, _worker, io);
+  }
+  return io;
+}
+
+
+/*
+ * Free an I/O queue.  Any closes still pending are completed first.
+ */
+void fileio_free(struct fileio* io) {
+  assert(io);
+
+  if (io->backend == FILEIO_URING) {
+    struct uring* ring = &io->ring;
+    while (ring->in_flight > 0) {
+      _uring_enter(io, 1, IORING_ENTER_GETEVENTS);
+      _uring_reap(io);
+    }
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr) {
+      munmap(ring->cq_ptr, ring->cq_size);
+    }
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+  } else {
+    pthread_mutex_lock(&io->lock);
+    io->stopping = 1;
+    pthread_cond_broadcast(&io->work_cond);
+    pthread_mutex_unlock(&io->lock);
+    for (int i = 0; i < NUM_THREADS; i++) {
+      pthread_join(io->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&io->lock);
+    pthread_cond_destroy(&io->work_cond);
+    pthread_cond_destroy(&io->done_cond);
+  }
+
+  free(io);
+}
+
+
+/*
+ * Returns the name of the backend an I/O queue is using.
+ */
+const char* fileio_backend_name(struct fileio* io) {
+  assert(io);
+  return io->backend == FILEIO_URING ? "io_uring" : "threads";
+}
+
+
+/*
+ * Returns the number of system calls an I/O queue has made so far.
+ */
+size_t fileio_syscalls(struct fileio* io) {
+  assert(io);
+  return __atomic_load_n(&io->syscalls, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Helper function to start a job on whichever backend is in use.  With
+ * io_uring the file is opened right away and the transfer is queued; if the
+ * open fails the job completes immediately.
+ */
+struct fileio_job* _fileio_start(struct fileio* io, struct fileio_job* job) {
+  if (io->backend == FILEIO_THREADS) {
+    _threads_queue(io, job);
+    return job;
+  }
+
+  job->error = _job_open(io, job);
+  if (job->error) {
+    job->done = 1;
+  } else {
+    _uring_queue_transfer(io, job);
+  }
+  return job;
+}
+
+
+/*
+ * Queues a read of the whole file at `path`.
+ */
+struct fileio_job* fileio_read(struct fileio* io, const char* path) {
+  assert(io);
+  return _fileio_start(io, _job_create(0, path, NULL, 0));
+}
+
+
+/*
+ * Queues a write of `len` bytes of `data` to the file at `path`.
+ */
+struct fileio_job* fileio_write(struct fileio* io, const char* path, char* data, size_t len) {
+  assert(io);
+  return _fileio_start(io, _job_create(1, path, data, len));
+}
+
+
+/*
+ * Waits for a job to complete.  With io_uring, this is where queued
+ * operations are actually submitted, so everything queued since the last
+ * wait goes to the kernel in a single system call.
+ */
+int fileio_wait(struct fileio* io, struct fileio_job* job) {
+  assert(io);
+  assert(job);
+
+  if (io->backend == FILEIO_URING) {
+    _uring_reap(io);
+    while (!job->done) {
+      _uring_enter(io, 1, IORING_ENTER_GETEVENTS);
+      _uring_reap(io);
+    }
+  } else {
+    pthread_mutex_lock(&io->lock);
+    while (!job->done) {
+      pthread_cond_wait(&io->done_cond, &io->lock);
+    }
+    pthread_mutex_unlock(&io->lock);
+  }
+
+  return job->error;
+}
+
+
+/*
+ * Returns the data read by a completed read job.
+ */
+char* fileio_job_data(struct fileio_job* job, size_t* len) {
+  assert(job);
+  assert(job->done);
+  *len = job->len;
+  return job->data;
+}
+
+
+/*
+ * Free a completed job and its data.
+ */
+void fileio_job_free(struct fileio_job* job) {
+  assert(job);
+  assert(job->done);
+  free(job->path);
+  free(job->data);
+  free(job);
+}
+
+
+/*
+ * Reads a whole file right away.  The buffer starts at the file's size, plus
+ * room to see the end of the file, and grows if the file turns out longer.
+ */
+char* fileio_read_file(const char* path, size_t* len) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    int error = errno;
+    if (fd >= 0) {
+      close(fd);
+    }
+    errno = error;
+    return NULL;
+  }
+
+  size_t capacity = st.st_size + 2;
+  char* buf = malloc(capacity);
+  assert(buf);
+  size_t done = 0;
+  ssize_t n;
+  while (1) {
+    if (done == capacity - 1) {
+      capacity *= 2;
+      buf = realloc(buf, capacity);
+      assert(buf);
+    }
+    n = read(fd, buf + done, capacity - 1 - done);
+    if (n > 0) {
+      done += n;
+    } else if (n == 0) {
+      break;
+    } else if (errno != EINTR) {
+      int error = errno;
+      free(buf);
+      close(fd);
+      errno = error;
+      return NULL;
+    }
+  }
+  close(fd);
+
+  buf[done] = '\0';
+  *len = done;
+  return buf;
+}
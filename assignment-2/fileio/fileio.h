@@ -0,0 +1,92 @@
+/*
+ * This file contains the declarations for an asynchronous file I/O layer used
+ * when translating many files at once.  Reads of whole files and writes of
+ * whole files are queued and complete in the background, so I/O overlaps
+ * translation.  Requests go through io_uring where the kernel supports it,
+ * falling back to a small pool of threads doing ordinary reads and writes.
+ * See fileio.c for implementation details.
+ */
+
+#ifndef __FILEIO_H
+#define __FILEIO_H
+
+#include <stddef.h>
+
+/*
+ * The available I/O backends.
+ */
+enum fileio_backend {
+  FILEIO_AUTO,
+  FILEIO_URING,
+  FILEIO_THREADS
+};
+
+/*
+ * Structure used to represent an I/O queue.
+ */
+struct fileio;
+
+/*
+ * Structure used to represent a single queued read or write.
+ */
+struct fileio_job;
+
+/*
+ * Create a new I/O queue using the given backend.  FILEIO_AUTO picks
+ * io_uring if it's available.  Returns NULL if the requested backend can't
+ * be set up.
+ */
+struct fileio* fileio_create(enum fileio_backend backend);
+
+/*
+ * Free an I/O queue.  All jobs must have been waited for first.
+ */
+void fileio_free(struct fileio* io);
+
+/*
+ * Returns the name of the backend an I/O queue is using.
+ */
+const char* fileio_backend_name(struct fileio* io);
+
+/*
+ * Returns the number of system calls an I/O queue has made so far.
+ */
+size_t fileio_syscalls(struct fileio* io);
+
+/*
+ * Queues a read of the whole file at `path`.
+ */
+struct fileio_job* fileio_read(struct fileio* io, const char* path);
+
+/*
+ * Queues a write of `len` bytes of `data` to the file at `path`, creating or
+ * truncating it.  The job takes ownership of `data`, which must have been
+ * allocated with malloc().
+ */
+struct fileio_job* fileio_write(struct fileio* io, const char* path, char* data, size_t len);
+
+/*
+ * Waits for a job to complete.  Returns 0 if it succeeded or an errno value
+ * if it failed.
+ */
+int fileio_wait(struct fileio* io, struct fileio_job* job);
+
+/*
+ * Returns the data read by a completed read job and stores its length in
+ * `len`.  The data is NUL-terminated and stays owned by the job.
+ */
+char* fileio_job_data(struct fileio_job* job, size_t* len);
+
+/*
+ * Free a completed job and its data.
+ */
+void fileio_job_free(struct fileio_job* job);
+
+/*
+ * Reads the whole file at `path` right away, without a queue, into a
+ * newly-allocated buffer and stores its length in `len`.  The data is
+ * NUL-terminated.  Returns NULL, with errno set, if the file can't be read.
+ */
+char* fileio_read_file(const char* path, size_t* len);
+
+#endif
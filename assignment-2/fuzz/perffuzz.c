@@ -0,0 +1,632 @@
+/*
+ * This file contains a coverage-guided fuzzer that looks for inputs which are
+ * valid (or at least accepted) but unusually slow to translate:
+ *
+ *   perffuzz [-n execs] [-t seconds] [-l max_len] [-k keep] [-T timeout_ms] [-o corpus_dir] seed...
+ *
+ * The translator is linked in and built with -fsanitize-coverage=trace-pc, so
+ * every basic block calls __sanitizer_cov_trace_pc(), which is implemented
+ * here to count hits of each edge (pair of consecutive blocks).  Each input's
+ * cost is measured in instructions retired, using perf_event_open(), or in
+ * thread CPU time if hardware counters aren't available.  Its score is its
+ * cost above that of an empty input, per byte.
+ *
+ * As in PerfFuzz, a mutated input joins the corpus if it reaches an edge no
+ * earlier input reached or if it hits some edge more times than any earlier
+ * input did, so the corpus is steered towards inputs that make loops and
+ * recursion run longer.  When fuzzing is done, the highest-scoring inputs are
+ * minimized (bytes are removed as long as the score doesn't drop) and saved to
+ * the corpus directory to serve as benchmark inputs.
+ *
+ * The translator runs in a worker process forked from the fuzzer, which
+ * translates inputs one after another as the fuzzer hands them over (the
+ * input and the edge hit counts live in memory shared with it).  Each run is
+ * limited to timeout_ms (1000 by default).  A worker that runs out of time is
+ * killed, and one that crashes is replaced, so a translation is never cut
+ * short in a process that goes on fuzzing.  The input is saved to the corpus
+ * directory as hang-NN.py or crash-NN.py and isn't added to the corpus, since
+ * everything mutated from it would likely do the same.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#include "../parser.h"
+
+#define MAP_SIZE (1 << 16)
+#define MAX_CORPUS 512
+#define MAX_SEED_LEN 65536
+
+/*
+ * Edge hit counts for the current run, which are shared with the worker, and
+ * the most hits of each edge seen in any run so far.
+ */
+static uint32_t* _hits;
+static uint32_t _max_hits[MAP_SIZE];
+static uintptr_t _prev_pc;
+
+/*
+ * Called by the instrumented translator at the start of every basic block.
+ */
+void __sanitizer_cov_trace_pc(void) {
+  uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+  _hits[(pc ^ _prev_pc) & (MAP_SIZE - 1)]++;
+  _prev_pc = pc >> 1;
+}
+
+
+/*
+ * An input in the corpus.
+ */
+struct input {
+  char* data;
+  size_t len;
+  double score;
+};
+
+static struct input _corpus[MAX_CORPUS];
+static int _corpus_size;
+
+/*
+ * Whether instructions can be counted, the worker's cost counter (a perf
+ * event file descriptor, or -1 to use CPU time), and the cost of translating
+ * an empty input.
+ */
+static int _perf_available;
+static int _perf_fd = -1;
+static double _base_cost;
+
+/*
+ * The worker process, the pipes that hand it the length of each input and
+ * get back its cost, and the input itself, in memory shared with it.
+ */
+static pid_t _worker = -1;
+static int _command_fd = -1;
+static int _result_fd = -1;
+static char* _input;
+static size_t _input_capacity;
+
+/*
+ * The per-run time limit, and the number of inputs saved as hangs and as
+ * crashes.
+ */
+static const char* _corpus_dir = "perf_corpus";
+static long _timeout_ms = 1000;
+static int _num_hangs;
+static int _num_crashes;
+
+/*
+ * Where progress is reported, since stderr is redirected to /dev/null.
+ */
+static FILE* _log;
+
+
+/*
+ * Helper function to open an instruction counter for this thread.
+ */
+int _perf_open() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/*
+ * Helper function to read the cost counter.
+ */
+double _read_cost() {
+  if (_perf_fd >= 0) {
+    uint64_t count;
+    if (read(_perf_fd, &count, sizeof(count)) == sizeof(count)) {
+      return count;
+    }
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/*
+ * Helper function to write an input to a file.
+ */
+void _write_input(const char* path, const char* data, size_t len) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n <= 0) {
+      break;
+    }
+    data += n;
+    len -= n;
+  }
+  close(fd);
+}
+
+
+/*
+ * Helper function to write an input to a file in the corpus directory.
+ */
+void _save(const char* name, const char* data, size_t len) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", _corpus_dir, name);
+  mkdir(_corpus_dir, 0755);
+  _write_input(path, data, len);
+}
+
+
+/*
+ * The worker's main loop.  It translates each input the fuzzer hands it and
+ * sends back the cost, until the fuzzer closes the command pipe.
+ */
+void _worker_loop(int command_fd, int result_fd) {
+  if (_perf_available) {
+    _perf_fd = _perf_open();
+    ioctl(_perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  FILE* sink = fopen("/dev/null", "w");
+
+  size_t len;
+  while (read(command_fd, &len, sizeof(len)) == sizeof(len)) {
+    memset(_hits, 0, MAP_SIZE * sizeof(uint32_t));
+    _prev_pc = 0;
+
+    struct interner* names = intern_create();
+    double start = _read_cost();
+    py2c_translate(names, _input, len, sink);
+    double cost = _read_cost() - start;
+    intern_free(names);
+
+    if (write(result_fd, &cost, sizeof(cost)) != sizeof(cost)) {
+      break;
+    }
+  }
+  _exit(0);
+}
+
+
+/*
+ * Helper function to fork a new worker.
+ */
+void _start_worker() {
+  int command[2], result[2];
+  if (pipe(command) != 0 || pipe(result) != 0) {
+    perror("Error: Could not create worker pipes");
+    exit(1);
+  }
+  _worker = fork();
+  if (_worker < 0) {
+    perror("Error: Could not start worker");
+    exit(1);
+  } else if (_worker == 0) {
+    close(command[1]);
+    close(result[0]);
+    _worker_loop(command[0], result[1]);
+  }
+  close(command[0]);
+  close(result[1]);
+  _command_fd = command[1];
+  _result_fd = result[0];
+}
+
+
+/*
+ * Helper function to kill the worker (if it's still running) and wait for
+ * it.  Returns its wait status.
+ */
+int _stop_worker() {
+  int status = 0;
+  kill(_worker, SIGKILL);
+  waitpid(_worker, &status, 0);
+  close(_command_fd);
+  close(_result_fd);
+  _worker = -1;
+  return status;
+}
+
+
+/*
+ * Translates an input in the worker, recording its edge hits, and returns its
+ * cost, or -1 if it ran out of time or crashed the translator, in which case
+ * the worker is replaced and the input is saved as a hang or a crash.
+ */
+double run(const char* data, size_t len) {
+  if (_worker < 0) {
+    _start_worker();
+  }
+
+  assert(len <= _input_capacity);
+  memcpy(_input, data, len);
+  double cost;
+  struct pollfd pfd = { _result_fd, POLLIN, 0 };
+  int ready = 0;
+  if (write(_command_fd, &len, sizeof(len)) == sizeof(len)) {
+    while ((ready = poll(&pfd, 1, _timeout_ms)) < 0 && errno == EINTR) {
+    }
+    if (ready > 0 && read(_result_fd, &cost, sizeof(cost)) == sizeof(cost)) {
+      return cost;
+    }
+  }
+
+  int status = _stop_worker();
+  char name[64];
+  if (ready == 0) {
+    snprintf(name, sizeof(name), "hang-%02d.py", ++_num_hangs);
+    _save(name, data, len);
+    fprintf(_log, "%s/%s: no result after %ld ms\n", _corpus_dir, name, _timeout_ms);
+  } else {
+    snprintf(name, sizeof(name), "crash-%02d.py", ++_num_crashes);
+    _save(name, data, len);
+    if (WIFSIGNALED(status)) {
+      fprintf(_log, "%s/%s: translator killed by signal %d\n", _corpus_dir, name, WTERMSIG(status));
+    } else {
+      fprintf(_log, "%s/%s: translator exited with status %d\n", _corpus_dir, name, WEXITSTATUS(status));
+    }
+  }
+  return -1;
+}
+
+
+/*
+ * Returns the cost of an input as the cheapest of a few runs, or -1 if it
+ * hung.  CPU time is much noisier than instruction counts, so it gets more
+ * runs.
+ */
+double measure(const char* data, size_t len) {
+  int runs = _perf_available ? 1 : 5;
+  double cost = run(data, len);
+  for (int i = 1; i < runs && cost >= 0; i++) {
+    double c = run(data, len);
+    cost = c < cost ? c : cost;
+  }
+  return cost;
+}
+
+
+/*
+ * Returns the score of an input with the given cost.
+ */
+double score(double cost, size_t len) {
+  return (cost - _base_cost) / (len ? len : 1);
+}
+
+
+/*
+ * Helper function to fold the current run's edge hits into the maximums.
+ * Returns 1 if the run reached a new edge or hit an edge more often than any
+ * run before it.
+ */
+int _update_max_hits() {
+  int interesting = 0;
+  for (int i = 0; i < MAP_SIZE; i++) {
+    if (_hits[i] > _max_hits[i]) {
+      _max_hits[i] = _hits[i];
+      interesting = 1;
+    }
+  }
+  return interesting;
+}
+
+
+/*
+ * Helper function to add an input to the corpus.  Once the corpus is full,
+ * the new input replaces the lowest-scoring one if it scores higher.
+ */
+void _corpus_add(const char* data, size_t len, double s) {
+  int slot = _corpus_size;
+  if (_corpus_size == MAX_CORPUS) {
+    slot = 0;
+    for (int i = 1; i < MAX_CORPUS; i++) {
+      if (_corpus[i].score < _corpus[slot].score) {
+        slot = i;
+      }
+    }
+    if (_corpus[slot].score >= s) {
+      return;
+    }
+    free(_corpus[slot].data);
+  } else {
+    _corpus_size++;
+  }
+
+  _corpus[slot].data = malloc(len + 1);
+  memcpy(_corpus[slot].data, data, len);
+  _corpus[slot].len = len;
+  _corpus[slot].score = s;
+}
+
+
+/*
+ * Fragments of the language mutations can insert.
+ */
+static const char* _tokens[] = {
+  "x", "y1", "_z", "1", "2.5", "True", "False", " = ", " + ", " - ", " * ",
+  " / ", " == ", " != ", " < ", " <= ", " > ", " >= ", " and ", " or ", "not ",
+  "(", ")", ":", "\n", "    ", "\t", "if ", "elif ", "else", "while ", "break",
+  "# comment", "$", "@", "x = x + 1\n", "if x:\n    ", "while True:\n    ",
+  "x = (", ")\n"
+};
+
+#define NUM_TOKENS (sizeof(_tokens) / sizeof(_tokens[0]))
+
+
+/*
+ * Writes a mutated copy of `in` to `out` (which has room for `max` bytes) and
+ * returns its length.
+ */
+size_t mutate(const struct input* in, char* out, size_t max) {
+  size_t len = in->len < max ? in->len : max;
+  memcpy(out, in->data, len);
+
+  int rounds = 1 + rand() % 4;
+  for (int r = 0; r < rounds; r++) {
+    size_t pos = len ? rand() % (len + 1) : 0;
+    switch (rand() % 6) {
+      case 0:
+        /* Overwrite a byte. */
+        if (len) {
+          out[rand() % len] = " \n\t()+-*/=<>!:#x1."[rand() % 18];
+        }
+        break;
+
+      case 1: {
+        /* Insert a token. */
+        const char* tok = _tokens[rand() % NUM_TOKENS];
+        size_t n = strlen(tok);
+        if (len + n <= max) {
+          memmove(out + pos + n, out + pos, len - pos);
+          memcpy(out + pos, tok, n);
+          len += n;
+        }
+        break;
+      }
+
+      case 2: {
+        /* Delete a range. */
+        size_t n = len - pos ? 1 + rand() % (len - pos) % 16 : 0;
+        memmove(out + pos, out + pos + n, len - pos - n);
+        len -= n;
+        break;
+      }
+
+      case 3:
+      case 4: {
+        /*
+         * Repeat a range several times, which is how nesting and long chains
+         * grow.
+         */
+        if (pos == len) {
+          break;
+        }
+        size_t n = 1 + rand() % ((len - pos) < 32 ? (len - pos) : 32);
+        int times = 1 + rand() % 16;
+        for (int i = 0; i < times && len + n <= max; i++) {
+          memmove(out + pos + n, out + pos, len - pos);
+          len += n;
+        }
+        break;
+      }
+
+      case 5: {
+        /* Splice in part of another corpus input. */
+        const struct input* other = &_corpus[rand() % _corpus_size];
+        if (other->len == 0) {
+          break;
+        }
+        size_t start = rand() % other->len;
+        size_t n = 1 + rand() % (other->len - start);
+        if (len + n <= max) {
+          memmove(out + pos + n, out + pos, len - pos);
+          memcpy(out + pos, other->data + start, n);
+          len += n;
+        }
+        break;
+      }
+    }
+  }
+
+  return len;
+}
+
+
+/*
+ * Minimizes an input, removing ranges of bytes (halving the range size each
+ * pass) as long as the score stays within MINIMIZE_SLACK of the original
+ * score, which allows for measurement noise.
+ */
+#define MINIMIZE_SLACK 0.9
+
+void minimize(struct input* in) {
+  char* buf = malloc(in->len + 1);
+  double target = in->score * MINIMIZE_SLACK;
+  for (size_t chunk = in->len / 2; chunk > 0; chunk /= 2) {
+    for (size_t pos = 0; pos + chunk <= in->len; ) {
+      memcpy(buf, in->data, pos);
+      memcpy(buf + pos, in->data + pos + chunk, in->len - pos - chunk);
+      size_t len = in->len - chunk;
+      double cost = measure(buf, len);
+      double s = score(cost, len);
+      if (cost >= 0 && s >= target) {
+        memcpy(in->data, buf, len);
+        in->len = len;
+        in->score = s;
+      } else {
+        pos += chunk;
+      }
+    }
+  }
+  free(buf);
+}
+
+
+/*
+ * Helper function to read a seed file.
+ */
+void _add_seed(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Error: Could not read %s\n", path);
+    return;
+  }
+  char buf[MAX_SEED_LEN];
+  size_t len = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+  double cost = measure(buf, len);
+  if (cost < 0) {
+    return;
+  }
+  _update_max_hits();
+  _corpus_add(buf, len, score(cost, len));
+}
+
+
+int _score_cmp(const void* a, const void* b) {
+  double x = ((const struct input*)a)->score, y = ((const struct input*)b)->score;
+  return x > y ? -1 : x < y;
+}
+
+
+int main(int argc, char** argv) {
+  long execs = 100000;
+  double seconds = 0;
+  size_t max_len = 4096;
+  int keep = 10;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:t:l:k:T:o:")) != -1) {
+    switch (opt) {
+      case 'n': execs = atol(optarg); break;
+      case 't': seconds = atof(optarg); break;
+      case 'l': max_len = atol(optarg); break;
+      case 'k': keep = atoi(optarg); break;
+      case 'T': _timeout_ms = atol(optarg); break;
+      case 'o': _corpus_dir = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s [-n execs] [-t seconds] [-l max_len] [-k keep] [-T timeout_ms] "
+            "[-o corpus_dir] seed...\n", argv[0]);
+        return 1;
+    }
+  }
+
+  /*
+   * The worker opens its own counter, since a counter only counts the thread
+   * that opened it.
+   */
+  int probe = _perf_open();
+  _perf_available = probe >= 0;
+  if (probe >= 0) {
+    close(probe);
+  }
+  const char* unit = _perf_available ? "instructions" : "ns";
+
+  _input_capacity = max_len > MAX_SEED_LEN ? max_len : MAX_SEED_LEN;
+  _hits = mmap(NULL, MAP_SIZE * sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  _input = mmap(NULL, _input_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (_hits == MAP_FAILED || _input == MAP_FAILED) {
+    perror("Error: Could not map memory shared with the worker");
+    return 1;
+  }
+
+  /*
+   * Diagnostics for broken inputs would drown out progress reports.
+   */
+  int err = dup(STDERR_FILENO);
+  _log = fdopen(err, "w");
+  setvbuf(_log, NULL, _IOLBF, 0);
+  freopen("/dev/null", "w", stderr);
+  signal(SIGPIPE, SIG_IGN);
+  srand(time(NULL));
+
+  _base_cost = measure("", 0);
+  for (int i = optind; i < argc; i++) {
+    _add_seed(argv[i]);
+  }
+  if (_corpus_size == 0) {
+    _corpus_add("x = 1\n", 6, 0);
+  }
+
+  fprintf(_log, "Fuzzing with cost in %s (empty input: %.0f)\n", unit, _base_cost);
+
+  char* buf = malloc(max_len);
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long n;
+  for (n = 0; n < execs; n++) {
+    /*
+     * Pick the better-scoring of two random corpus inputs to mutate.
+     */
+    struct input* a = &_corpus[rand() % _corpus_size];
+    struct input* b = &_corpus[rand() % _corpus_size];
+    size_t len = mutate(a->score > b->score ? a : b, buf, max_len);
+
+    if (run(buf, len) >= 0 && _update_max_hits()) {
+      double cost = measure(buf, len);
+      if (cost >= 0) {
+        _corpus_add(buf, len, score(cost, len));
+      }
+    }
+
+    if (n % 10000 == 0 || seconds > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+      if (n % 10000 == 0) {
+        double best = 0;
+        for (int i = 0; i < _corpus_size; i++) {
+          best = _corpus[i].score > best ? _corpus[i].score : best;
+        }
+        fprintf(_log, "%ld execs, %.0f/s, corpus %d, best %.1f %s/byte\n",
+            n, n / (elapsed > 0 ? elapsed : 1), _corpus_size, best, unit);
+      }
+      if (seconds > 0 && elapsed >= seconds) {
+        break;
+      }
+    }
+  }
+
+  /*
+   * Minimize and save the slowest inputs.
+   */
+  qsort(_corpus, _corpus_size, sizeof(struct input), _score_cmp);
+  for (int i = 0; i < keep && i < _corpus_size; i++) {
+    size_t before = _corpus[i].len;
+    minimize(&_corpus[i]);
+
+    char name[64];
+    snprintf(name, sizeof(name), "slow-%02d.py", i + 1);
+    _save(name, _corpus[i].data, _corpus[i].len);
+    fprintf(_log, "%s/%s: %.1f %s/byte, %zu bytes (from %zu)\n",
+        _corpus_dir, name, _corpus[i].score, unit, _corpus[i].len, before);
+  }
+
+  free(buf);
+  if (_worker >= 0) {
+    _stop_worker();
+  }
+  return 0;
+}
@@ -3,14 +3,23 @@
  * simplicity, the hash table is set up to store float values.
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/random.h>
 
 #include "hash.h"
+#include "../trace/trace.h"
 
 /*
- * The initial capacity of the hash table array.
+ * The initial capacity of the hash table array.  The array isn't allocated
+ * until the first insertion, so creating a table that stays empty (or is only
+ * used for lookups) costs a single small allocation.
  */
 #define INITIAL_CAPACITY 128
 
@@ -28,16 +37,25 @@ struct association {
   char* key;
   void* value;
   struct association* next;
+  struct association* order_next;
+  struct association* order_prev;
 };
 
 
 /*
- * This structure is used to represent the hash table itself.
+ * This structure is used to represent the hash table itself.  Besides the
+ * bucket chains, all associations are kept in a doubly-linked list in the
+ * order they were inserted, which is the order iterators visit them in.  This
+ * keeps iteration order independent of the (randomly seeded) hash function.
  */
 struct hash {
   struct association** table;
   unsigned int capacity;
   unsigned int num_elems;
+  unsigned int max_chain;
+  size_t key_bytes;
+  struct association* order_head;
+  struct association* order_tail;
 };
 
 /*
@@ -48,7 +66,6 @@ void _hash_table_init(struct hash* hash, unsigned int capacity) {
   assert(hash->table);
   memset(hash->table, 0, capacity * sizeof(struct association*));
   hash->capacity = capacity;
-  hash->num_elems = 0;
 }
 
 
@@ -58,7 +75,12 @@ void _hash_table_init(struct hash* hash, unsigned int capacity) {
 struct hash* hash_create() {
   struct hash* hash = malloc(sizeof(struct hash));
   assert(hash);
-  _hash_table_init(hash, INITIAL_CAPACITY);
+  hash->table = NULL;
+  hash->capacity = 0;
+  hash->num_elems = 0;
+  hash->max_chain = 0;
+  hash->key_bytes = 0;
+  hash->order_head = hash->order_tail = NULL;
   return hash;
 }
 
@@ -102,15 +124,99 @@ float _hash_load_factor(struct hash* hash) {
 
 
 /*
- * The DJB hash function: http://www.cse.yorku.ca/~oz/hash.html.
+ * The key for hash_bytes().  It's chosen randomly the first time it's needed,
+ * so the bucket a given key lands in can't be predicted from outside the
+ * process.  Tables may be used on several threads, so it's chosen only once.
+ */
+static uint64_t _hash_seed[2];
+static pthread_once_t _hash_seeded = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Helper function to pick a random key for hash_bytes(), falling back to the
+ * time and process ID if the kernel can't provide random bytes.  getrandom()
+ * is a single system call, where reading /dev/urandom takes three.
  */
-unsigned int _djb_hash(char* key) {
-  unsigned long hash = 5381;
-  int c;
-  while ((c = *key++)) {
-    hash = ((hash << 5) + hash) + c;  // hash * 33 + c
+void _hash_seed_init() {
+  if (getrandom(_hash_seed, sizeof(_hash_seed), GRND_NONBLOCK) != sizeof(_hash_seed)) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    _hash_seed[0] = (uint64_t)ts.tv_sec * 1000000007ULL ^ (uint64_t)ts.tv_nsec;
+    _hash_seed[1] = ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)&ts;
   }
-  return hash;
+}
+
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do {                                                    \
+    v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);              \
+    v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                                 \
+    v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                                 \
+    v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);              \
+} while (0)
+
+
+/*
+ * SipHash-1-3 with a 128-bit key:
+ * https://cr.yp.to/siphash/siphash-20120918.pdf.  This is a keyed hash, so
+ * inputs can't be crafted offline to all collide in the same bucket.
+ */
+uint64_t hash_bytes_keyed(const void* data, size_t len, const uint64_t key[2]) {
+  const unsigned char* in = data;
+  uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+  uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+  uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+  uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+  uint64_t b = (uint64_t)len << 56;
+
+  /*
+   * Compress each full 8-byte little-endian word of the input.
+   */
+  const unsigned char* end = in + len - (len % 8);
+  for (; in != end; in += 8) {
+    uint64_t m = 0;
+    for (int i = 0; i < 8; i++) {
+      m |= (uint64_t)in[i] << (8 * i);
+    }
+    v3 ^= m;
+    SIPROUND;
+    v0 ^= m;
+  }
+
+  /*
+   * Fold the remaining bytes into the final word along with the length.
+   */
+  for (int i = 0; i < len % 8; i++) {
+    b |= (uint64_t)in[i] << (8 * i);
+  }
+  v3 ^= b;
+  SIPROUND;
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+/*
+ * Hashes `len` bytes of `data` with the process-wide random key.
+ */
+uint64_t hash_bytes(const void* data, size_t len) {
+  pthread_once(&_hash_seeded, _hash_seed_init);
+  return hash_bytes_keyed(data, len, _hash_seed);
+}
+
+
+/*
+ * Helper function to compute the hash value of a NUL-terminated key.
+ */
+unsigned int _hash_key(char* key) {
+  return (unsigned int)hash_bytes(key, strlen(key));
 }
 
 
@@ -120,27 +226,31 @@ unsigned int _djb_hash(char* key) {
 void _hash_resize(struct hash* hash) {
 
   /*
-   * Remember the old table array and its capacity and re-initialize the
-   * hash with a new table array with twice the capacity.
+   * Remember the old table array and re-initialize the hash with a new table
+   * array with twice the capacity.
    */
   struct association** old_table = hash->table;
-  unsigned int old_capacity = hash->capacity;
-  _hash_table_init(hash, old_capacity * 2);
+  TRACE3(hash_resize, hash->capacity, hash->capacity * 2, hash->num_elems);
+  _hash_table_init(hash, hash->capacity * 2);
 
   /*
-   * Loop through the old table and re-hash all the old elements via
-   * hash_insert().  This will handle updating the table's size for us.  By
-   * definition, this will not cause a recursive call to _hash_resize(),
-   * since the new table's capacity is doubled.  Free all the old assocation
-   * structures.
+   * Walk all the associations in insertion order and link each one into the
+   * head of its chain in the new table.  The associations themselves are
+   * reused, so the insertion order list is unaffected.  Chain lengths are
+   * recomputed along the way.
    */
-  for (int i = 0; i < old_capacity; i++) {
-    struct association* cur = old_table[i];
-    while (cur != NULL) {
-      struct association* tmp = cur;
-      hash_insert(hash, cur->key, cur->value);
-      cur = cur->next;
-      _association_free(tmp);
+  hash->max_chain = 0;
+  for (struct association* cur = hash->order_head; cur != NULL; cur = cur->order_next) {
+    unsigned int idx = _hash_key(cur->key) % hash->capacity;
+    cur->next = hash->table[idx];
+    hash->table[idx] = cur;
+
+    unsigned int chain = 0;
+    for (struct association* c = cur; c != NULL; c = c->next) {
+      chain++;
+    }
+    if (chain > hash->max_chain) {
+      hash->max_chain = chain;
     }
   }
 
@@ -170,16 +280,20 @@ void hash_insert(struct hash* hash, char* key, void* value) {
   assert(key);
 
   /*
-   * Double capacity of hash table if needed.
+   * Allocate the table array on first use, or double capacity of hash table if
+   * needed.
    */
-  if (_hash_load_factor(hash) > LOAD_FACTOR_THR) {
+  if (hash->table == NULL) {
+    TRACE3(hash_resize, 0, INITIAL_CAPACITY, 0);
+    _hash_table_init(hash, INITIAL_CAPACITY);
+  } else if (_hash_load_factor(hash) > LOAD_FACTOR_THR) {
     _hash_resize(hash);
   }
 
   /*
    * Compute a hash value for the given key and mod to convert it to an index.
    */
-  unsigned int hashval = _djb_hash(key);
+  unsigned int hashval = _hash_key(key);
   unsigned int idx = hashval % hash->capacity;
 
   /*
@@ -187,12 +301,14 @@ void hash_insert(struct hash* hash, char* key, void* value) {
    */
   struct association* cur = hash->table[idx];
   struct association* prev = NULL;
+  unsigned int chain = 0;
   while (cur != NULL) {
     if (!strcmp(key, cur->key)) {
       break;
     }
     prev = cur;
     cur = cur->next;
+    chain++;
   }
 
   if (cur != NULL) {
@@ -204,7 +320,8 @@ void hash_insert(struct hash* hash, char* key, void* value) {
     /*
      * If the user wants to add a new key/value pair into the table, allocate
      * a new association structure for it and put the new association at the
-     * head of the chain for its bucket.
+     * head of the chain for its bucket and at the tail of the insertion order
+     * list.
      */
     cur = _association_create(key, value);
     if (hash->table[idx] != NULL) {
@@ -214,6 +331,23 @@ void hash_insert(struct hash* hash, char* key, void* value) {
     }
     hash->table[idx] = cur;
     hash->num_elems++;
+    hash->key_bytes += strlen(key) + 1;
+
+    cur->order_next = NULL;
+    cur->order_prev = hash->order_tail;
+    if (hash->order_tail != NULL) {
+      hash->order_tail->order_next = cur;
+    } else {
+      hash->order_head = cur;
+    }
+    hash->order_tail = cur;
+
+    /*
+     * Keep track of the longest chain we've had to build.
+     */
+    if (chain + 1 > hash->max_chain) {
+      hash->max_chain = chain + 1;
+    }
   }
 }
 
@@ -224,11 +358,14 @@ void hash_insert(struct hash* hash, char* key, void* value) {
 void hash_remove(struct hash* hash, char* key) {
   assert(hash);
   assert(key);
+  if (hash->num_elems == 0) {
+    return;
+  }
 
   /*
    * Compute a hash value for the given key and mod to convert it to an index.
    */
-  unsigned int hashval = _djb_hash(key);
+  unsigned int hashval = _hash_key(key);
   unsigned int idx = hashval % hash->capacity;
 
   /*
@@ -255,6 +392,18 @@ void hash_remove(struct hash* hash, char* key) {
       hash->table[idx] = cur->next;
     }
 
+    if (cur->order_prev != NULL) {
+      cur->order_prev->order_next = cur->order_next;
+    } else {
+      hash->order_head = cur->order_next;
+    }
+    if (cur->order_next != NULL) {
+      cur->order_next->order_prev = cur->order_prev;
+    } else {
+      hash->order_tail = cur->order_prev;
+    }
+
+    hash->key_bytes -= strlen(cur->key) + 1;
     _association_free(cur);
     hash->num_elems--;
   }
@@ -268,11 +417,14 @@ void hash_remove(struct hash* hash, char* key) {
 void* hash_get(struct hash* hash, char* key) {
   assert(hash);
   assert(key);
+  if (hash->num_elems == 0) {
+    return 0;
+  }
 
   /*
    * Compute a hash value for the given key and mod to convert it to an index.
    */
-  unsigned int hashval = _djb_hash(key);
+  unsigned int hashval = _hash_key(key);
   unsigned int idx = hashval % hash->capacity;
 
   /*
@@ -299,11 +451,14 @@ void* hash_get(struct hash* hash, char* key) {
 int hash_contains(struct hash* hash, char* key) {
   assert(hash);
   assert(key);
+  if (hash->num_elems == 0) {
+    return 0;
+  }
 
   /*
    * Compute a hash value for the given key and mod to convert it to an index.
    */
-  unsigned int hashval = _djb_hash(key);
+  unsigned int hashval = _hash_key(key);
   unsigned int idx = hashval % hash->capacity;
 
   /*
@@ -324,6 +479,36 @@ int hash_contains(struct hash* hash, char* key) {
 }
 
 
+/*
+ * Returns the number of elements stored in a hash table.
+ */
+unsigned int hash_size(struct hash* hash) {
+  assert(hash);
+  return hash->num_elems;
+}
+
+
+/*
+ * Returns the number of bytes of memory a hash table uses, counting its
+ * bucket array, its associations and their copies of the keys.
+ */
+size_t hash_memory(struct hash* hash) {
+  assert(hash);
+  return sizeof(struct hash) + hash->capacity * sizeof(struct association*)
+    + hash->num_elems * sizeof(struct association) + hash->key_bytes;
+}
+
+
+/*
+ * Returns the length of the longest bucket chain built in a hash table since
+ * it was created or last resized.
+ */
+unsigned int hash_max_chain(struct hash* hash) {
+  assert(hash);
+  return hash->max_chain;
+}
+
+
 /*****************************************************************************
  **
  ** Iterator definitions
@@ -331,36 +516,15 @@ int hash_contains(struct hash* hash, char* key) {
  *****************************************************************************/
 
 /*
- * This is the structure representing a hash table iterator.
+ * This is the structure representing a hash table iterator.  Iterators visit
+ * elements in the order they were inserted.
  */
 struct hash_iter {
   struct hash* hash;
   struct association* next;
-  int next_idx;
 };
 
 
-/*
- * Utility function to update the `next` pointer for the hash table iterator to
- * point to the next element in the hash table.
- */
-void _update_hash_iter_next(struct hash_iter* iter) {
-  if (iter->next != NULL) {
-    iter->next = iter->next->next;
-  }
-  if (iter->next == NULL) {
-    int i = iter->next_idx + 1;
-    while (i < iter->hash->capacity && iter->hash->table[i] == NULL) {
-      i++;
-    }
-    if (i < iter->hash->capacity) {
-      iter->next_idx = i;
-      iter->next = iter->hash->table[i];
-    }
-  }
-}
-
-
 /*
  * Create a new iterator over a hash table.
  */
@@ -368,9 +532,7 @@ struct hash_iter* hash_iter_create(struct hash* hash) {
   assert(hash);
   struct hash_iter* iter = malloc(sizeof(struct hash_iter));
   iter->hash = hash;
-  iter->next = NULL;
-  iter->next_idx = -1;
-  _update_hash_iter_next(iter);
+  iter->next = hash->order_head;
   return iter;
 }
 
@@ -401,7 +563,7 @@ void* hash_iter_next(struct hash_iter* iter, char** key_ptr) {
   assert(iter);
   assert(iter->next);
   struct association* curr = iter->next;
-  _update_hash_iter_next(iter);
+  iter->next = curr->order_next;
   if (key_ptr != NULL) {
     *key_ptr = curr->key;
   }
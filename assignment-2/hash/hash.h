@@ -7,6 +7,9 @@
 #ifndef __HASH_H
 #define __HASH_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /*
  * Structure used to represent a hash table.
  */
@@ -49,7 +52,37 @@ void* hash_get(struct hash* hash, char* key);
 int hash_contains(struct hash* hash, char* key);
 
 /*
- * Create a new iterator over a hash table.
+ * Returns the number of elements stored in a hash table.
+ */
+unsigned int hash_size(struct hash* hash);
+
+/*
+ * Returns the number of bytes of memory a hash table uses, not counting the
+ * values stored in it.
+ */
+size_t hash_memory(struct hash* hash);
+
+/*
+ * Returns the length of the longest bucket chain built in a hash table since
+ * it was created or last resized.  With a well-behaved hash function this
+ * stays small no matter what keys are inserted.
+ */
+unsigned int hash_max_chain(struct hash* hash);
+
+/*
+ * Hashes `len` bytes of `data` using SipHash with a key chosen randomly once
+ * per process.  The results differ between runs.
+ */
+uint64_t hash_bytes(const void* data, size_t len);
+
+/*
+ * Hashes `len` bytes of `data` using SipHash with the given 128-bit key.
+ */
+uint64_t hash_bytes_keyed(const void* data, size_t len, const uint64_t key[2]);
+
+/*
+ * Create a new iterator over a hash table.  Iterators visit elements in the
+ * order they were first inserted.
  */
 struct hash_iter* hash_iter_create(struct hash* hash);
 
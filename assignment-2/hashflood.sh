@@ -0,0 +1,91 @@
+#!/bin/bash
+
+#
+# Checks that translation stays close to linear on input crafted to flood
+# the symbol table.  Identifiers are built by concatenating the pair "Ab" and
+# "BA", which have the same DJB hash (the table's old, unkeyed hash), so every
+# identifier of the same length would have landed in one bucket.  Programs
+# assigning and then reading 2^k of them are translated for doubling k, and
+# the report gives the time, the symbol table's longest bucket chain (from
+# --stats) and a growth exponent fitted by least squares on a log-log scale.
+#
+# The exit status is 1 if the exponent is over MAX_EXPONENT or any chain is
+# longer than MAX_CHAIN.  The table averages up to 5 entries per bucket before
+# it grows, so chains of 10 to 20 are normal; flooded, a chain would hold
+# every identifier.
+#
+
+output_dir="output_files"
+work_dir="$output_dir/hashflood"
+MAX_EXPONENT=${MAX_EXPONENT:-1.3}
+MAX_CHAIN=${MAX_CHAIN:-32}
+RUNS=${RUNS:-3}
+
+mkdir -p $work_dir
+
+echo "Compiling Parser..."
+make parse runstat || exit 1
+
+#
+# Writes a program assigning and then reading each of the 2^$1 identifiers
+# made of $1 "Ab"/"BA" pairs.
+#
+gen_colliding() {
+    awk -v k=$1 'BEGIN {
+        n = 2 ^ k
+        for (i = 0; i < n; i++) {
+            s = ""
+            for (b = 0; b < k; b++) s = s (int(i / 2 ^ b) % 2 ? "BA" : "Ab")
+            name[i] = s
+            print s " = " i
+        }
+        for (i = 0; i < n; i++) print "x = " name[i] " + 1"
+    }'
+}
+
+#
+# Prints the median time of translating file $1.
+#
+measure() {
+    for ((r = 0; r < RUNS; r++)); do
+        ./runstat $1 ./parse
+    done | sort -n | awk -v runs=$RUNS 'NR == int(runs / 2) + 1 { print $1 }'
+}
+
+status=0
+sizes=""
+times=""
+printf "\n%10s %10s %10s\n" "Names" "ms" "Chain"
+for k in 11 12 13 14 15; do
+    input=$work_dir/colliding_$k.py
+    gen_colliding $k > $input
+    t=$(measure $input)
+    chain=$(./parse --stats < $input 2>&1 > /dev/null \
+        | awk '/^Symbol table:/ { print $NF }')
+    sizes="$sizes $((2 ** k))"
+    times="$times $t"
+
+    printf "%10d %10.1f %10d" $((2 ** k)) $(awk -v t=$t 'BEGIN { print t * 1e3 }') $chain
+    if [[ $chain -gt $MAX_CHAIN ]]; then
+        printf "   FAIL (over %d)" $MAX_CHAIN
+        status=1
+    fi
+    printf "\n"
+done
+
+exponent=$(awk -v xs="$sizes" -v ys="$times" 'BEGIN {
+    n = split(xs, x, " "); split(ys, y, " ")
+    for (i = 1; i <= n; i++) {
+        lx = log(x[i]); ly = log(y[i])
+        sx += lx; sy += ly; sxx += lx * lx; sxy += lx * ly
+    }
+    printf "%.3f", (n * sxy - sx * sy) / (n * sxx - sx * sx)
+}')
+printf "\nTime exponent: %s" $exponent
+if awk -v e=$exponent -v max=$MAX_EXPONENT 'BEGIN { exit !(e > max) }'; then
+    printf "   FAIL (over %s)" $MAX_EXPONENT
+    status=1
+fi
+printf "\n"
+
+exit $status
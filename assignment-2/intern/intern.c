@@ -0,0 +1,468 @@
+/*
+ * This file contains the implementation of a string interner that any number
+ * of threads can share.  Strings are copied into large chunks of memory
+ * instead of being allocated one at a time, and each copy is preceded by its
+ * ID, so the ID of an interned string can be found from its pointer alone.
+ *
+ * The interner is split into NUM_SHARDS shards, each with its own lock,
+ * lookup table and string storage, and a string always goes to the shard
+ * picked by the top bits of its hash value.  Threads interning different
+ * strings almost always lock different shards, so they rarely wait for each
+ * other, and a thread that interns many strings at once with intern_strings()
+ * takes each shard's lock only once.
+ *
+ * IDs are shared by all of the shards: a new string takes the next one from
+ * a single atomic counter, so IDs stay consecutive and can index arrays.  The
+ * entry for each ID (its string, length and hash value) lives in a directory
+ * of fixed-size blocks that never move once allocated, so intern_name() needs
+ * no lock.  A thread can only know an ID after interning its string, which
+ * locks the shard that stored it, so the entry is always visible by then.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "intern.h"
+#include "../hash/hash.h"
+
+/*
+ * The number of shards (a power of 2), the number of entries in each block of
+ * the ID directory (also a power of 2) and the number of blocks.
+ */
+#define SHARD_BITS 6
+#define NUM_SHARDS (1 << SHARD_BITS)
+#define BLOCK_BITS 12
+#define BLOCK_SIZE (1u << BLOCK_BITS)
+#define MAX_BLOCKS 4096
+
+/*
+ * The sizes of the first and the largest chunks of string storage in each
+ * shard, and the initial capacity of each shard's lookup table (which must be
+ * a power of 2).  Shards start small, since most programs only have a few
+ * names per shard.
+ */
+#define MIN_CHUNK_SIZE 1024
+#define CHUNK_SIZE 65536
+#define INITIAL_CAPACITY 16
+
+/*
+ * The size of a cache line, which each shard is aligned to so that threads
+ * using neighbouring shards don't contend for the same line.
+ */
+#define CACHE_LINE 64
+
+/*
+ * A chunk of memory that interned strings are copied into.
+ */
+struct intern_chunk {
+  struct intern_chunk* next;
+  size_t used;
+  size_t capacity;
+  char data[];
+};
+
+/*
+ * A slot of a shard's lookup table, holding ID + 1 (or 0 if the slot is
+ * empty) and the string's hash value, so most mismatches are found without
+ * looking up the entry.
+ */
+struct intern_slot {
+  unsigned int id;
+  unsigned int hash;
+};
+
+/*
+ * The entry for an ID.
+ */
+struct intern_entry {
+  const char* name;
+  unsigned int length;
+  unsigned int hash;
+};
+
+/*
+ * One shard of the interner.  Everything in it is protected by `lock`.
+ */
+struct intern_shard {
+  pthread_mutex_t lock;
+  struct intern_slot* slots;
+  unsigned int capacity;
+  unsigned int count;
+  struct intern_chunk* chunks;
+  size_t chunk_bytes;
+} __attribute__((aligned(CACHE_LINE)));
+
+/*
+ * This structure is used to represent the interner itself.  `count` is the
+ * next ID to give out, and `blocks` the directory of entries by ID, whose
+ * blocks are allocated as IDs reach them.  Both are updated atomically.
+ */
+struct interner {
+  struct intern_shard shards[NUM_SHARDS];
+  struct intern_entry* blocks[MAX_BLOCKS];
+  unsigned int count;
+  size_t block_bytes;
+};
+
+
+/*
+ * Helper function returning the shard for a string with a given 64-bit hash
+ * value.  The top bits pick the shard and the bottom bits the slot, so the
+ * strings in a shard are spread over all of its slots.
+ */
+struct intern_shard* _intern_shard(struct interner* interner, uint64_t hashval) {
+  return &interner->shards[hashval >> (64 - SHARD_BITS)];
+}
+
+
+/*
+ * Helper function returning the entry for an ID, allocating its block if no
+ * thread has yet.  If two threads allocate the same block at once, the one
+ * that installs it second frees its own.
+ */
+struct intern_entry* _intern_entry(struct interner* interner, unsigned int id) {
+  assert(id >> BLOCK_BITS < MAX_BLOCKS);
+  struct intern_entry** block = &interner->blocks[id >> BLOCK_BITS];
+  struct intern_entry* entries = __atomic_load_n(block, __ATOMIC_ACQUIRE);
+  if (!entries) {
+    struct intern_entry* fresh = malloc(BLOCK_SIZE * sizeof(struct intern_entry));
+    assert(fresh);
+    if (__atomic_compare_exchange_n(block, &entries, fresh, 0, __ATOMIC_ACQ_REL,
+        __ATOMIC_ACQUIRE)) {
+      entries = fresh;
+      __atomic_fetch_add(&interner->block_bytes, BLOCK_SIZE * sizeof(struct intern_entry),
+          __ATOMIC_RELAXED);
+    } else {
+      free(fresh);
+    }
+  }
+  return &entries[id & (BLOCK_SIZE - 1)];
+}
+
+
+/*
+ * Helper function to allocate a new chunk able to hold at least `min_size`
+ * bytes and put it at the head of a shard's chunk list.  Each chunk is twice
+ * the size of the last, up to CHUNK_SIZE.
+ */
+struct intern_chunk* _intern_chunk_push(struct intern_shard* shard, size_t min_size) {
+  size_t capacity = shard->chunks ? 2 * shard->chunks->capacity : MIN_CHUNK_SIZE;
+  capacity = capacity < CHUNK_SIZE ? capacity : CHUNK_SIZE;
+  capacity = min_size > capacity ? min_size : capacity;
+  struct intern_chunk* chunk = malloc(sizeof(struct intern_chunk) + capacity);
+  assert(chunk);
+  chunk->next = shard->chunks;
+  chunk->used = 0;
+  chunk->capacity = capacity;
+  shard->chunks = chunk;
+  shard->chunk_bytes += sizeof(struct intern_chunk) + capacity;
+  return chunk;
+}
+
+
+/*
+ * Create a new, empty interner.  Shards get their storage when the first
+ * string is added to them.
+ */
+struct interner* intern_create() {
+  struct interner* interner;
+  int error = posix_memalign((void**)&interner, CACHE_LINE, sizeof(struct interner));
+  assert(!error);
+  memset(interner, 0, sizeof(struct interner));
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    pthread_mutex_init(&interner->shards[i].lock, NULL);
+  }
+  return interner;
+}
+
+
+/*
+ * Free the memory associated with an interner, including every string it
+ * stores.
+ */
+void intern_free(struct interner* interner) {
+  assert(interner);
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    struct intern_shard* shard = &interner->shards[i];
+    struct intern_chunk* next, * cur = shard->chunks;
+    while (cur != NULL) {
+      next = cur->next;
+      free(cur);
+      cur = next;
+    }
+    free(shard->slots);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  for (int i = 0; i < MAX_BLOCKS; i++) {
+    free(interner->blocks[i]);
+  }
+  free(interner);
+}
+
+
+/*
+ * Forget every string stored in an interner and free its storage, except for
+ * the first block of the ID directory.  Shards start again from nothing, so
+ * an interner reset because it grew too large is small again afterward.
+ */
+void intern_reset(struct interner* interner) {
+  assert(interner);
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    struct intern_shard* shard = &interner->shards[i];
+    struct intern_chunk* next, * cur = shard->chunks;
+    while (cur != NULL) {
+      next = cur->next;
+      free(cur);
+      cur = next;
+    }
+    shard->chunks = NULL;
+    shard->chunk_bytes = 0;
+
+    free(shard->slots);
+    shard->slots = NULL;
+    shard->capacity = 0;
+    shard->count = 0;
+  }
+  for (int i = 1; i < MAX_BLOCKS; i++) {
+    if (interner->blocks[i]) {
+      free(interner->blocks[i]);
+      interner->blocks[i] = NULL;
+      interner->block_bytes -= BLOCK_SIZE * sizeof(struct intern_entry);
+    }
+  }
+  interner->count = 0;
+}
+
+
+/*
+ * Resets an interner if it uses more than `limit` bytes of memory.
+ */
+int intern_reclaim(struct interner* interner, size_t limit) {
+  if (intern_memory(interner) <= limit) {
+    return 0;
+  }
+  intern_reset(interner);
+  return 1;
+}
+
+
+/*
+ * Helper function to find the lookup table slot for a string in a shard,
+ * whose lock must be held.  Returns the index of the slot holding the string
+ * if it's present or of the empty slot where it would be inserted otherwise.
+ */
+unsigned int _intern_find_slot(struct interner* interner, struct intern_shard* shard,
+    const char* str, size_t len, unsigned int hashval) {
+  unsigned int mask = shard->capacity - 1;
+  unsigned int idx = hashval & mask;
+  while (shard->slots[idx].id != 0) {
+    if (shard->slots[idx].hash == hashval) {
+      struct intern_entry* entry = _intern_entry(interner, shard->slots[idx].id - 1);
+      if (entry->length == len && !memcmp(entry->name, str, len)) {
+        break;
+      }
+    }
+    idx = (idx + 1) & mask;
+  }
+  return idx;
+}
+
+
+/*
+ * Helper function to give a shard's lookup table `capacity` slots (a power of
+ * 2), re-inserting every occupied slot using its stored hash value.
+ */
+void _intern_resize(struct intern_shard* shard, unsigned int capacity) {
+  struct intern_slot* old = shard->slots;
+  unsigned int old_capacity = shard->capacity;
+  shard->capacity = capacity;
+  shard->slots = calloc(capacity, sizeof(struct intern_slot));
+  assert(shard->slots);
+
+  unsigned int mask = capacity - 1;
+  for (unsigned int i = 0; i < old_capacity; i++) {
+    if (old[i].id != 0) {
+      unsigned int idx = old[i].hash & mask;
+      while (shard->slots[idx].id != 0) {
+        idx = (idx + 1) & mask;
+      }
+      shard->slots[idx] = old[i];
+    }
+  }
+  free(old);
+}
+
+
+/*
+ * Helper function to copy a string into a shard's chunk storage, preceded by
+ * its ID.
+ */
+const char* _intern_copy(struct intern_shard* shard, const char* str, size_t len,
+    unsigned int id) {
+  /*
+   * Keep each entry aligned so the ID in front of it can be read directly.
+   */
+  size_t size = sizeof(unsigned int) + len + 1;
+  size = (size + sizeof(unsigned int) - 1) & ~(sizeof(unsigned int) - 1);
+
+  struct intern_chunk* chunk = shard->chunks;
+  if (!chunk || chunk->capacity - chunk->used < size) {
+    chunk = _intern_chunk_push(shard, size);
+  }
+
+  char* entry = chunk->data + chunk->used;
+  chunk->used += size;
+  *(unsigned int*)entry = id;
+  memcpy(entry + sizeof(unsigned int), str, len);
+  entry[sizeof(unsigned int) + len] = '\0';
+
+  return entry + sizeof(unsigned int);
+}
+
+
+/*
+ * Helper function returning the interned copy of a string in a shard whose
+ * lock is held, adding it with the next ID if it isn't there yet.
+ */
+const char* _intern_locked(struct interner* interner, struct intern_shard* shard,
+    const char* str, size_t len, unsigned int hashval) {
+  if (!shard->slots) {
+    shard->capacity = INITIAL_CAPACITY;
+    shard->slots = calloc(shard->capacity, sizeof(struct intern_slot));
+    assert(shard->slots);
+  }
+
+  unsigned int idx = _intern_find_slot(interner, shard, str, len, hashval);
+  if (shard->slots[idx].id != 0) {
+    return _intern_entry(interner, shard->slots[idx].id - 1)->name;
+  }
+
+  unsigned int id = __atomic_fetch_add(&interner->count, 1, __ATOMIC_RELAXED);
+  struct intern_entry* entry = _intern_entry(interner, id);
+  entry->name = _intern_copy(shard, str, len, id);
+  entry->length = len;
+  entry->hash = hashval;
+  shard->slots[idx].id = id + 1;
+  shard->slots[idx].hash = hashval;
+  shard->count++;
+
+  /*
+   * Keep the lookup table at most half full.
+   */
+  if (2 * shard->count > shard->capacity) {
+    _intern_resize(shard, 2 * shard->capacity);
+  }
+
+  return entry->name;
+}
+
+
+/*
+ * Returns the interned copy of the first `len` bytes of `str`, adding it to
+ * the interner if it isn't there yet.
+ */
+const char* intern_string(struct interner* interner, const char* str, size_t len) {
+  assert(interner);
+  assert(str);
+
+  uint64_t hashval = hash_bytes(str, len);
+  struct intern_shard* shard = _intern_shard(interner, hashval);
+  pthread_mutex_lock(&shard->lock);
+  const char* interned = _intern_locked(interner, shard, str, len, (unsigned int)hashval);
+  pthread_mutex_unlock(&shard->lock);
+  return interned;
+}
+
+
+/*
+ * Interns `count` strings at once.  The strings are hashed and sorted by
+ * shard first (with a counting sort), then each shard is locked once to
+ * intern all of its strings.
+ */
+void intern_strings(struct interner* interner, const char* const* strs, const size_t* lens,
+    size_t count, const char** interned) {
+  assert(interner);
+  uint64_t* hashes = malloc(count * sizeof(uint64_t));
+  size_t* order = malloc(count * sizeof(size_t));
+  assert(count == 0 || (hashes && order));
+
+  size_t starts[NUM_SHARDS + 1] = { 0 };
+  for (size_t i = 0; i < count; i++) {
+    hashes[i] = hash_bytes(strs[i], lens[i]);
+    starts[(hashes[i] >> (64 - SHARD_BITS)) + 1]++;
+  }
+  for (int s = 0; s < NUM_SHARDS; s++) {
+    starts[s + 1] += starts[s];
+  }
+  size_t next[NUM_SHARDS];
+  memcpy(next, starts, sizeof(next));
+  for (size_t i = 0; i < count; i++) {
+    order[next[hashes[i] >> (64 - SHARD_BITS)]++] = i;
+  }
+
+  for (int s = 0; s < NUM_SHARDS; s++) {
+    if (starts[s] == starts[s + 1]) {
+      continue;
+    }
+    struct intern_shard* shard = &interner->shards[s];
+    pthread_mutex_lock(&shard->lock);
+    for (size_t j = starts[s]; j < starts[s + 1]; j++) {
+      size_t i = order[j];
+      interned[i] = _intern_locked(interner, shard, strs[i], lens[i], (unsigned int)hashes[i]);
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  free(hashes);
+  free(order);
+}
+
+
+/*
+ * Returns the ID of a string returned by intern_string().
+ */
+unsigned int intern_id(const char* interned) {
+  assert(interned);
+  return *(const unsigned int*)(interned - sizeof(unsigned int));
+}
+
+
+/*
+ * Returns the interned string with a given ID.
+ */
+const char* intern_name(struct interner* interner, unsigned int id) {
+  assert(interner);
+  assert(id < __atomic_load_n(&interner->count, __ATOMIC_RELAXED));
+  return _intern_entry(interner, id)->name;
+}
+
+
+/*
+ * Returns the number of distinct strings stored in an interner.
+ */
+unsigned int intern_count(struct interner* interner) {
+  assert(interner);
+  return __atomic_load_n(&interner->count, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Returns the number of bytes of memory an interner uses.  Each shard is
+ * locked in turn while its memory is counted.
+ */
+size_t intern_memory(struct interner* interner) {
+  assert(interner);
+  size_t bytes = sizeof(struct interner)
+    + __atomic_load_n(&interner->block_bytes, __ATOMIC_RELAXED);
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    struct intern_shard* shard = &interner->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    bytes += shard->chunk_bytes + shard->capacity * sizeof(struct intern_slot);
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return bytes;
+}
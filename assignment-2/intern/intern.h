@@ -0,0 +1,90 @@
+/*
+ * This file contains the declarations for a string interner.  Each distinct
+ * string is stored exactly once and is assigned a small, stable integer ID.
+ * One interner may be shared by any number of threads and translation
+ * contexts.  See intern.c for implementation details.
+ */
+
+#ifndef __INTERN_H
+#define __INTERN_H
+
+#include <stddef.h>
+
+/*
+ * How much memory a shared interner may grow to before intern_reclaim()
+ * forgets its strings.  Batch modes share one interner across files, so
+ * names common to the files are interned once, and reclaim it between files.
+ */
+#define INTERN_RECLAIM_BYTES (1u << 20)
+
+/*
+ * Structure used to represent an interner.
+ */
+struct interner;
+
+/*
+ * Create a new, empty interner.
+ */
+struct interner* intern_create();
+
+/*
+ * Free the memory associated with an interner, including every string it
+ * stores.  Pointers returned by intern_string() are invalid afterwards.
+ */
+void intern_free(struct interner* interner);
+
+/*
+ * Forget every string stored in an interner and free most of its memory.
+ * Pointers returned by intern_string() are invalid afterwards, and
+ * IDs start again from 0.  Unlike the other functions, this mustn't be called
+ * while any other thread is using the interner.
+ */
+void intern_reset(struct interner* interner);
+
+/*
+ * Resets an interner, as intern_reset() does, if it uses more than `limit`
+ * bytes of memory.  It's meant to be called at the boundaries between the
+ * files of a batch, where no strings are in use.  Returns 1 if the interner
+ * was reset or 0 if not.
+ */
+int intern_reclaim(struct interner* interner, size_t limit);
+
+/*
+ * Returns the interned copy of the first `len` bytes of `str`, adding it to
+ * the interner if it isn't there yet.  The returned string is NUL-terminated
+ * and stays valid until the interner is reset or freed.
+ */
+const char* intern_string(struct interner* interner, const char* str, size_t len);
+
+/*
+ * Interns `count` strings at once, setting `interned[i]` to the interned copy
+ * of the first `lens[i]` bytes of `strs[i]`.  This is faster than interning
+ * each string in turn when several threads share the interner, since each
+ * part of the interner is locked once for the whole batch.
+ */
+void intern_strings(struct interner* interner, const char* const* strs, const size_t* lens,
+    size_t count, const char** interned);
+
+/*
+ * Returns the ID of a string returned by intern_string().  IDs are assigned
+ * consecutively from 0 in the order strings are first interned.
+ */
+unsigned int intern_id(const char* interned);
+
+/*
+ * Returns the interned string with a given ID.
+ */
+const char* intern_name(struct interner* interner, unsigned int id);
+
+/*
+ * Returns the number of distinct strings stored in an interner, which is one
+ * more than the highest ID it has given out.
+ */
+unsigned int intern_count(struct interner* interner);
+
+/*
+ * Returns the number of bytes of memory an interner uses.
+ */
+size_t intern_memory(struct interner* interner);
+
+#endif
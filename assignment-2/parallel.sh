@@ -0,0 +1,98 @@
+#!/bin/bash
+
+#
+# Measures how translating one large program scales with the number of
+# threads it's spread across (parse -jN), and checks that every thread count
+# gives exactly the output and diagnostics of a sequential translation.  With
+# -jN the parse is split into chunks, and the code of each group of statements
+# is generated and checked for undefined symbols in a separate task, all run
+# by a work-stealing scheduler.  Two programs are generated: a valid one, and
+# one that also reads undefined variables, so the undefined-symbol checks made
+# across tasks are covered.  The report gives the median wall time and speedup
+# for each thread count, and how long the code generation tasks take.
+#
+# The exit status is 1 if any thread count gives different output or
+# diagnostics from -j1.
+#
+
+output_dir="output_files"
+work_dir="$output_dir/parallel"
+RUNS=${RUNS:-5}
+STATEMENTS=${STATEMENTS:-60000}
+MAX_JOBS=${MAX_JOBS:-$(( $(nproc) > 4 ? $(nproc) : 4 ))}
+
+mkdir -p $work_dir
+
+echo "Compiling Parser..."
+make parse runstat || exit 1
+
+#
+# Generates the programs: assignments, if/elif/else chains, while loops and
+# comments, with about one statement in a thousand reading an undefined
+# variable in the second one.
+#
+python3 -c '
+import random, sys
+for name, undefined in (("valid", 0), ("undefined", 0.001)):
+    random.seed(1)
+    names, lines = ["x0"], ["x0 = 1"]
+    for i in range(int(sys.argv[2])):
+        r, v = random.random(), random.choice(names)
+        if r < 0.6:
+            new = "x%d" % random.randrange(500)
+            lines.append("%s = %s * %d + %s" % (new, v, i % 9 + 1, random.choice(names)))
+            names.append(new)
+        elif r < 0.75:
+            lines.append("if %s > %d:\n    y = %s + 1\n    while y < 3:\n        y = y + 1\n"
+                         "        break\nelif %s == 2:\n    y = 2\nelse:\n    y = 3" % (v, i, v, v))
+        elif r < 0.85:
+            lines.append("\n# comment %d" % i)
+        else:
+            lines.append("while %s < 10:\n    %s = %s + 1\n    z = not %s and %s" % (v, v, v, v, v))
+        if random.random() < undefined:
+            lines.append("q = undefined%d + 1" % i)
+    open("%s/%s.py" % (sys.argv[1], name), "w").write("\n".join(lines) + "\n")
+' $work_dir $STATEMENTS
+
+#
+# Prints the median wall-clock seconds of translating file $1 with -j$2.
+#
+measure() {
+    for ((r = 0; r < RUNS; r++)); do
+        ./runstat $1 ./parse -j$2
+    done | sort -n | awk -v runs=$RUNS 'NR == int(runs / 2) + 1 { print $1 }'
+}
+
+status=0
+for program in valid undefined; do
+    input=$work_dir/$program.py
+    printf "\n%s.py: %d lines, %d bytes, %d CPUs\n" $program $(wc -l < $input) $(wc -c < $input) $(nproc)
+    printf "%-8s %10s %10s %10s\n" "Threads" "ms" "speedup" "output"
+
+    ./parse -j1 < $input > $work_dir/$program.1.c 2> $work_dir/$program.1.err
+    base_time=$(measure $input 1)
+    [[ $program == valid ]] && valid_time=$base_time
+    for ((jobs = 1; jobs <= MAX_JOBS; jobs *= 2)); do
+        ./parse -j$jobs < $input > $work_dir/$program.$jobs.c 2> $work_dir/$program.$jobs.err
+        matched=same
+        if ! cmp -s $work_dir/$program.1.c $work_dir/$program.$jobs.c \
+                || ! cmp -s $work_dir/$program.1.err $work_dir/$program.$jobs.err; then
+            matched=DIFFERENT
+            status=1
+        fi
+        t=$([[ $jobs -eq 1 ]] && echo $base_time || measure $input $jobs)
+        printf "%-8d %10.1f %9.2fx %10s\n" $jobs $(awk -v t=$t 'BEGIN { print t * 1e3 }') \
+            $(awk -v b=$base_time -v t=$t 'BEGIN { print b / t }') $matched
+    done
+done
+
+#
+# The emit phase of a -jN translation is its code generation tasks, which
+# write out each statement's expressions and check its symbols (both done
+# during the parse when translating sequentially), and writing the code out.
+# --stats parses sequentially, so the time doesn't include any of the parse.
+#
+./parse --stats -j$MAX_JOBS < $work_dir/valid.py 2>&1 > /dev/null | awk -v total=$valid_time -v jobs=$MAX_JOBS '
+    $1 == "emit" { printf "\nCode generation tasks and output (-j%d): %.1f ms; a sequential translation takes %.1f ms\n", jobs, $3, total * 1e3 }'
+
+exit $status
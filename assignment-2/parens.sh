@@ -0,0 +1,276 @@
+#!/bin/bash
+
+#
+# Checks that expressions are translated with exactly the parentheses C needs
+# to keep Python's meaning, and that they compute what Python computes.
+# Every expression with up to three operators, drawn from all of the binary
+# operators and `not`, is generated, along with every chain of two and three
+# comparisons.  Each is written with the parentheses Python needs (by
+# ast.unparse()), translated, and checked two ways:
+#
+#   - its C code is parsed by a parser written from the productions of C's
+#     expression grammar, and must give the tree Python's parse tree stands
+#     for in C: `and` and `or` as ?: (`a ? b : a` and `a ? a : b`, grouped
+#     to the right as Python evaluates them), a chain of comparisons as the
+#     comparisons joined by &&, and `not` as !.  Removing any one pair of its
+#     parentheses must give a different tree or no parse at all;
+#   - compiled, it must compute the value Python's eval() gives, with True
+#     and False as 1 and 0.
+#
+# Neither check uses a precedence table, so neither shares one with expr.c.
+#
+# Variables are 2, 3, 5 and 0, so `and`, `or` and `not` see false operands.
+# An expression that divides by zero is an error in Python (and, when the
+# divisor is a comparison, which is an int in C, a crash in C), so those only
+# have their C code checked.  The exit status is 1 if any expression fails
+# either check.
+#
+
+output_dir="output_files"
+work_dir="$output_dir/parens"
+MAX_OPERATORS=${MAX_OPERATORS:-3}
+
+mkdir -p $work_dir
+
+echo "Compiling Parser..."
+make parse || exit 1
+
+#
+# Writes a Python program assigning every expression to $work_dir/exprs.py,
+# one assigning those that don't divide by zero to $work_dir/values.py, and
+# each expression, its value (or - if it divides by zero) and its expected C
+# tree to $work_dir/expected.
+#
+python3 - $work_dir $MAX_OPERATORS <<'EOF'
+import ast, itertools, sys
+
+work_dir, max_operators = sys.argv[1], int(sys.argv[2])
+values = {"a": 2.0, "b": 3.0, "c": 5.0, "d": 0.0}
+
+binary = [ast.Add(), ast.Sub(), ast.Mult(), ast.Div(), ast.Eq(), ast.NotEq(),
+          ast.Gt(), ast.GtE(), ast.Lt(), ast.LtE(), ast.And(), ast.Or()]
+
+def trees(n):
+    """Every tree with n operators, as a function of its leaves."""
+    if n == 0:
+        yield lambda leaves: ast.Name(next(leaves))
+        return
+    for operand in trees(n - 1):
+        yield lambda leaves, o=operand: ast.UnaryOp(ast.Not(), o(leaves))
+    for op in binary:
+        for i in range(n):
+            for left in trees(i):
+                for right in trees(n - 1 - i):
+                    def build(leaves, op=op, left=left, right=right):
+                        l, r = left(leaves), right(leaves)
+                        if isinstance(op, (ast.And, ast.Or)):
+                            return ast.BoolOp(op, [l, r])
+                        if isinstance(op, ast.cmpop):
+                            return ast.Compare(l, [op], [r])
+                        return ast.BinOp(l, op, r)
+                    yield build
+
+exprs = []
+for n in range(1, max_operators + 1):
+    for tree in trees(n):
+        exprs.append(ast.unparse(tree(iter("abcd"))))
+comparisons = binary[4:10]
+for length in (2, 3):
+    for ops in itertools.product(comparisons, repeat=length):
+        exprs.append(ast.unparse(ast.Compare(ast.Name("a"), list(ops),
+                                             [ast.Name(x) for x in "bcd"[:length]])))
+
+c_spelling = {ast.Add: "+", ast.Sub: "-", ast.Mult: "*", ast.Div: "/", ast.Eq: "==",
+              ast.NotEq: "!=", ast.Gt: ">", ast.GtE: ">=", ast.Lt: "<", ast.LtE: "<="}
+
+def to_c_tree(node):
+    """The tree Python's parse tree stands for in C, as nested tuples."""
+    if isinstance(node, ast.BoolOp):
+        *rest, result = [to_c_tree(x) for x in node.values]
+        for value in reversed(rest):
+            if isinstance(node.op, ast.And):
+                result = ("?:", value, result, value)
+            else:
+                result = ("?:", value, value, result)
+        return result
+    if isinstance(node, ast.Compare):
+        operands = [to_c_tree(x) for x in [node.left] + node.comparators]
+        result = None
+        for op, l, r in zip(node.ops, operands, operands[1:]):
+            comparison = (c_spelling[type(op)], l, r)
+            result = comparison if result is None else ("&&", result, comparison)
+        return result
+    if isinstance(node, ast.BinOp):
+        return (c_spelling[type(node.op)], to_c_tree(node.left), to_c_tree(node.right))
+    if isinstance(node, ast.UnaryOp):
+        return ("!", to_c_tree(node.operand))
+    return node.id
+
+with open(work_dir + "/exprs.py", "w") as program, open(work_dir + "/values.py", "w") as safe, \
+        open(work_dir + "/expected", "w") as expected:
+    for name, value in values.items():
+        program.write("%s = %r\n" % (name, value))
+        safe.write("%s = %r\n" % (name, value))
+    for i, expr in enumerate(exprs):
+        program.write("e%d = %s\n" % (i, expr))
+        try:
+            value = "%f" % float(eval(expr, {}, dict(values)))
+            safe.write("e%d = %s\n" % (i, expr))
+        except ZeroDivisionError:
+            value = "-"
+        tree = to_c_tree(ast.parse(expr, mode="eval").body)
+        expected.write("e%d\t%s\t%s\t%r\n" % (i, expr, value, tree))
+print("%d expressions" % len(exprs))
+EOF
+
+if ! ./parse --fast-compile < $work_dir/exprs.py > $work_dir/exprs.c \
+        || ! ./parse --fast-compile < $work_dir/values.py > $work_dir/values.c; then
+    echo "FAIL (could not translate)"
+    exit 1
+fi
+if ! gcc -w $work_dir/values.c -o $work_dir/values; then
+    echo "FAIL (could not compile)"
+    exit 1
+fi
+$work_dir/values > $work_dir/actual
+
+#
+# Parses the C code of each expression and compares its tree and value with
+# the expected ones.
+#
+python3 - $work_dir <<'EOF'
+import ast, re, sys
+
+work_dir = sys.argv[1]
+
+def tokenize(code):
+    return re.findall(r"[A-Za-z_]\w*|\d+(?:\.\d*)?|==|!=|<=|>=|&&|\|\||[-+*/<>!?:()]", code)
+
+class Parser:
+    """
+    A recursive-descent parser for the part of C's expression grammar (C11
+    6.5) the translator uses, one function per production.
+    """
+    def __init__(self, tokens):
+        self.tokens, self.pos = tokens, 0
+
+    def peek(self):
+        return self.tokens[self.pos] if self.pos < len(self.tokens) else None
+
+    def take(self, expected=None):
+        token = self.peek()
+        if token is None or (expected is not None and token != expected):
+            raise SyntaxError(token)
+        self.pos += 1
+        return token
+
+    def binary(self, operand, operators):
+        """A left-associative production: operand (operator operand)*."""
+        result = operand()
+        while self.peek() in operators:
+            op = self.take()
+            result = (op, result, operand())
+        return result
+
+    def primary(self):
+        if self.peek() == "(":
+            self.take("(")
+            result = self.expression()
+            self.take(")")
+            return result
+        token = self.take()
+        if not re.match(r"\w", token):
+            raise SyntaxError(token)
+        return token
+
+    def unary(self):
+        if self.peek() == "!":
+            self.take("!")
+            return ("!", self.unary())
+        return self.primary()
+
+    def multiplicative(self):
+        return self.binary(self.unary, ("*", "/"))
+
+    def additive(self):
+        return self.binary(self.multiplicative, ("+", "-"))
+
+    def relational(self):
+        return self.binary(self.additive, ("<", ">", "<=", ">="))
+
+    def equality(self):
+        return self.binary(self.relational, ("==", "!="))
+
+    def logical_and(self):
+        return self.binary(self.equality, ("&&",))
+
+    def logical_or(self):
+        return self.binary(self.logical_and, ("||",))
+
+    def conditional(self):
+        condition = self.logical_or()
+        if self.peek() != "?":
+            return condition
+        self.take("?")
+        middle = self.expression()
+        self.take(":")
+        return ("?:", condition, middle, self.conditional())
+
+    def expression(self):
+        return self.conditional()
+
+def parse(tokens):
+    parser = Parser(tokens)
+    tree = parser.expression()
+    if parser.peek() is not None:
+        raise SyntaxError(parser.peek())
+    return tree
+
+def redundant_parens(tokens, tree):
+    """The index of an opening parenthesis that can be removed without changing the tree, if any."""
+    stack, pairs = [], []
+    for i, token in enumerate(tokens):
+        if token == "(":
+            stack.append(i)
+        elif token == ")":
+            pairs.append((stack.pop(), i))
+    for open_at, close_at in pairs:
+        try:
+            if parse(tokens[:open_at] + tokens[open_at + 1:close_at] + tokens[close_at + 1:]) == tree:
+                return open_at
+        except SyntaxError:
+            pass
+    return None
+
+expected = {}
+for line in open(work_dir + "/expected"):
+    name, expr, value, tree = line.rstrip("\n").split("\t")
+    expected[name] = (expr, value, ast.literal_eval(tree))
+actual_code = {}
+for line in open(work_dir + "/exprs.c"):
+    match = re.match(r"^(e\d+) = (.*);$", line.rstrip("\n"))
+    if match:
+        actual_code[match.group(1)] = match.group(2)
+actual_value = dict(line.rstrip("\n").split(": ") for line in open(work_dir + "/actual"))
+
+failed = 0
+for name, (expr, value, tree) in expected.items():
+    code = actual_code.get(name, "")
+    tokens = tokenize(code)
+    try:
+        actual_tree = parse(tokens)
+    except SyntaxError:
+        actual_tree = None
+    problem = None
+    if actual_tree != tree:
+        problem = "    C code:   %s\n    C tree:   %r\n    expected: %r" % (code, actual_tree, tree)
+    elif redundant_parens(tokens, tree) is not None:
+        problem = "    C code:   %s\n    has parentheses C doesn't need" % code
+    elif value != "-" and actual_value.get(name) != value:
+        problem = "    value:    %s\n    expected: %s" % (actual_value.get(name), value)
+    if problem:
+        print("%s\n%s" % (expr, problem))
+        failed += 1
+print("%d expressions checked, %d failed" % (len(expected), failed))
+sys.exit(failed > 0)
+EOF
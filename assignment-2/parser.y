@@ -3,31 +3,118 @@
 /*
  * PROLOGUE
 */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdio_ext.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <limits.h>
 
 #include "parser.h"
-#include "hash/hash.h"
+#include "watch/watch.h"
+#include "fileio/fileio.h"
+#include "bundle/bundle.h"
+#include "zstream/zstream.h"
+#include "build/build.h"
+#include "sched/sched.h"
+#include "trace/trace.h"
 
-struct hash* symbols; // symbols hash map
+// function prototype
+void yyerror(YYLTYPE* loc, struct py2c_ctx* ctx, const char* err);
 
-yypstate*    pstate; // parser state
+/*
+ * Every identifier reference seen by the parser, in source order.  Whether a
+ * symbol was defined before it is used is decided by resolve_symbols() in a
+ * sequential pass, rather than in the IDENTIFIER rule.  The pass runs as each
+ * top-level statement is completed, picking up where it left off, so only the
+ * references from the current statement are ever kept (unless the program's
+ * statements are checked by region tasks after the parse, see
+ * run_region_tasks(), which need all of them).  Names are interned by the
+ * scanner, so they can be identified by their interned ID.
+ * A read reserves the diagnostic sequence number an error about it gets, so
+ * the error is written where the IDENTIFIER rule would have reported it.
+ */
+struct symbol_ref {
+    char* name;
+    uint32_t offset;
+    int is_def;
+    int seq;
+};
 
-// lexer function
-extern int yylex();
+/*
+ * Where a top-level statement ends: the number of the program's regions and
+ * of the recorded symbol references up to the end of the statement.
+ */
+struct statement_end {
+    int regions;
+    int refs;
+};
 
-// function prototype
-void yyerror(YYLTYPE* loc, const char* err);
+/*
+ * The results of one region task (see run_region_tasks()): the generated code
+ * for a run of top-level statements, and what's left of checking their symbol
+ * references once the names they assign themselves are accounted for.
+ */
+struct region_task {
+    int first;                  // first statement of the run
+    int last;                   // statement after the last one
+    char* output;               // generated code (NULL if the translation failed)
+    size_t length;
+    int* open_reads;            // reads of names not yet assigned in the run, as reference indexes
+    int num_open_reads;
+    unsigned int* defs;         // interned IDs of the names the run assigns
+    int num_defs;
+};
+
+int region_tasks_enabled(struct py2c_ctx* ctx);
+int add_program_statement(struct py2c_ctx* ctx, struct region_list* statement, YYLTYPE loc);
+struct region_list* add_statement(struct py2c_ctx* ctx, struct region_list* list, struct region_list* statement,
+    YYLTYPE loc);
+struct region_list* new_regions(struct py2c_ctx* ctx, char* text);
+struct region_list* expr_regions(struct py2c_ctx* ctx, char* head, expr_id expr, const char* tail);
+struct region_list* append_regions(struct py2c_ctx* ctx, struct region_list* dst, struct region_list* src,
+    const char* tail, YYLTYPE loc);
+int check_memory(struct py2c_ctx* ctx, struct region_list* list, YYLTYPE loc);
+void record_symbol_ref(struct py2c_ctx* ctx, char* name, uint32_t offset, int is_def);
+void resolve_symbols(struct py2c_ctx* ctx);
+void run_region_tasks(struct py2c_ctx* ctx);
+
+/*
+ * Diagnostics are buffered and written out by flush_diagnostics() once parsing
+ * and resolution are done, in the order they would have been reported in had
+ * every check been made during the parse.  `seq` is a position in that order.
+ */
+struct diagnostic {
+    char* message;
+    int line;
+    int seq;
+};
+
+void flush_diagnostics(struct py2c_ctx* ctx);
 
-int _error = 0;
+expr_id number_leaf(struct py2c_ctx* ctx, float value, int is_float);
+expr_id build_binary(struct py2c_ctx* ctx, enum expr_op op, expr_id left, expr_id right, YYLTYPE loc);
 
 #define PARSE_ERROR(err_message, loc) do {                                        \
-        fprintf(stderr, "Error: %s on line %d\n", err_message, loc.first_line);   \
-        _error = 1;                                                               \
+        report_error(ctx, loc.offset, "Error: %s on line %d\n",                 \
+                     err_message, source_line(ctx->source, loc.offset));          \
         YYERROR;                                                                  \
 } while(0);                                                                       \
 
+/*
+ * Runs `op`, a hash table operation, with its cost counted in the hash phase.
+ */
+#define HASH_OP(op) do {                                                          \
+        perfcount_enter(ctx->counters, PHASE_HASH);                               \
+        op;                                                                       \
+        perfcount_leave(ctx->counters, PHASE_HASH);                               \
+} while(0)
+
 %}
 
 /*
@@ -36,15 +123,138 @@ int _error = 0;
 %locations
 %define parse.error verbose
 
+%code requires {
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <stdbool.h>
+    #include <stdio.h>
+
+    #include "hash/hash.h"
+    #include "region/region.h"
+    #include "intern/intern.h"
+    #include "expr/expr.h"
+    #include "source/source.h"
+    #include "perfcount/perfcount.h"
+    #include "remarks/remarks.h"
+
+    /*
+     * Locations are just the byte offset of the first character of a token or
+     * rule.  Line numbers are looked up from the source text when needed.
+     */
+    struct location {
+        uint32_t offset;
+    };
+
+    #define YYLLOC_DEFAULT(Current, Rhs, N)                                   \
+        do {                                                                  \
+            (Current).offset = (N) ? YYRHSLOC(Rhs, 1).offset                  \
+                                   : YYRHSLOC(Rhs, 0).offset;                 \
+        } while (0)
+}
+
+%define api.location.type {struct location}
+
+%code requires {
+    #define MAX_INDENT_LEVELS 128
+
+    /*
+     * The phases of a translation that --stats breaks hardware counters down
+     * by.  Hash operations (interning names, hash-consing expressions and
+     * adding symbols) are nested inside the other phases and are counted
+     * separately from them.
+     */
+    enum py2c_phase {
+        PHASE_SCAN,
+        PHASE_PARSE,
+        PHASE_HASH,
+        PHASE_EMIT,
+        NUM_PHASES
+    };
+
+    extern const char* const py2c_phase_names[NUM_PHASES];
+
+    /*
+     * All of the state for translating one program.  Input is fed to a context
+     * a chunk at a time with py2c_feed(), so any number of translations can be
+     * in progress at once.  The interner may be shared between contexts, even
+     * ones on different threads, and reset once none of them is in use.
+     */
+    struct py2c_ctx {
+        struct source* source;          // all input fed so far
+        size_t scanned;                 // offset up to which input has been scanned
+        int final;                      // set once the last chunk has been fed
+        int status;                     // parser status (YYPUSH_MORE while running)
+        struct yypstate* pstate;        // parser state
+
+        int indent_stack[MAX_INDENT_LEVELS];
+        int indent_stack_top;
+
+        struct interner* names;         // interned identifier and keyword names
+        struct hash* symbols;           // symbols hash map
+        struct expr_table* exprs;       // hash-consed expression nodes
+        struct region_list* program;    // generated code for each top-level statement
+        size_t region_memory;           // memory used by the program's and all other region lists
+        size_t max_memory;              // memory budget in bytes (0 for none)
+        struct perfcount* counters;     // per-phase counters (NULL unless --stats)
+        struct remarks* remarks;        // optimization remarks (NULL unless -R)
+        const char* path;               // input file name for remarks (NULL for stdin)
+        int compact;                    // write output tuned for compile time (--fast-compile)
+
+        struct symbol_ref* symbol_refs;
+        int num_symbol_refs;
+        int symbol_refs_capacity;
+        char* defined;                  // whether each interned name is defined yet
+        size_t defined_size;
+
+        struct diagnostic* diagnostics;
+        int num_diagnostics;
+        int diagnostics_capacity;
+        int next_seq;                   // next diagnostic sequence number
+
+        int chunk;                      // set for a chunk of a parallel parse (see py2c_parse_parallel())
+        int jobs;                       // threads for region tasks (see run_region_tasks())
+        struct statement_end* statements;   // where each top-level statement ends, for region tasks
+        int num_statements;
+        int statements_capacity;
+        struct region_task* region_tasks;   // each region task's results, in program order
+        int num_region_tasks;
+        int error;
+    };
+}
+
 %union {
     float num;
     char* str;
     int category;
+    struct region_list* regions;
+    uint32_t expr;
 }
 
 %define api.pure       full
 %define api.push-pull  push
 
+%parse-param {struct py2c_ctx* ctx}
+
+%code provides {
+    struct py2c_ctx* py2c_create(struct interner* names);
+    void py2c_free(struct py2c_ctx* ctx);
+    int py2c_feed(struct py2c_ctx* ctx, const char* chunk, size_t len, bool last);
+    int py2c_parse_parallel(struct py2c_ctx* ctx, const char* text, size_t len, int jobs);
+    int py2c_finish(struct py2c_ctx* ctx);
+    void py2c_write(struct py2c_ctx* ctx, FILE* stream);
+    void py2c_print_stats(struct py2c_ctx* ctx, FILE* stream);
+    int py2c_translate(struct interner* names, const char* text, size_t len, FILE* stream);
+
+    struct py2c_incremental;
+    struct py2c_incremental* py2c_incremental_create(struct interner* names);
+    void py2c_incremental_forget(struct py2c_incremental* inc);
+    void py2c_incremental_free(struct py2c_incremental* inc);
+    const char* py2c_incremental_source(struct py2c_incremental* inc, size_t* len);
+    int py2c_incremental_translate(struct py2c_incremental* inc, char* text, size_t len, FILE* stream);
+
+    void report_error(struct py2c_ctx* ctx, uint32_t offset, const char* fmt, ...);
+}
+
 %token <str>      IDENTIFIER
 %token <str>      AND BREAK DEF ELIF ELSE FOR IF NOT OR RETURN WHILE
 %token <str>      BOOLEAN
@@ -57,17 +267,42 @@ int _error = 0;
 
 %token <category> INDENT DEDENT NEWLINE
 
-%type <str>       statement_list statement assignment_statement break_statement while_statement
-%type <str>       program if_statement elif_block else_block expression
+%type <regions>   statement_list
+%type <regions>   statement assignment_statement break_statement while_statement
+%type <regions>   if_statement elif_block else_block misplaced_block
+%type <expr>      expression
 %type <str>       error
 
-%left             OR
-%left             AND
-%left             EQ NEQ
-%left             GT GTE LT LTE
+/*
+ * Statements and statement lists left on the stack by error recovery or by a
+ * translation that fails, which may hold spill files.
+ */
+%destructor { region_list_free($$); } statement statement_list
+
+/*
+ * Python's operator precedence, loosest first.  Unlike in C, `not` binds more
+ * loosely than the comparisons, and the comparisons all bind alike (and chain,
+ * see expr_compare()).  Chains of `and` or `or` give the same value grouped
+ * either way, and are grouped to the right to keep their C code short (see
+ * expr.c).  The C code for an expression is parenthesized by C's precedence,
+ * in expr.c.
+ */
+%right            OR
+%right            AND
+%right            NOT
+%left             EQ NEQ GT GTE LT LTE
 %left             PLUS MINUS
 %left             TIMES DIVIDEDBY
-%right            NOT
+
+/*
+ * The `expression expression` rule, which catches a missing operator, makes
+ * every token that can start an expression conflict with reducing the
+ * expression before it, and an elif or else block after a block conflicts
+ * with ending the statement before it.  Bison resolves all of these by
+ * shifting, which is what we want, so the count is pinned here to make any new
+ * conflict an error.
+ */
+%expect           90
 
 %start            program;
 
@@ -77,86 +312,138 @@ int _error = 0;
 %%
 
 program
-    : statement_list                                                                  { hash_insert(symbols, "program", $1); }
+    : program statement                                                               { if (add_program_statement(ctx, $2, @2)) YYABORT; }
+    | statement                                                                       { if (add_program_statement(ctx, $1, @1)) YYABORT; }
     ;
 
 statement_list
-    : statement_list statement                                                        { asprintf(&$$, "%s%s", $1, $2); }
-    | statement                                                                       { $$ = $1; }
+    : statement_list statement                                                        { if (!($$ = add_statement(ctx, $1, $2, @2))) YYABORT; }
+    | statement                                                                       { if (!($$ = add_statement(ctx, $1, NULL, @1))) YYABORT; }
     ;
 
 statement
     : assignment_statement                                                            { $$ = $1; }
     | if_statement                                                                    { $$ = $1; }
+    | misplaced_block                                                                 { $$ = $1; }
     | while_statement                                                                 { $$ = $1; }
     | break_statement                                                                 { $$ = $1; }
-    | error NEWLINE                                                                   { }
+    | error NEWLINE                                                                   { $$ = new_regions(ctx, NULL); }
     ;
 
 assignment_statement
     : IDENTIFIER ASSIGN expression NEWLINE {
-        hash_insert(symbols, $1, $3);
-        asprintf(&$$, "%s = %s;\n", $1, $3);
+        char* head;
+        record_symbol_ref(ctx, $1, @1.offset, 1);
+        HASH_OP(hash_insert(ctx->symbols, $1, NULL));
+        asprintf(&head, "%s = ", $1);
+        $$ = expr_regions(ctx, head, $3, ";\n");
     }
     | IDENTIFIER IDENTIFIER ASSIGN expression NEWLINE                                 { PARSE_ERROR("Invalid assignment statement", @1); }
     | INDENT IDENTIFIER ASSIGN expression NEWLINE                                     { PARSE_ERROR("Invalid indentation", @1); }
     ;
 
+/*
+ * Block statements are built as region lists, so the body of a block is never
+ * copied into one string and may already have been spilled to disk.
+ */
 if_statement
-    : IF expression COLON NEWLINE INDENT statement_list DEDENT                        { asprintf(&$$, "if (%s) {\n%s}\n", $2, $6); }
-    | IF expression COLON NEWLINE INDENT statement_list DEDENT elif_block else_block  { asprintf(&$$, "if (%s) {\n%s} %s %s", $2, $6, $8, $9); }
-    | IF expression COLON NEWLINE INDENT statement_list DEDENT elif_block             { asprintf(&$$, "if (%s) {\n%s} %s", $2, $6, $8); }
-    | IF expression COLON NEWLINE INDENT statement_list DEDENT else_block             { asprintf(&$$, "if (%s) {\n%s} %s", $2, $6, $8); }
+    : IF expression COLON NEWLINE INDENT statement_list DEDENT {
+        $$ = expr_regions(ctx, strdup("if ("), $2, ") {\n");
+        if (!($$ = append_regions(ctx, $$, $6, "}\n", @6))) YYABORT;
+    }
+    | IF expression COLON NEWLINE INDENT statement_list DEDENT elif_block else_block {
+        $$ = expr_regions(ctx, strdup("if ("), $2, ") {\n");
+        $$ = append_regions(ctx, $$, $6, "} ", @6);
+        $$ = append_regions(ctx, $$, $8, " ", @8);
+        if (!($$ = append_regions(ctx, $$, $9, "", @9))) YYABORT;
+    }
+    | IF expression COLON NEWLINE INDENT statement_list DEDENT elif_block {
+        $$ = expr_regions(ctx, strdup("if ("), $2, ") {\n");
+        $$ = append_regions(ctx, $$, $6, "} ", @6);
+        if (!($$ = append_regions(ctx, $$, $8, "", @8))) YYABORT;
+    }
+    | IF expression COLON NEWLINE INDENT statement_list DEDENT else_block {
+        $$ = expr_regions(ctx, strdup("if ("), $2, ") {\n");
+        $$ = append_regions(ctx, $$, $6, "} ", @6);
+        if (!($$ = append_regions(ctx, $$, $8, "", @8))) YYABORT;
+    }
     | IF expression NEWLINE                                                           { PARSE_ERROR("Missing colon after 'if' statement", @1); }
-    | elif_block                                                                      { PARSE_ERROR("Unexpected 'elif' statement", @1); }
-    | elif_block if_statement                                                         { PARSE_ERROR("Unexpected 'elif' statement", @1); }
-    | else_block                                                                      { PARSE_ERROR("Unexpected 'else' statement", @1); }
+    ;
+
+/*
+ * An elif or else block without an if before it.  One followed by an if
+ * statement is reported once.  A following elif block always continues the
+ * first one, so that case never arises.
+ */
+misplaced_block
+    : elif_block                                                                      { region_list_free($1); PARSE_ERROR("Unexpected 'elif' statement", @1); }
+    | elif_block if_statement {
+        region_list_free($1);
+        region_list_free($2);
+        PARSE_ERROR("Unexpected 'elif' statement", @1);
+    }
+    | elif_block else_block {
+        region_list_free($1);
+        region_list_free($2);
+        PARSE_ERROR("Unexpected 'else' statement", @2);
+    }
+    | else_block                                                                      { region_list_free($1); PARSE_ERROR("Unexpected 'else' statement", @1); }
     ;
 
 elif_block
-    : elif_block ELIF expression COLON NEWLINE INDENT statement_list DEDENT           { asprintf(&$$, "%s else if (%s) {\n%s}", $1, $3, $7); }
-    | ELIF expression COLON NEWLINE INDENT statement_list DEDENT                      { asprintf(&$$, "else if (%s) {\n%s}", $2, $6); }
-    | ELIF expression NEWLINE INDENT statement_list DEDENT                            { PARSE_ERROR("Missing colon after 'elif' statement", @1); }
+    : elif_block ELIF expression COLON NEWLINE INDENT statement_list DEDENT {
+        $$ = append_regions(ctx, $1, expr_regions(ctx, strdup(" else if ("), $3, ") {\n"), "", @3);
+        if (!($$ = append_regions(ctx, $$, $7, "}", @7))) YYABORT;
+    }
+    | ELIF expression COLON NEWLINE INDENT statement_list DEDENT {
+        $$ = expr_regions(ctx, strdup("else if ("), $2, ") {\n");
+        if (!($$ = append_regions(ctx, $$, $6, "}", @6))) YYABORT;
+    }
+    | ELIF expression NEWLINE INDENT statement_list DEDENT                            { region_list_free($5); PARSE_ERROR("Missing colon after 'elif' statement", @1); }
     ;
 
 else_block
-    : ELSE COLON NEWLINE INDENT statement_list DEDENT                                 { asprintf(&$$, "else {\n%s}\n", $5); }
+    : ELSE COLON NEWLINE INDENT statement_list DEDENT {
+        if (!($$ = append_regions(ctx, new_regions(ctx, strdup("else {\n")), $5, "}\n", @5))) YYABORT;
+    }
     | ELSE expression NEWLINE                                                         { PARSE_ERROR("Missing colon after 'else' statement", @1); }
     ;
 
 while_statement
-    : WHILE expression COLON NEWLINE INDENT statement_list DEDENT                     { asprintf(&$$, "while (%s) {\n%s}\n", $2, $6); }
-    | WHILE COLON NEWLINE INDENT statement_list DEDENT                                { PARSE_ERROR("Missing expression for 'while' statement", @1); }
+    : WHILE expression COLON NEWLINE INDENT statement_list DEDENT {
+        $$ = expr_regions(ctx, strdup("while ("), $2, ") {\n");
+        if (!($$ = append_regions(ctx, $$, $6, "}\n", @6))) YYABORT;
+    }
+    | WHILE COLON NEWLINE INDENT statement_list DEDENT                                { region_list_free($5); PARSE_ERROR("Missing expression for 'while' statement", @1); }
     | WHILE expression NEWLINE                                                        { PARSE_ERROR("Missing colon after 'while' statement", @1); }
     ;
 
 break_statement
-    : BREAK NEWLINE                                                                   { asprintf(&$$, "break;\n"); }
+    : BREAK NEWLINE                                                                   { $$ = new_regions(ctx, strdup("break;\n")); }
     ;
 
 expression
-    : LPAREN expression RPAREN                                                        { asprintf(&$$, "(%s)", $2); }
-    | expression PLUS expression                                                      { asprintf(&$$, "%s + %s", $1, $3); }
-    | expression MINUS expression                                                     { asprintf(&$$, "%s - %s", $1, $3); }
-    | expression TIMES expression                                                     { asprintf(&$$, "%s * %s", $1, $3); }
-    | expression DIVIDEDBY expression                                                 { asprintf(&$$, "%s / %s", $1, $3); }
-    | expression EQ expression                                                        { asprintf(&$$, "%s == %s", $1, $3); }
-    | expression NEQ expression                                                       { asprintf(&$$, "%s != %s", $1, $3); }
-    | expression GT expression                                                        { asprintf(&$$, "%s > %s", $1, $3); }
-    | expression GTE expression                                                       { asprintf(&$$, "%s >= %s", $1, $3); }
-    | expression LT expression                                                        { asprintf(&$$, "%s < %s", $1, $3);  }
-    | expression LTE expression                                                       { asprintf(&$$, "%s <= %s", $1, $3); }
-    | INTEGER                                                                         { asprintf(&$$, "%g", $1); }
-    | FLOAT                                                                           { ((int)$1 == $1) ? asprintf(&$$, "%.1f", $1) : asprintf(&$$, "%g", $1); }
-    | BOOLEAN                                                                         { $$ = strdup(strcmp($1, "True") ? "0" : "1"); }
+    : LPAREN expression RPAREN                                                        { HASH_OP($$ = expr_paren(ctx->exprs, $2)); }
+    | expression PLUS expression                                                      { if (($$ = build_binary(ctx, OP_PLUS, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression MINUS expression                                                     { if (($$ = build_binary(ctx, OP_MINUS, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression TIMES expression                                                     { if (($$ = build_binary(ctx, OP_TIMES, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression DIVIDEDBY expression                                                 { if (($$ = build_binary(ctx, OP_DIVIDEDBY, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression EQ expression                                                        { if (($$ = build_binary(ctx, OP_EQ, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression NEQ expression                                                       { if (($$ = build_binary(ctx, OP_NEQ, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression GT expression                                                        { if (($$ = build_binary(ctx, OP_GT, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression GTE expression                                                       { if (($$ = build_binary(ctx, OP_GTE, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression LT expression                                                        { if (($$ = build_binary(ctx, OP_LT, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression LTE expression                                                       { if (($$ = build_binary(ctx, OP_LTE, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression AND expression                                                       { if (($$ = build_binary(ctx, OP_AND, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | expression OR expression                                                        { if (($$ = build_binary(ctx, OP_OR, $1, $3, @2)) == EXPR_NONE) YYABORT; }
+    | NOT expression                                                                  { HASH_OP($$ = expr_unary(ctx->exprs, OP_NOT, $2)); }
+    | INTEGER                                                                         { HASH_OP($$ = number_leaf(ctx, $1, 0)); }
+    | FLOAT                                                                           { HASH_OP($$ = number_leaf(ctx, $1, 1)); }
+    | BOOLEAN                                                                         { HASH_OP($$ = expr_leaf(ctx->exprs, strcmp($1, "True") ? "0" : "1")); }
     | expression expression                                                           { }
     | IDENTIFIER {
-        if (hash_contains(symbols, $1)) {
-            $$ = strdup($1);
-        } else {
-            fprintf(stderr, "Error: Invalid Symbol (%s) on line %d\n", $1, @1.first_line);
-            _error = 1;
-        }
+        record_symbol_ref(ctx, $1, @1.offset, 0);
+        HASH_OP($$ = expr_leaf(ctx->exprs, $1));
     }
     ;
 
@@ -165,53 +452,1747 @@ expression
 /*
  * EPILOGUE
 */
-void yyerror(YYLTYPE* loc, const char* err) {
-    fprintf(stderr, "Error: %s\n", err);
+void yyerror(YYLTYPE* loc, struct py2c_ctx* ctx, const char* err) {
+    report_error(ctx, loc->offset, "Error: %s\n", err);
 }
 
-int main() {
-    symbols = hash_create();
-    pstate = yypstate_new();
+const char* const py2c_phase_names[NUM_PHASES] = { "scan", "parse", "hash", "emit" };
 
-    if(!yylex() && !_error) {
-        printf("#include <stdio.h>\n");
-        printf("int main() {\n");
+/*
+ * This function creates a new translation context.  Names are interned in
+ * `names`, which must outlive the context.
+ */
+struct py2c_ctx* py2c_create(struct interner* names) {
+    struct py2c_ctx* ctx = calloc(1, sizeof(struct py2c_ctx));
+    ctx->source = source_create("", 0);
+    ctx->status = YYPUSH_MORE;
+    ctx->pstate = yypstate_new();
+    ctx->names = names;
+    ctx->symbols = hash_create();
+    ctx->exprs = expr_table_create(names);
+    ctx->program = region_list_create(&ctx->region_memory);
+    return ctx;
+}
 
-        struct hash_iter* iter = hash_iter_create(symbols);
-        while (hash_iter_has_next(iter)) {
-          char* key;
-          char* val = (char*)hash_iter_next(iter, &key);
+/*
+ * This function frees a translation context.
+ */
+void py2c_free(struct py2c_ctx* ctx) {
+    if (ctx->status == YYPUSH_MORE) {
+        yypstate_delete(ctx->pstate);
+    }
+    for (int i = 0; i < ctx->num_diagnostics; i++) {
+        free(ctx->diagnostics[i].message);
+    }
+    free(ctx->diagnostics);
+    free(ctx->symbol_refs);
+    free(ctx->defined);
+    free(ctx->statements);
+    for (int i = 0; i < ctx->num_region_tasks; i++) {
+        free(ctx->region_tasks[i].output);
+    }
+    free(ctx->region_tasks);
+    region_list_free(ctx->program);
+    expr_table_free(ctx->exprs);
+    hash_free(ctx->symbols);
+    source_free(ctx->source);
+    free(ctx);
+}
+
+/*
+ * This function finishes a translation once all input has been fed.  It
+ * resolves symbols (and, with region tasks, generates the code left for
+ * them), writes diagnostics to stderr, and returns 0 if the program was
+ * translated successfully or 1 otherwise.
+ */
+int py2c_finish(struct py2c_ctx* ctx) {
+    if (region_tasks_enabled(ctx)) {
+        perfcount_enter(ctx->counters, PHASE_EMIT);
+        run_region_tasks(ctx);
+        perfcount_leave(ctx->counters, PHASE_EMIT);
+    } else {
+        resolve_symbols(ctx);
+    }
+    flush_diagnostics(ctx);
+    return ctx->status != 0 || ctx->error;
+}
+
+/*
+ * This function writes the code for the program's statements, in order.
+ * With region tasks, each task's code is already in a buffer of its own;
+ * otherwise the program's regions are written out.
+ */
+void write_program(struct py2c_ctx* ctx, FILE* stream) {
+    if (region_tasks_enabled(ctx)) {
+        for (int i = 0; i < ctx->num_region_tasks; i++) {
+            fwrite(ctx->region_tasks[i].output, 1, ctx->region_tasks[i].length, stream);
+        }
+    } else if (region_list_write(ctx->program, stream) != 0) {
+        fprintf(stderr, "Error: Could not read back spilled output\n");
+    }
+}
+
+/*
+ * How many variables each printf() call prints in compact output.  Printing
+ * them all in a few calls rather than one call each makes the end of main()
+ * far cheaper for gcc to compile, while staying well within the 127
+ * arguments a C compiler has to allow.
+ */
+#define PRINTF_BATCH 64
+
+/*
+ * This function writes the compact form of the C translation, which is tuned
+ * for compile time: it declares printf() itself rather than including
+ * <stdio.h>, declares all of the variables on one line, and prints them in
+ * batches.
+ */
+void write_compact(struct py2c_ctx* ctx, FILE* stream) {
+    fprintf(stream, "int printf(const char*,...);\nint main(void){");
+
+    const char* separator = "double ";
+    struct hash_iter* iter = hash_iter_create(ctx->symbols);
+    while (hash_iter_has_next(iter)) {
+        char* key;
+        hash_iter_next(iter, &key);
+        fprintf(stream, "%s%s", separator, key);
+        separator = ",";
+    }
+    hash_iter_free(iter);
+    fprintf(stream, "%s\n", *separator == ',' ? ";" : "");
+
+    write_program(ctx, stream);
+
+    char* keys[PRINTF_BATCH];
+    int num_keys = 0;
+    iter = hash_iter_create(ctx->symbols);
+    while (hash_iter_has_next(iter) || num_keys > 0) {
+        if (hash_iter_has_next(iter)) {
+            hash_iter_next(iter, &keys[num_keys++]);
+            if (num_keys < PRINTF_BATCH && hash_iter_has_next(iter)) {
+                continue;
+            }
+        }
+        fprintf(stream, "printf(\"");
+        for (int i = 0; i < num_keys; i++) {
+            fprintf(stream, "%s: %%lf\\n", keys[i]);
+        }
+        fprintf(stream, "\"");
+        for (int i = 0; i < num_keys; i++) {
+            fprintf(stream, ",%s", keys[i]);
+        }
+        fprintf(stream, ");\n");
+        num_keys = 0;
+    }
+    hash_iter_free(iter);
+
+    fprintf(stream, "}\n");
+}
+
+/*
+ * This function writes the standard form of the C translation up to where the
+ * program's code goes, declaring the variables in `symbols`.
+ */
+void write_prologue(struct hash* symbols, FILE* stream) {
+    fprintf(stream, "#include <stdio.h>\n");
+    fprintf(stream, "int main() {\n");
+
+    struct hash_iter* iter = hash_iter_create(symbols);
+    while (hash_iter_has_next(iter)) {
+      char* key;
+      hash_iter_next(iter, &key);
+
+      fprintf(stream, "double %s;\n", key);
+    }
+    hash_iter_free(iter);
+
+    fprintf(stream, "\n/* Begin Program */\n\n");
+}
+
+/*
+ * This function writes the rest of the standard form of the C translation
+ * after the program's code, printing the variables in `symbols`.
+ */
+void write_epilogue(struct hash* symbols, FILE* stream) {
+    fprintf(stream, "\n/* End Program */\n\n");
+
+    struct hash_iter* iter = hash_iter_create(symbols);
+    while (hash_iter_has_next(iter)) {
+      char* key;
+      hash_iter_next(iter, &key);
+
+      fprintf(stream, "printf(\"%s: %%lf\\n\", %s);\n", key, key);
+    }
+    hash_iter_free(iter);
+
+    fprintf(stream, "}\n");
+}
+
+/*
+ * This function writes the C translation of a successfully translated
+ * program.
+ */
+void py2c_write(struct py2c_ctx* ctx, FILE* stream) {
+    perfcount_enter(ctx->counters, PHASE_EMIT);
+    if (ctx->compact) {
+        write_compact(ctx, stream);
+    } else {
+        write_prologue(ctx->symbols, stream);
+        write_program(ctx, stream);
+        write_epilogue(ctx->symbols, stream);
+    }
+    perfcount_leave(ctx->counters, PHASE_EMIT);
+}
+
+/*
+ * Helper function to buffer a diagnostic message with sequence number `seq`
+ * for the given source offset.
+ */
+void _add_diagnostic(struct py2c_ctx* ctx, int seq, uint32_t offset, const char* fmt, va_list args) {
+    if (ctx->num_diagnostics == ctx->diagnostics_capacity) {
+        ctx->diagnostics_capacity = ctx->diagnostics_capacity ? 2 * ctx->diagnostics_capacity : 16;
+        ctx->diagnostics = realloc(ctx->diagnostics, ctx->diagnostics_capacity * sizeof(struct diagnostic));
+    }
+
+    struct diagnostic* d = &ctx->diagnostics[ctx->num_diagnostics++];
+    vasprintf(&d->message, fmt, args);
+    d->line = source_line(ctx->source, offset);
+    d->seq = seq;
+    TRACE2(parse_error, d->line, d->message);
+    ctx->error = 1;
+}
+
+/*
+ * This function buffers a diagnostic message for the given source offset.
+ * The message is written to stderr by flush_diagnostics().
+ */
+void report_error(struct py2c_ctx* ctx, uint32_t offset, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    _add_diagnostic(ctx, ctx->next_seq++, offset, fmt, args);
+    va_end(args);
+}
+
+/*
+ * Helper function to buffer the diagnostic for a read of an undefined symbol,
+ * in the place in the order that its reference reserved.
+ */
+void _report_symbol_error(struct py2c_ctx* ctx, struct symbol_ref* ref, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    _add_diagnostic(ctx, ref->seq, ref->offset, fmt, args);
+    va_end(args);
+}
+
+/*
+ * Comparison function used to order diagnostics by sequence number.
+ */
+int _diagnostic_cmp(const void* a, const void* b) {
+    const struct diagnostic* da = a;
+    const struct diagnostic* db = b;
+    return da->seq - db->seq;
+}
+
+/*
+ * This function writes all buffered diagnostics to stderr in the order they
+ * would have been reported in during the parse.
+ */
+void flush_diagnostics(struct py2c_ctx* ctx) {
+    qsort(ctx->diagnostics, ctx->num_diagnostics, sizeof(struct diagnostic), _diagnostic_cmp);
+    for (int i = 0; i < ctx->num_diagnostics; i++) {
+        fputs(ctx->diagnostics[i].message, stderr);
+        free(ctx->diagnostics[i].message);
+    }
+    free(ctx->diagnostics);
+    ctx->diagnostics = NULL;
+    ctx->num_diagnostics = ctx->diagnostics_capacity = 0;
+}
+
+/*
+ * This function creates a region list for a statement, holding `text` if it
+ * isn't NULL.  The list's memory is counted in the context's total.
+ */
+struct region_list* new_regions(struct py2c_ctx* ctx, char* text) {
+    struct region_list* list = region_list_create(&ctx->region_memory);
+    region_list_append(list, text);
+    return list;
+}
+
+/*
+ * This function creates a region list for the C code `head`, then `expr`,
+ * then `tail`, taking ownership of `head`.  With region tasks, the
+ * expression's code is left for a task to write (see run_region_tasks()), so
+ * writing it out is taken off the parse; otherwise it's written now.
+ */
+struct region_list* expr_regions(struct py2c_ctx* ctx, char* head, expr_id expr, const char* tail) {
+    struct region_list* list = region_list_create(&ctx->region_memory);
+    if (region_tasks_enabled(ctx)) {
+        region_list_append(list, head);
+        region_list_append_deferred(list, expr, expr_length(ctx->exprs, expr));
+        region_list_append(list, strdup(tail));
+        return list;
+    }
+
+    size_t head_len = strlen(head), expr_len = expr_length(ctx->exprs, expr), tail_len = strlen(tail);
+    char* text = malloc(head_len + expr_len + tail_len + 1);
+    memcpy(text, head, head_len);
+    expr_write(ctx->exprs, expr, text + head_len);
+    memcpy(text + head_len + expr_len, tail, tail_len + 1);
+    region_list_append(list, text);
+    free(head);
+    return list;
+}
+
+/*
+ * This function moves the regions of `src` to the end of `dst` and frees
+ * `src`, then appends a copy of `tail` unless it's empty.  Returns `dst`, or
+ * NULL if the regions couldn't be moved (a spilled list may need to be copied)
+ * or `dst` is NULL, in which case both lists are freed.  Calls can be chained,
+ * so only the first failure is reported.
+ */
+struct region_list* append_regions(struct py2c_ctx* ctx, struct region_list* dst, struct region_list* src,
+        const char* tail, YYLTYPE loc) {
+    if (dst && region_list_concat(dst, src) != 0) {
+        report_error(ctx, loc.offset, "Error: Could not spill output to a temporary file on line %d\n",
+            source_line(ctx->source, loc.offset));
+        region_list_free(dst);
+        dst = NULL;
+    }
+    region_list_free(src);
+    if (dst && *tail) {
+        region_list_append(dst, strdup(tail));
+    }
+    return dst;
+}
+
+/*
+ * This function checks the translation's memory use against the budget, if
+ * one is set.  The working set is the source and the data built from it,
+ * including the interned names and symbols, and everything else is generated
+ * code: the program's completed output and every statement list still on the
+ * parser stack.  If the two together are over the budget, the output of the
+ * program and of `list`, the statement list being built, is spilled to disk.
+ * Lists further down the stack are spilled once the blocks they're part of
+ * are complete, because a list holding spilled regions spills everything
+ * added to it.  If the working set alone is over the budget, the translation
+ * fails.  Returns 0 if the translation can continue or -1 if it can't.
+ */
+int check_memory(struct py2c_ctx* ctx, struct region_list* list, YYLTYPE loc) {
+    if (ctx->max_memory == 0) {
+        return 0;
+    }
+
+    size_t working = source_length(ctx->source) + expr_table_bytes(ctx->exprs)
+        + intern_memory(ctx->names) + hash_memory(ctx->symbols)
+        + ctx->symbol_refs_capacity * sizeof(struct symbol_ref)
+        + ctx->diagnostics_capacity * sizeof(struct diagnostic);
+    if (working > ctx->max_memory) {
+        report_error(ctx, loc.offset, "Error: Translation needs more than %zu bytes of memory on line %d\n",
+            ctx->max_memory, source_line(ctx->source, loc.offset));
+        return -1;
+    }
+
+    size_t output = region_list_memory(ctx->program) + (list ? region_list_memory(list) : 0);
+    if (working + ctx->region_memory > ctx->max_memory && output > 0) {
+        if ((region_list_memory(ctx->program) > 0 && region_list_spill(ctx->program) != 0)
+                || (list && region_list_memory(list) > 0 && region_list_spill(list) != 0)) {
+            report_error(ctx, loc.offset, "Error: Could not spill output to a temporary file on line %d\n",
+                source_line(ctx->source, loc.offset));
+            return -1;
+        }
+        if (REMARKS_ENABLED(ctx->remarks, "spill")) {
+            remarks_emit(ctx->remarks, "spill", REMARK_APPLIED, "SpilledOutput", ctx->path,
+                source_line(ctx->source, loc.offset), source_column(ctx->source, loc.offset),
+                "spilled %zu bytes of generated code to disk to stay within the %zu byte memory budget",
+                output, ctx->max_memory);
+        }
+    }
+    return 0;
+}
+
+/*
+ * This function adds a statement to the end of a statement list and checks the
+ * memory budget.  `statement` is NULL for the first statement of a list, which
+ * becomes the list itself.  Returns the list, or NULL (having freed both) if
+ * the translation can't continue.
+ */
+struct region_list* add_statement(struct py2c_ctx* ctx, struct region_list* list, struct region_list* statement,
+        YYLTYPE loc) {
+    if (statement) {
+        list = append_regions(ctx, list, statement, "", loc);
+    }
+    if (list && check_memory(ctx, list, loc) != 0) {
+        region_list_free(list);
+        list = NULL;
+    }
+    return list;
+}
+
+/*
+ * Returns 1 if the program's code is written out and its symbol references
+ * are checked by region tasks after the parse (see run_region_tasks()) or 0
+ * if that's done during the parse.  Region tasks need all of the program's
+ * regions and references kept in memory, so a memory budget rules them out.
+ */
+int region_tasks_enabled(struct py2c_ctx* ctx) {
+    return ctx->jobs > 1 && ctx->max_memory == 0;
+}
+
+/*
+ * This function records that a top-level statement ends after the program's
+ * current regions and symbol references.
+ */
+void end_statement(struct py2c_ctx* ctx) {
+    if (ctx->num_statements == ctx->statements_capacity) {
+        ctx->statements_capacity = ctx->statements_capacity ? 2 * ctx->statements_capacity : 64;
+        ctx->statements = realloc(ctx->statements, ctx->statements_capacity * sizeof(struct statement_end));
+    }
+    ctx->statements[ctx->num_statements].regions = region_list_size(ctx->program);
+    ctx->statements[ctx->num_statements].refs = ctx->num_symbol_refs;
+    ctx->num_statements++;
+}
+
+/*
+ * This function adds a completed top-level statement to the program and
+ * resolves the symbol references made in it, then checks the memory budget.
+ * A chunk of a parallel parse, whose references are resolved after the
+ * merge, and a context using region tasks record where the statement ends
+ * instead.  Returns 0 if the translation can continue or -1 if it can't.
+ */
+int add_program_statement(struct py2c_ctx* ctx, struct region_list* statement, YYLTYPE loc) {
+    int status = region_list_concat(ctx->program, statement);
+    region_list_free(statement);
+    if (status != 0) {
+        report_error(ctx, loc.offset, "Error: Could not spill output to a temporary file on line %d\n",
+            source_line(ctx->source, loc.offset));
+        return -1;
+    }
+    if (ctx->chunk || region_tasks_enabled(ctx)) {
+        end_statement(ctx);
+    } else {
+        resolve_symbols(ctx);
+    }
+    return check_memory(ctx, NULL, loc);
+}
+
+/*
+ * This function records a reference to a symbol.  `is_def` is 1 if the
+ * reference assigns to the symbol and 0 if it reads it.
+ */
+void record_symbol_ref(struct py2c_ctx* ctx, char* name, uint32_t offset, int is_def) {
+    if (ctx->num_symbol_refs == ctx->symbol_refs_capacity) {
+        ctx->symbol_refs_capacity = ctx->symbol_refs_capacity ? 2 * ctx->symbol_refs_capacity : 64;
+        ctx->symbol_refs = realloc(ctx->symbol_refs, ctx->symbol_refs_capacity * sizeof(struct symbol_ref));
+    }
+
+    struct symbol_ref* ref = &ctx->symbol_refs[ctx->num_symbol_refs++];
+    ref->name = name;
+    ref->offset = offset;
+    ref->is_def = is_def;
+    ref->seq = is_def ? -1 : ctx->next_seq++;
+}
+
+/*
+ * Helper function to make room in ctx->defined for every name interned so
+ * far.
+ */
+void _size_defined(struct py2c_ctx* ctx) {
+    size_t count = intern_count(ctx->names) + 1;
+    if (count > ctx->defined_size) {
+        ctx->defined = realloc(ctx->defined, count);
+        memset(ctx->defined + ctx->defined_size, 0, count - ctx->defined_size);
+        ctx->defined_size = count;
+    }
+}
+
+/*
+ * This function walks the symbol references recorded since it last ran, in
+ * source order, and reports every read of a symbol that hasn't been assigned
+ * to yet.  The references are then discarded.
+ */
+void resolve_symbols(struct py2c_ctx* ctx) {
+    _size_defined(ctx);
+    for (int i = 0; i < ctx->num_symbol_refs; i++) {
+        struct symbol_ref* ref = &ctx->symbol_refs[i];
+        unsigned int id = intern_id(ref->name);
+        if (ref->is_def) {
+            ctx->defined[id] = 1;
+        } else if (!ctx->defined[id]) {
+            _report_symbol_error(ctx, ref, "Error: Invalid Symbol (%s) on line %d\n", ref->name,
+                source_line(ctx->source, ref->offset));
+        }
+    }
+
+    ctx->num_symbol_refs = 0;
+}
+
+/*
+ * The least generated code a region task is given, so that tasks are coarse
+ * enough for scheduling them to cost nothing noticeable.
+ */
+#define REGION_TASK_BYTES 16384
+
+/*
+ * The state shared by the region tasks of a translation.  `render` is set if
+ * the code is needed.  `stamps` holds an array for each worker thread, giving
+ * for each interned name the number (plus 1) of the last task on that thread
+ * to assign it.
+ */
+struct region_tasks {
+    struct py2c_ctx* ctx;
+    int render;
+    unsigned int num_names;
+    unsigned int** stamps;
+};
+
+/*
+ * Helper function to write the code for an expression left in a deferred
+ * region by expr_regions().
+ */
+void _fill_expr(void* arg, uint32_t key, char* out) {
+    expr_write(arg, key, out);
+}
+
+/*
+ * Helper function run for each region task.  It writes the code for the
+ * task's statements into a buffer of its own, then walks their symbol
+ * references, keeping the reads of names the statements haven't assigned
+ * themselves by then, which depend on the statements before the task, and
+ * the names they assign, which the statements after it depend on.
+ */
+void _run_region_task(void* arg, int index, int worker) {
+    struct region_tasks* tasks = arg;
+    struct py2c_ctx* ctx = tasks->ctx;
+    struct region_task* task = &ctx->region_tasks[index];
+    struct statement_end* start = task->first ? &ctx->statements[task->first - 1] : NULL;
+    struct statement_end* end = &ctx->statements[task->last - 1];
+    int first_region = start ? start->regions : 0;
+    int first_ref = start ? start->refs : 0;
+
+    if (tasks->render) {
+        task->length = region_list_span_length(ctx->program, first_region, end->regions);
+        task->output = malloc(task->length);
+        region_list_render(ctx->program, first_region, end->regions, task->output, _fill_expr, ctx->exprs);
+    }
 
-          if (strcmp(key, "program") == 0) {
+    if (!tasks->stamps[worker]) {
+        tasks->stamps[worker] = calloc(tasks->num_names, sizeof(unsigned int));
+    }
+    unsigned int* stamps = tasks->stamps[worker];
+    task->open_reads = malloc((end->refs - first_ref) * sizeof(int));
+    task->defs = malloc((end->refs - first_ref) * sizeof(unsigned int));
+    for (int i = first_ref; i < end->refs; i++) {
+        struct symbol_ref* ref = &ctx->symbol_refs[i];
+        unsigned int id = intern_id(ref->name);
+        if (stamps[id] == (unsigned int)index + 1) {
             continue;
-          }
+        }
+        if (ref->is_def) {
+            stamps[id] = index + 1;
+            task->defs[task->num_defs++] = id;
+        } else {
+            task->open_reads[task->num_open_reads++] = i;
+        }
+    }
+}
+
+/*
+ * This function does the per-statement work of a translation that's been
+ * left until the parse is done: writing out the code for the expressions in
+ * deferred regions (see expr_regions()), copying each statement's code into
+ * the output, and checking its symbol references.  The top-level statements
+ * are split into runs with at least REGION_TASK_BYTES of code between them,
+ * and each run is a task for a work-stealing scheduler (see sched.h) on
+ * ctx->jobs threads.  The expression table and the program's regions don't
+ * change once the parse is done, so tasks can read them without locking.
+ *
+ * Each task writes its code into a buffer of its own, which py2c_write()
+ * writes out in order, so the output is the same however the tasks were
+ * scheduled.  A task can only check the reads of names its own statements
+ * assigned earlier, so it leaves the rest, along with the names it assigns,
+ * to a sequential pass over the tasks in order, which reports the reads of
+ * names no earlier statement assigned.  Diagnostics are ordered by the
+ * sequence numbers their references reserved, so they come out as they
+ * would from resolve_symbols().
+ */
+void run_region_tasks(struct py2c_ctx* ctx) {
+    /*
+     * References made after the last complete statement, by a parse that
+     * stopped partway through one, are checked as one more statement.
+     */
+    if (ctx->num_statements == 0
+            || ctx->statements[ctx->num_statements - 1].refs != ctx->num_symbol_refs
+            || ctx->statements[ctx->num_statements - 1].regions != region_list_size(ctx->program)) {
+        end_statement(ctx);
+    }
+
+    ctx->region_tasks = calloc(ctx->num_statements, sizeof(struct region_task));
+    int first = 0, regions = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < ctx->num_statements; i++) {
+        bytes += region_list_span_length(ctx->program, regions, ctx->statements[i].regions);
+        regions = ctx->statements[i].regions;
+        if (bytes >= REGION_TASK_BYTES || i == ctx->num_statements - 1) {
+            ctx->region_tasks[ctx->num_region_tasks].first = first;
+            ctx->region_tasks[ctx->num_region_tasks].last = i + 1;
+            ctx->num_region_tasks++;
+            first = i + 1;
+            bytes = 0;
+        }
+    }
+
+    struct region_tasks tasks = { ctx, ctx->status == 0 && !ctx->error, intern_count(ctx->names),
+        calloc(ctx->jobs, sizeof(unsigned int*)) };
+    sched_run(ctx->jobs, ctx->num_region_tasks, _run_region_task, &tasks);
+
+    _size_defined(ctx);
+    for (int i = 0; i < ctx->num_region_tasks; i++) {
+        struct region_task* task = &ctx->region_tasks[i];
+        for (int j = 0; j < task->num_open_reads; j++) {
+            struct symbol_ref* ref = &ctx->symbol_refs[task->open_reads[j]];
+            if (!ctx->defined[intern_id(ref->name)]) {
+                _report_symbol_error(ctx, ref, "Error: Invalid Symbol (%s) on line %d\n", ref->name,
+                    source_line(ctx->source, ref->offset));
+            }
+        }
+        for (int j = 0; j < task->num_defs; j++) {
+            ctx->defined[task->defs[j]] = 1;
+        }
+        free(task->open_reads);
+        free(task->defs);
+    }
+
+    for (int i = 0; i < ctx->jobs; i++) {
+        free(tasks.stamps[i]);
+    }
+    free(tasks.stamps);
+    ctx->num_symbol_refs = 0;
+    ctx->num_statements = 0;
+}
+
+/*
+ * This function returns the leaf expression for a numeric literal.  Floats
+ * with integral values keep a decimal point so they remain floats in C.
+ */
+expr_id number_leaf(struct py2c_ctx* ctx, float value, int is_float) {
+    char text[64];
+    if (is_float && (int)value == value) {
+        snprintf(text, sizeof(text), "%.1f", value);
+    } else {
+        snprintf(text, sizeof(text), "%g", value);
+    }
+    return expr_leaf(ctx->exprs, text);
+}
+
+/*
+ * This function returns the node for a binary operation, sharing it with an
+ * identical expression built earlier if there is one, or EXPR_NONE (after
+ * reporting an error) if its C code would be too long.  Comparisons may
+ * chain.  `loc` is the location of the operator.  Sharing is reported to the
+ * hash-cons remarks: a reused node as applied, and a new node that's
+ * equivalent to an existing one with its operands swapped as missed.
+ */
+expr_id build_binary(struct py2c_ctx* ctx, enum expr_op op, expr_id left, expr_id right, YYLTYPE loc) {
+    size_t before = expr_table_size(ctx->exprs);
+    expr_id id;
+    if (op >= OP_EQ && op <= OP_LTE) {
+        HASH_OP(id = expr_compare(ctx->exprs, op, left, right));
+    } else {
+        HASH_OP(id = expr_binary(ctx->exprs, op, left, right));
+    }
+    if (id == EXPR_NONE) {
+        report_error(ctx, loc.offset, "Error: Expression is too long to translate on line %d\n",
+            source_line(ctx->source, loc.offset));
+        return EXPR_NONE;
+    }
+    if (!REMARKS_ENABLED(ctx->remarks, "hash-cons")) {
+        return id;
+    }
+
+    /*
+     * The operator that gives the same result with the operands swapped.  A
+     * comparison that continued a chain isn't a single comparison, so it has
+     * no swapped form.
+     */
+    static const int swapped[] = {
+        [OP_PLUS] = OP_PLUS, [OP_MINUS] = -1, [OP_TIMES] = OP_TIMES, [OP_DIVIDEDBY] = -1,
+        [OP_EQ] = OP_EQ, [OP_NEQ] = OP_NEQ, [OP_GT] = OP_LT, [OP_GTE] = OP_LTE,
+        [OP_LT] = OP_GT, [OP_LTE] = OP_GTE, [OP_AND] = -1, [OP_OR] = -1
+    };
+    int chained = expr_find_binary(ctx->exprs, op, left, right) != id;
+
+    int line = source_line(ctx->source, loc.offset);
+    int column = source_column(ctx->source, loc.offset);
+    char* text = expr_to_string(ctx->exprs, id);
+    expr_id other = id >= before && swapped[op] >= 0 && !chained
+        ? expr_find_binary(ctx->exprs, swapped[op], right, left) : EXPR_NONE;
+    if (id < before) {
+        remarks_emit(ctx->remarks, "hash-cons", REMARK_APPLIED, "HashConsReused", ctx->path, line, column,
+            "reused the existing node for `%s`", text);
+    } else if (other != EXPR_NONE) {
+        char* other_text = expr_to_string(ctx->exprs, other);
+        remarks_emit(ctx->remarks, "hash-cons", REMARK_MISSED, "HashConsOperandOrder", ctx->path, line, column,
+            "`%s` not shared with the equivalent `%s` because operands aren't put in a canonical order",
+            text, other_text);
+        free(other_text);
+    }
+    free(text);
+    return id;
+}
+
+/*
+ * This function prints statistics about a translation.
+ */
+void py2c_print_stats(struct py2c_ctx* ctx, FILE* stream) {
+    size_t requested = expr_table_requests(ctx->exprs);
+    size_t unique = expr_table_size(ctx->exprs);
+    size_t bytes = expr_table_bytes(ctx->exprs);
+    fprintf(stream, "Expression nodes: %zu built, %zu after sharing (%.1f%% shared)\n",
+        requested, unique, requested ? 100.0 * (requested - unique) / requested : 0.0);
+    fprintf(stream, "Expression memory: %zu bytes (%.1f bytes per source line)\n",
+        bytes, (double)bytes / source_line_count(ctx->source));
+    fprintf(stream, "Symbol table: %u variables, longest bucket chain %u\n",
+        hash_size(ctx->symbols), hash_max_chain(ctx->symbols));
+}
+
+/*
+ * This function translates a whole program held in memory, writing the C
+ * translation to `stream` if it succeeds.  Returns 0 on success or 1 if
+ * there were errors, which are written to stderr.
+ */
+int py2c_translate(struct interner* names, const char* text, size_t len, FILE* stream) {
+    struct py2c_ctx* ctx = py2c_create(names);
+    py2c_feed(ctx, text, len, true);
+    int status = py2c_finish(ctx);
+    if (!status) {
+        py2c_write(ctx, stream);
+    }
+    py2c_free(ctx);
+    return status;
+}
+
+/*
+ * The smallest input py2c_parse_parallel() splits up, and how many chunks per
+ * thread it splits an input into, so a thread that gets through its share
+ * early takes chunks that would otherwise wait for a slower thread.
+ */
+#define PARALLEL_MIN_BYTES 65536
+#define CHUNKS_PER_JOB 4
+
+/*
+ * One chunk of a parallel parse: the input from `start` up to `end`, parsed in
+ * a context of its own.  Every chunk's context shares the whole parse's
+ * interner, so names have the same IDs in all of them.
+ */
+struct parse_chunk {
+    size_t start;
+    size_t end;
+    struct py2c_ctx* ctx;
+};
+
+/*
+ * The state shared by the threads of a parallel parse.
+ */
+struct parallel_parse {
+    struct interner* names;
+    const char* text;
+    struct parse_chunk* chunks;
+};
 
-          printf("double %s;\n", key);
+/*
+ * Helper function returning 1 if the line starting at `line` starts a
+ * top-level statement, so the input can be cut in front of it, or 0 if not.
+ * Indented lines, blank lines and comments don't, and neither do `elif` and
+ * `else` lines, which continue the `if` statement before them.
+ */
+int _is_chunk_start(const char* line, const char* end) {
+    if (line == end || strchr(" \t\r\n#", *line)) {
+        return 0;
+    }
+
+    static const char* const continuations[] = { "elif", "else" };
+    size_t rest = end - line;
+    for (int i = 0; i < 2; i++) {
+        size_t l = strlen(continuations[i]);
+        if (rest >= l && strncmp(line, continuations[i], l) == 0
+                && (rest == l || !(isalnum(line[l]) || line[l] == '_'))) {
+            return 0;
         }
+    }
+    return 1;
+}
 
-        printf("\n/* Begin Program */\n\n");
-        printf("%s", (char*)hash_get(symbols, "program"));
+/*
+ * Helper function run as the task for each chunk of a parallel parse.
+ */
+void _parse_chunk(void* arg, int task, int worker) {
+    struct parallel_parse* parse = arg;
+    struct parse_chunk* chunk = &parse->chunks[task];
+    chunk->ctx = py2c_create(parse->names);
+    chunk->ctx->chunk = 1;
+    py2c_feed(chunk->ctx, parse->text + chunk->start, chunk->end - chunk->start, true);
+}
 
-        printf("\n/* End Program */\n\n");
+/*
+ * This function feeds a whole program to a new context, like a single call to
+ * py2c_feed() with `last` set, but parses it on up to `jobs` threads.
+ *
+ * The input is cut into chunks in front of top-level statements, which always
+ * start at column 0 with the indentation stack empty and the parser between
+ * statements, so each chunk parses on its own exactly as it would as part of
+ * the whole.  Each chunk is parsed into a context of its own, and the chunks'
+ * generated code, variables, symbol references and statements are merged in
+ * order into `ctx`, and py2c_finish() checks the references against the whole
+ * program (with region tasks, if ctx->jobs is set).  If any chunk has a syntax error, the input is
+ * parsed again sequentially instead, since error recovery can carry on past
+ * the end of a chunk; the output and diagnostics are always the same as a
+ * sequential parse's.
+ *
+ * Small inputs, and contexts with counters or remarks (which aren't shared
+ * between threads) or a memory budget, are parsed sequentially.  Returns the
+ * parser's final status.
+ */
+int py2c_parse_parallel(struct py2c_ctx* ctx, const char* text, size_t len, int jobs) {
+    if (jobs < 2 || len < PARALLEL_MIN_BYTES || ctx->counters || ctx->remarks || ctx->max_memory
+            || ctx->status != YYPUSH_MORE || source_length(ctx->source) > 0) {
+        return py2c_feed(ctx, text, len, true);
+    }
+
+    /*
+     * Cut the input in front of the first top-level statement at or after
+     * each multiple of the chunk size.
+     */
+    int max_chunks = jobs * CHUNKS_PER_JOB;
+    size_t target = len / max_chunks + 1;
+    struct parse_chunk* chunks = calloc(max_chunks, sizeof(struct parse_chunk));
+    int num_chunks = 0;
+    for (size_t start = 0; start < len; num_chunks++) {
+        size_t end = start + target;
+        while (end < len && (text[end - 1] != '\n' || !_is_chunk_start(text + end, text + len))) {
+            const char* newline = memchr(text + end, '\n', len - end);
+            end = newline ? (size_t)(newline - text) + 1 : len;
+        }
+        chunks[num_chunks].start = start;
+        chunks[num_chunks].end = end < len ? end : len;
+        start = chunks[num_chunks].end;
+    }
 
-        iter = hash_iter_create(symbols);
+    if (num_chunks == 1) {
+        free(chunks);
+        return py2c_feed(ctx, text, len, true);
+    }
+
+    struct parallel_parse parse = { ctx->names, text, chunks };
+    sched_run(jobs, num_chunks, _parse_chunk, &parse);
+
+    int failed = 0;
+    for (int i = 0; i < num_chunks; i++) {
+        failed |= chunks[i].ctx->status != 0 || chunks[i].ctx->error;
+    }
+
+    if (!failed) {
+        yypstate_delete(ctx->pstate);
+        ctx->status = 0;
+        ctx->final = 1;
+        source_append(ctx->source, text, len);
+        ctx->scanned = len;
+    }
+
+    for (int i = 0; i < num_chunks && !failed; i++) {
+        struct parse_chunk* chunk = &chunks[i];
+        struct py2c_ctx* chunk_ctx = chunk->ctx;
+
+        /*
+         * Take over the chunk's references and statements as if they had
+         * been parsed in `ctx`, for its region tasks to check.
+         */
+        int first_region = region_list_size(ctx->program);
+        int first_ref = ctx->num_symbol_refs;
+        for (int j = 0; j < chunk_ctx->num_symbol_refs; j++) {
+            struct symbol_ref* ref = &chunk_ctx->symbol_refs[j];
+            record_symbol_ref(ctx, ref->name, chunk->start + ref->offset, ref->is_def);
+        }
+        for (int j = 0; j < chunk_ctx->num_statements; j++) {
+            end_statement(ctx);
+            ctx->statements[ctx->num_statements - 1].regions = first_region + chunk_ctx->statements[j].regions;
+            ctx->statements[ctx->num_statements - 1].refs = first_ref + chunk_ctx->statements[j].refs;
+        }
+
+        struct hash_iter* iter = hash_iter_create(chunk_ctx->symbols);
         while (hash_iter_has_next(iter)) {
-          char* key;
-          char* val = (char*)hash_iter_next(iter, &key);
+            char* key;
+            hash_iter_next(iter, &key);
+            hash_insert(ctx->symbols, key, NULL);
+        }
+        hash_iter_free(iter);
+
+        region_list_concat(ctx->program, chunk_ctx->program);
+    }
+
+    for (int i = 0; i < num_chunks; i++) {
+        py2c_free(chunks[i].ctx);
+    }
+    free(chunks);
+
+    return failed ? py2c_feed(ctx, text, len, true) : ctx->status;
+}
+
+/*
+ * An incremental translation keeps the translation of each top-level
+ * statement of the last version of a program it translated, so that a new
+ * version only has the statements that changed parsed again.  A statement's
+ * code doesn't depend on the statements around it, and neither do the names
+ * it reads before assigning them or the names it assigns, which are all
+ * that's needed to declare the program's variables and check its symbols.
+ * The input is split into statements in front of top-level statements, as
+ * py2c_parse_parallel() splits it into chunks, except that the first
+ * statement also takes any blank lines and comments before it.
+ *
+ * Each kept statement's source runs from the end of the statement before it
+ * (or the start of the input) up to `source_end`, its code likewise up to
+ * `code_end` in the translation's code, and its names up to `names_end` in the
+ * translation's names: first the `num_reads` names it reads before assigning
+ * them, then the names it assigns, in the order it first assigns them.
+ */
+struct kept_statement {
+    size_t source_end;
+    size_t code_end;
+    int names_end;
+    int num_reads;
+};
+
+/*
+ * The state of an incremental translation.  `statements` is empty unless it
+ * holds the translation of `text`, the last version translated.  `marks` holds
+ * for each interned name the number of the last pass over names to mark it
+ * (see _next_mark()).
+ */
+struct py2c_incremental {
+    struct interner* names;
+    char* text;
+    size_t len;
+    struct kept_statement* statements;
+    int num_statements;
+    char* code;
+    const char** kept_names;
+    unsigned int* marks;
+    size_t marks_size;
+    unsigned int mark;
+};
+
+/*
+ * How many bytes at a time the common prefix and suffix of two versions of a
+ * program are compared in, before narrowing down to the byte.
+ */
+#define COMPARE_BLOCK 4096
+
+/*
+ * This function creates a new incremental translation, with no version of a
+ * program translated yet.  Names are interned in `names`, which must outlive
+ * it.
+ */
+struct py2c_incremental* py2c_incremental_create(struct interner* names) {
+    struct py2c_incremental* inc = calloc(1, sizeof(struct py2c_incremental));
+    inc->names = names;
+    return inc;
+}
 
-          if (strcmp(key, "program") == 0) {
+/*
+ * This function forgets the statements an incremental translation has kept,
+ * so the next version is translated from scratch.  It must be called when the
+ * interner is reset, since the kept statements hold interned names.
+ */
+void py2c_incremental_forget(struct py2c_incremental* inc) {
+    free(inc->statements);
+    free(inc->code);
+    free(inc->kept_names);
+    inc->statements = NULL;
+    inc->code = NULL;
+    inc->kept_names = NULL;
+    inc->num_statements = 0;
+}
+
+/*
+ * This function frees an incremental translation.
+ */
+void py2c_incremental_free(struct py2c_incremental* inc) {
+    py2c_incremental_forget(inc);
+    free(inc->text);
+    free(inc->marks);
+    free(inc);
+}
+
+/*
+ * This function returns the version of the program last passed to
+ * py2c_incremental_translate() (NULL if none has been), setting `*len` to its
+ * length.
+ */
+const char* py2c_incremental_source(struct py2c_incremental* inc, size_t* len) {
+    *len = inc->len;
+    return inc->text;
+}
+
+/*
+ * Helper function to start a new pass over names, making room in inc->marks
+ * for every name interned so far.  Returns the pass's number, which no name
+ * is marked with yet.
+ */
+unsigned int _next_mark(struct py2c_incremental* inc) {
+    size_t count = intern_count(inc->names) + 1;
+    if (count > inc->marks_size) {
+        inc->marks = realloc(inc->marks, count * sizeof(unsigned int));
+        memset(inc->marks + inc->marks_size, 0, (count - inc->marks_size) * sizeof(unsigned int));
+        inc->marks_size = count;
+    }
+    if (inc->mark == UINT_MAX) {
+        memset(inc->marks, 0, inc->marks_size * sizeof(unsigned int));
+        inc->mark = 0;
+    }
+    return ++inc->mark;
+}
+
+/*
+ * Helper function returning 1 if a statement of an incremental translation
+ * can start (or, at the end of the input, end) at `offset` in `text`, given
+ * that one starts before it, or 0 if not.
+ */
+int _is_statement_boundary(const char* text, size_t len, size_t offset) {
+    return offset == 0 || offset == len
+        || (text[offset - 1] == '\n' && _is_chunk_start(text + offset, text + len));
+}
+
+/*
+ * Helper function returning the length of the longest common prefix of the
+ * first `len` bytes of `a` and `b`.
+ */
+size_t _common_prefix(const char* a, const char* b, size_t len) {
+    size_t i = 0;
+    while (i + COMPARE_BLOCK <= len && memcmp(a + i, b + i, COMPARE_BLOCK) == 0) {
+        i += COMPARE_BLOCK;
+    }
+    while (i < len && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Helper function returning the length, up to `max`, of the longest common
+ * suffix of `a` and `b`.
+ */
+size_t _common_suffix(const char* a, size_t a_len, const char* b, size_t b_len, size_t max) {
+    size_t i = 0;
+    while (i + COMPARE_BLOCK <= max
+            && memcmp(a + a_len - i - COMPARE_BLOCK, b + b_len - i - COMPARE_BLOCK, COMPARE_BLOCK) == 0) {
+        i += COMPARE_BLOCK;
+    }
+    while (i < max && a[a_len - i - 1] == b[b_len - i - 1]) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Helper function to add the names statement `index` of a parsed chunk reads
+ * before assigning them, then the names it assigns, to `names`, returning how
+ * many of them are reads.
+ */
+int _keep_names(struct py2c_incremental* inc, struct py2c_ctx* ctx, int index, const char** names,
+        int* num_names) {
+    int first_ref = index ? ctx->statements[index - 1].refs : 0;
+    int last_ref = ctx->statements[index].refs;
+    int num_reads = 0;
+
+    unsigned int mark = _next_mark(inc);
+    for (int i = first_ref; i < last_ref; i++) {
+        struct symbol_ref* ref = &ctx->symbol_refs[i];
+        unsigned int id = intern_id(ref->name);
+        if (inc->marks[id] == mark) {
             continue;
-          }
+        }
+        if (ref->is_def) {
+            inc->marks[id] = mark;
+        } else {
+            names[(*num_names)++] = ref->name;
+            num_reads++;
+        }
+    }
+
+    mark = _next_mark(inc);
+    for (int i = first_ref; i < last_ref; i++) {
+        struct symbol_ref* ref = &ctx->symbol_refs[i];
+        unsigned int id = intern_id(ref->name);
+        if (ref->is_def && inc->marks[id] != mark) {
+            inc->marks[id] = mark;
+            names[(*num_names)++] = ref->name;
+        }
+    }
+    return num_reads;
+}
+
+/*
+ * This function translates a new version of a program, taking ownership of
+ * `text`, which must have been allocated with malloc().  It works like
+ * py2c_translate(), and gives the same output and diagnostics, but only parses
+ * the statements from the first one that differs from the last version up to
+ * the last one that does, keeping the translations of the statements around
+ * them, so changing one statement costs about the same however long the
+ * program is, apart from comparing and copying the unchanged parts.
+ *
+ * Only programs that translate successfully are translated incrementally.
+ * If the changed statements don't parse, or any statement reads a name no
+ * statement before it assigns, the whole program is translated again with
+ * py2c_translate() to report the errors in the usual order.  Returns 0 on
+ * success or 1 if there were errors.
+ */
+int py2c_incremental_translate(struct py2c_incremental* inc, char* text, size_t len, FILE* stream) {
+    struct kept_statement* old = inc->statements;
+    int num_old = inc->num_statements;
+    size_t old_len = inc->len;
 
-          printf("printf(\"%s: %%lf\\n\", %s);\n", key, key);
+    /*
+     * Keep the statements before the first byte that changed and after the
+     * last one, as long as the input is still split in the same places around
+     * them.
+     */
+    int first = 0, last = num_old;
+    if (num_old > 0) {
+        size_t shorter = old_len < len ? old_len : len;
+        size_t prefix = _common_prefix(inc->text, text, shorter);
+        size_t suffix = _common_suffix(inc->text, old_len, text, len, shorter - prefix);
+
+        int lo = 0, hi = num_old;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (old[mid].source_end <= prefix) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        first = lo;
+        while (first > 0 && !_is_statement_boundary(text, len, old[first - 1].source_end)) {
+            first--;
         }
 
-        printf("}\n");
+        lo = first, hi = num_old;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if ((mid ? old[mid - 1].source_end : 0) >= old_len - suffix) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        last = lo;
+        while (last < num_old
+                && !_is_statement_boundary(text, len, (last ? old[last - 1].source_end : 0) + len - old_len)) {
+            last++;
+        }
+    }
+    free(inc->text);
+    inc->text = text;
+    inc->len = len;
+
+    /*
+     * Find where the statements between the kept ones start.  If none does,
+     * because all that's left of the changed text before the first kept
+     * statement is blank lines and comments, that statement is parsed again
+     * along with them.
+     */
+    size_t start = first ? old[first - 1].source_end : 0;
+    size_t end = last < num_old ? (last ? old[last - 1].source_end : 0) + len - old_len : len;
+    size_t* starts = NULL;
+    int num_starts = 0, starts_capacity = 0;
+    for (size_t line = start; ; ) {
+        while (line < end) {
+            if (_is_chunk_start(text + line, text + len)) {
+                if (num_starts == starts_capacity) {
+                    starts_capacity = starts_capacity ? 2 * starts_capacity : 64;
+                    starts = realloc(starts, starts_capacity * sizeof(size_t));
+                }
+                starts[num_starts++] = line;
+            }
+            const char* newline = memchr(text + line, '\n', end - line);
+            line = newline ? (size_t)(newline - text) + 1 : end;
+        }
+        if (num_starts > 0 || end == start || last == num_old) {
+            break;
+        }
+        end = old[last++].source_end + len - old_len;
+    }
+
+    struct py2c_ctx* ctx = NULL;
+    int failed = first + num_starts + (num_old - last) == 0;
+    if (end > start && !failed) {
+        ctx = py2c_create(inc->names);
+        ctx->chunk = 1;
+        py2c_feed(ctx, text + start, end - start, true);
+        failed = num_starts == 0 || ctx->status != 0 || ctx->error || ctx->num_statements != num_starts
+            || ctx->statements[num_starts - 1].regions != region_list_size(ctx->program)
+            || ctx->statements[num_starts - 1].refs != ctx->num_symbol_refs;
+    }
+    if (failed) {
+        if (ctx) {
+            py2c_free(ctx);
+        }
+        free(starts);
+        py2c_incremental_forget(inc);
+        return py2c_translate(inc->names, text, len, stream);
+    }
+
+    /*
+     * Put the new statements' translations between the kept ones.
+     */
+    int num_new = ctx ? ctx->num_statements : 0;
+    int num_statements = first + num_new + num_old - last;
+    size_t prefix_code = first ? old[first - 1].code_end : 0;
+    size_t old_suffix_start = last ? old[last - 1].code_end : 0;
+    size_t suffix_code = (num_old ? old[num_old - 1].code_end : 0) - old_suffix_start;
+    size_t new_code = ctx ? region_list_span_length(ctx->program, 0, region_list_size(ctx->program)) : 0;
+    int prefix_names = first ? old[first - 1].names_end : 0;
+    int old_suffix_names = last ? old[last - 1].names_end : 0;
+    int suffix_names = (num_old ? old[num_old - 1].names_end : 0) - old_suffix_names;
+
+    struct kept_statement* statements = malloc(num_statements * sizeof(struct kept_statement));
+    char* code = malloc(prefix_code + new_code + suffix_code);
+    const char** names = malloc((prefix_names + (ctx ? ctx->num_symbol_refs : 0) + suffix_names)
+        * sizeof(char*));
+    if (num_old > 0) {
+        memcpy(statements, old, first * sizeof(struct kept_statement));
+        memcpy(code, inc->code, prefix_code);
+        memcpy(names, inc->kept_names, prefix_names * sizeof(char*));
+    }
+
+    size_t code_end = prefix_code;
+    int num_names = prefix_names;
+    for (int i = 0; i < num_new; i++) {
+        struct kept_statement* statement = &statements[first + i];
+        int first_region = i ? ctx->statements[i - 1].regions : 0;
+        size_t length = region_list_span_length(ctx->program, first_region, ctx->statements[i].regions);
+        region_list_render(ctx->program, first_region, ctx->statements[i].regions, code + code_end, NULL,
+            NULL);
+        code_end += length;
+        statement->source_end = i + 1 < num_new ? starts[i + 1] : end;
+        statement->code_end = code_end;
+        statement->num_reads = _keep_names(inc, ctx, i, names, &num_names);
+        statement->names_end = num_names;
+    }
+
+    if (num_old > 0) {
+        memcpy(code + code_end, inc->code + old_suffix_start, suffix_code);
+        memcpy(names + num_names, inc->kept_names + old_suffix_names, suffix_names * sizeof(char*));
+    }
+    for (int i = last; i < num_old; i++) {
+        struct kept_statement* statement = &statements[first + num_new + i - last];
+        statement->source_end = old[i].source_end + len - old_len;
+        statement->code_end = old[i].code_end - old_suffix_start + code_end;
+        statement->names_end = old[i].names_end - old_suffix_names + num_names;
+        statement->num_reads = old[i].num_reads;
+    }
+
+    if (ctx) {
+        py2c_free(ctx);
+    }
+    free(starts);
+    py2c_incremental_forget(inc);
+    inc->statements = statements;
+    inc->num_statements = num_statements;
+    inc->code = code;
+    inc->kept_names = names;
+
+    /*
+     * Declare the variables in the order they're first assigned in, and check
+     * that every name a statement reads is assigned by a statement before it,
+     * as resolve_symbols() would.
+     */
+    struct hash* symbols = hash_create();
+    unsigned int mark = _next_mark(inc);
+    int undefined = 0;
+    for (int i = 0, j = 0; i < num_statements && !undefined; i++) {
+        for (int reads_end = j + statements[i].num_reads; j < reads_end; j++) {
+            undefined |= inc->marks[intern_id(names[j])] != mark;
+        }
+        for (; j < statements[i].names_end; j++) {
+            unsigned int id = intern_id(names[j]);
+            if (inc->marks[id] != mark) {
+                inc->marks[id] = mark;
+                hash_insert(symbols, (char*)names[j], NULL);
+            }
+        }
+    }
 
+    if (undefined) {
         hash_free(symbols);
+        return py2c_translate(inc->names, text, len, stream);
+    }
+    write_prologue(symbols, stream);
+    fwrite(code, 1, statements[num_statements - 1].code_end, stream);
+    write_epilogue(symbols, stream);
+    hash_free(symbols);
+    return 0;
+}
 
-        return 0;
-    } else  {
+/*
+ * How many input files batch mode reads ahead of the one being translated,
+ * and how many finished outputs may be waiting to be written.
+ */
+#define BATCH_DEPTH 32
+
+/*
+ * This function builds the output path for `path` in `outdir`, replacing a
+ * .py extension with .c.  Compressed inputs (.py.gz) get compressed outputs
+ * (.c.gz).
+ */
+char* batch_output_path(const char* outdir, const char* path) {
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    size_t len = strlen(base);
+    int gzip = len > 3 && strcmp(base + len - 3, ".gz") == 0;
+    if (gzip) {
+        len -= 3;
+    }
+    if (len > 3 && strncmp(base + len - 3, ".py", 3) == 0) {
+        len -= 3;
+    }
+
+    char* out;
+    asprintf(&out, "%s/%.*s.c%s", outdir, (int)len, base, gzip ? ".gz" : "");
+    return out;
+}
+
+/*
+ * This function is passed to zstream_inflate() to feed each decompressed
+ * chunk of a file to a translation context.
+ */
+int feed_chunk(void* ctx, const char* chunk, size_t len) {
+    return py2c_feed(ctx, chunk, len, false) != YYPUSH_MORE;
+}
+
+/*
+ * This function waits for a queued write of the output at `path` to finish,
+ * then frees the job and the path.  Returns 0 if the write succeeded or 1
+ * (after reporting the error) otherwise.
+ */
+int batch_reap_write(struct fileio* io, struct fileio_job* write, char* path) {
+    int error = fileio_wait(io, write);
+    if (error) {
+        fprintf(stderr, "Error: Could not write %s: %s\n", path, strerror(error));
+    }
+    fileio_job_free(write);
+    free(path);
+    return error != 0;
+}
+
+/*
+ * This function translates each of `num_files` files into `outdir`.  Reads of
+ * upcoming inputs and writes of finished outputs go through an asynchronous
+ * I/O queue, so they overlap translation.  Nothing is translated if two files
+ * would have the same output path.  Returns 0 if every file was translated
+ * successfully or 1 otherwise.
+ */
+int translate_batch(struct interner* names, const char* outdir, char** files, int num_files,
+        enum fileio_backend backend, int stats, int compact, struct remarks* remarks) {
+    /*
+     * Outputs are named after their inputs' base names, so inputs with the
+     * same name in different directories would overwrite each other's output.
+     * Refuse to translate any of them rather than lose one.
+     */
+    struct hash* outputs = hash_create();
+    int collided = 0;
+    for (int i = 0; i < num_files; i++) {
+        char* path = batch_output_path(outdir, files[i]);
+        if (hash_contains(outputs, path)) {
+            fprintf(stderr, "Error: %s and %s would both be translated to %s\n",
+                (char*)hash_get(outputs, path), files[i], path);
+            collided = 1;
+        } else {
+            hash_insert(outputs, path, strdup(files[i]));
+        }
+        free(path);
+    }
+    hash_free(outputs);
+    if (collided) {
+        return 1;
+    }
+
+    struct fileio* io = fileio_create(backend);
+    if (!io) {
+        fprintf(stderr, "Error: io_uring is not available\n");
+        return 1;
+    }
+
+    struct perfcount* counters = stats ? perfcount_create(py2c_phase_names, NUM_PHASES) : NULL;
+    struct fileio_job** reads = calloc(num_files, sizeof(struct fileio_job*));
+    struct fileio_job* writes[BATCH_DEPTH] = { NULL };
+    char* write_paths[BATCH_DEPTH] = { NULL };
+    int next_read = 0;
+    int status = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < num_files; i++) {
+        while (next_read < num_files && next_read < i + BATCH_DEPTH) {
+            reads[next_read] = fileio_read(io, files[next_read]);
+            next_read++;
+        }
+
+        int error = fileio_wait(io, reads[i]);
+        if (error) {
+            fprintf(stderr, "Error: Could not read %s: %s\n", files[i], strerror(error));
+            fileio_job_free(reads[i]);
+            status = 1;
+            continue;
+        }
+
+        size_t len;
+        char* text = fileio_job_data(reads[i], &len);
+        size_t name_len = strlen(files[i]);
+        int gzip = name_len > 3 && strcmp(files[i] + name_len - 3, ".gz") == 0;
+        struct py2c_ctx* ctx = py2c_create(names);
+        ctx->counters = counters;
+        ctx->remarks = remarks;
+        ctx->compact = compact;
+        ctx->path = files[i];
+        int corrupt = gzip && zstream_inflate(text, len, feed_chunk, ctx) != 0;
+        py2c_feed(ctx, gzip ? "" : text, gzip ? 0 : len, true);
+        fileio_job_free(reads[i]);
+
+        if (corrupt) {
+            fprintf(stderr, "Error: Could not decompress %s\n", files[i]);
+            status = 1;
+        } else if (py2c_finish(ctx)) {
+            status = 1;
+        } else {
+            char* output;
+            size_t output_len;
+            FILE* stream = open_memstream(&output, &output_len);
+            py2c_write(ctx, stream);
+            fclose(stream);
+
+            if (gzip) {
+                char* compressed = zstream_deflate(output, output_len, &output_len);
+                free(output);
+                output = compressed;
+            }
+
+            /*
+             * Reap the oldest pending write if all of the slots are taken.
+             */
+            int slot = i % BATCH_DEPTH;
+            if (writes[slot]) {
+                status |= batch_reap_write(io, writes[slot], write_paths[slot]);
+            }
+
+            write_paths[slot] = batch_output_path(outdir, files[i]);
+            writes[slot] = fileio_write(io, write_paths[slot], output, output_len);
+        }
+        py2c_free(ctx);
+
+        /*
+         * No names outlive the file they're from, so this is where the
+         * interner can be cut back if the batch has grown it too far.
+         */
+        intern_reclaim(names, INTERN_RECLAIM_BYTES);
+    }
+
+    for (int i = 0; i < BATCH_DEPTH; i++) {
+        if (writes[i]) {
+            status |= batch_reap_write(io, writes[i], write_paths[i]);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (stats) {
+        fprintf(stderr, "Batch I/O: %s, %d files in %.3f s (%.0f files/s), %.2f syscalls per file\n",
+            fileio_backend_name(io), num_files, secs, num_files / secs,
+            (double)fileio_syscalls(io) / num_files);
+        perfcount_print(counters, stderr);
+    }
+
+    perfcount_free(counters);
+    free(reads);
+    fileio_free(io);
+    return status;
+}
+
+/*
+ * This function translates every entry of the bundle at `in_path`, writing
+ * the translations to a bundle at `out_path`.  Output entries are named like
+ * their inputs, with a .py extension replaced by .c; entries that fail to
+ * translate are left out.  Returns 0 if every entry was translated
+ * successfully or 1 otherwise.
+ */
+int translate_bundle(struct interner* names, const char* in_path, const char* out_path, int stats,
+        int compact, struct remarks* remarks) {
+    struct bundle* in = bundle_open(in_path);
+    if (!in) {
+        fprintf(stderr, "Error: Could not open bundle %s: %s\n", in_path, strerror(errno));
         return 1;
     }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct perfcount* counters = stats ? perfcount_create(py2c_phase_names, NUM_PHASES) : NULL;
+    struct bundle_writer* out = bundle_writer_create();
+    char* output = NULL;
+    size_t output_len = 0;
+    int status = 0;
+
+    for (size_t i = 0; i < bundle_count(in); i++) {
+        size_t name_len, len;
+        const char* name = bundle_name(in, i, &name_len);
+        const char* text = bundle_data(in, i, &len);
+
+        char* path = strndup(name, name_len);
+        struct py2c_ctx* ctx = py2c_create(names);
+        ctx->counters = counters;
+        ctx->remarks = remarks;
+        ctx->compact = compact;
+        ctx->path = path;
+        py2c_feed(ctx, text, len, true);
+        if (py2c_finish(ctx)) {
+            fprintf(stderr, "Error: Could not translate %.*s\n", (int)name_len, name);
+            status = 1;
+        } else {
+            FILE* stream = open_memstream(&output, &output_len);
+            py2c_write(ctx, stream);
+            fclose(stream);
+
+            char* out_name;
+            if (name_len > 3 && strncmp(name + name_len - 3, ".py", 3) == 0) {
+                name_len -= 3;
+            }
+            int out_name_len = asprintf(&out_name, "%.*s.c", (int)name_len, name);
+            bundle_writer_add(out, out_name, out_name_len, output, output_len);
+            free(out_name);
+            free(output);
+        }
+        py2c_free(ctx);
+        intern_reclaim(names, INTERN_RECLAIM_BYTES);
+        free(path);
+    }
+
+    if (bundle_writer_save(out, out_path) != 0) {
+        fprintf(stderr, "Error: Could not write bundle %s: %s\n", out_path, strerror(errno));
+        status = 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (stats) {
+        fprintf(stderr, "Bundle: %zu entries in %.3f s (%.0f files/s)\n",
+            bundle_count(in), secs, bundle_count(in) / secs);
+        perfcount_print(counters, stderr);
+    }
+
+    perfcount_free(counters);
+    bundle_writer_free(out);
+    bundle_close(in);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    int stats = 0;
+    int gzip = 0;
+    size_t max_memory = 0;
+    char* watch_dir = NULL;
+    char* out_dir = NULL;
+    char* bundle_path = NULL;
+    char* remark_passes = NULL;
+    enum remark_format remark_format = REMARK_TEXT;
+    enum fileio_backend backend = FILEIO_AUTO;
+    int build = 0;
+    int fast_compile = 0;
+    struct build_options build_options = { 0 };
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            watch_dir = argv[++i];
+        } else if (strcmp(argv[i], "--bundle") == 0 && i + 1 < argc) {
+            bundle_path = argv[++i];
+        } else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+            char* end;
+            max_memory = strtoull(argv[++i], &end, 10);
+            switch (*end) {
+                case 'G': case 'g': max_memory <<= 10; /* fall through */
+                case 'M': case 'm': max_memory <<= 10; /* fall through */
+                case 'K': case 'k': max_memory <<= 10; end++;
+            }
+            if (*end != '\0' || end == argv[i]) {
+                fprintf(stderr, "Error: Invalid memory budget: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            remark_passes = argv[++i];
+        } else if (strcmp(argv[i], "--remarks-format") == 0 && i + 1 < argc) {
+            if (remarks_parse_format(argv[++i], &remark_format) != 0) {
+                fprintf(stderr, "Error: Invalid remarks format: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--fast-compile") == 0) {
+            fast_compile = 1;
+        } else if (strcmp(argv[i], "--build") == 0) {
+            build = 1;
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            build_options.cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--cc") == 0 && i + 1 < argc) {
+            build_options.cc = argv[++i];
+        } else if (strcmp(argv[i], "--cflags") == 0 && i + 1 < argc) {
+            build_options.cflags = argv[++i];
+        } else if (strncmp(argv[i], "-j", 2) == 0 && (argv[i][2] != '\0' || i + 1 < argc)) {
+            char* end;
+            const char* jobs = argv[i][2] != '\0' ? argv[i] + 2 : argv[++i];
+            build_options.jobs = strtol(jobs, &end, 10);
+            if (*end != '\0' || build_options.jobs < 1) {
+                fprintf(stderr, "Error: Invalid number of jobs: %s\n", jobs);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--gzip") == 0) {
+            gzip = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc && strcmp(argv[i + 1], "uring") == 0) {
+            backend = FILEIO_URING;
+            i++;
+        } else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc && strcmp(argv[i + 1], "threads") == 0) {
+            backend = FILEIO_THREADS;
+            i++;
+        } else {
+            break;
+        }
+    }
+    if ((i < argc || bundle_path) != (out_dir != NULL) || (i < argc && bundle_path)
+            || (build && i == argc)) {
+        fprintf(stderr, "Usage: %s [options] [-jN] [--gzip] [--max-memory bytes[K|M|G]] < file.py[.gz] > file.c[.gz]\n"
+            "       %s [options] [--watch dir]\n"
+            "       %s [options] [--io uring|threads] -o outdir file.py...\n"
+            "       %s [options] --bundle in.bundle -o out.bundle\n"
+            "       %s [options] --build [-jN] [--cache-dir dir] [--cc cc] [--cflags flags] -o outdir file.py...\n"
+            "Options: --stats                        print statistics\n"
+            "         -R pass[,pass...]|all          report optimization remarks from these passes\n"
+            "         --remarks-format text|yaml|json\n"
+            "         --fast-compile                 write C that compiles as fast as possible\n"
+            "         -jN                            translate on N threads (or with --build, run N compilers)\n", argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    struct interner* names = intern_create();
+    struct remarks* remarks = remark_passes ? remarks_create(stderr, remark_format, remark_passes) : NULL;
+
+    if (watch_dir) {
+        return watch_directory(watch_dir, names);
+    }
+    if (bundle_path) {
+        int status = translate_bundle(names, bundle_path, out_dir, stats, fast_compile, remarks);
+        remarks_free(remarks);
+        intern_free(names);
+        return status;
+    }
+    if (build) {
+        build_options.outdir = out_dir;
+        build_options.stats = stats;
+        build_options.fast_compile = fast_compile;
+        int status = build_files(names, &build_options, argv + i, argc - i);
+        remarks_free(remarks);
+        intern_free(names);
+        return status;
+    }
+    if (out_dir) {
+        int status = translate_batch(names, out_dir, argv + i, argc - i, backend, stats, fast_compile,
+            remarks);
+        remarks_free(remarks);
+        intern_free(names);
+        return status;
+    }
+    struct py2c_ctx* ctx = py2c_create(names);
+    ctx->max_memory = max_memory;
+    ctx->jobs = build_options.jobs;
+    ctx->remarks = remarks;
+    ctx->compact = fast_compile;
+    if (stats) {
+        ctx->counters = perfcount_create(py2c_phase_names, NUM_PHASES);
+    }
+
+    /*
+     * Only this thread writes output, so stdout doesn't need locking.
+     */
+    __fsetlocking(stdout, FSETLOCKING_BYCALLER);
+
+    /*
+     * Feed stdin to the translator a chunk at a time, as it's decompressed
+     * (if it's compressed at all) on a separate thread.
+     */
+    struct zstream_reader* reader = zstream_reader_open(STDIN_FILENO);
+    if (!reader) {
+        fprintf(stderr, "Error: Could not read input\n");
+        return 1;
+    }
+    const char* chunk;
+    size_t n;
+    if (build_options.jobs > 1) {
+        /*
+         * A parallel parse needs the whole program up front.
+         */
+        char* text = NULL;
+        size_t len = 0;
+        FILE* mem = open_memstream(&text, &len);
+        while ((chunk = zstream_reader_next(reader, &n)) != NULL) {
+            fwrite(chunk, 1, n, mem);
+        }
+        fclose(mem);
+        py2c_parse_parallel(ctx, text, len, build_options.jobs);
+        free(text);
+    } else {
+        while ((chunk = zstream_reader_next(reader, &n)) != NULL
+                && py2c_feed(ctx, chunk, n, false) == YYPUSH_MORE);
+        py2c_feed(ctx, "", 0, true);
+    }
+
+    if (zstream_reader_error(reader)) {
+        fprintf(stderr, "Error: Could not read input: %s\n", zstream_reader_error(reader));
+        return 1;
+    }
+    zstream_reader_close(reader);
+
+    int status = py2c_finish(ctx);
+
+    if (!status) {
+        FILE* out = stdout;
+        if (gzip) {
+            fflush(stdout);
+            out = zstream_writer_open(dup(STDOUT_FILENO));
+        }
+        if (!out) {
+            fprintf(stderr, "Error: Could not set up compressed output\n");
+            status = 1;
+        } else {
+            py2c_write(ctx, out);
+            if (gzip && fclose(out) != 0) {
+                fprintf(stderr, "Error: Could not write output\n");
+                status = 1;
+            }
+        }
+    }
+
+    /*
+     * Statistics are printed after the output is written, so the counters
+     * cover emitting it.
+     */
+    if (stats) {
+        py2c_print_stats(ctx, stderr);
+        perfcount_print(ctx->counters, stderr);
+        perfcount_free(ctx->counters);
+    }
+
+    py2c_free(ctx);
+    remarks_free(remarks);
+    intern_free(names);
+
+    return status;
 }
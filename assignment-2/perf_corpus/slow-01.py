@@ -0,0 +1,92 @@
+* 4
+el=0:
+    =  7
+if a: = 5
+ b =* = 16
+
+if a ==  x = x *a:
+
+if a:a:
+  7 7
+if a:
+  1
+iff a:
+ :
+ 7
+if a:
+  7
+if
+:
+  7
+if
+if    7
+if a:
+  7
+if
+if a:
+   7
+ia:
+   7
+if a:
+  7
+if
+if a:
+ if
+if a:
+ if
+if a:
+ if
+if a:
+ if a:
+  if if a:
+   f a 7
+if a:
+if a:
+  7
+
+ 
+if a
+  
+iff a:
+  7
+if a:
+  7
+if a  7
+if a:
+  7
+if a:
+    x = 5
+     x =  7
+if a:
+    x = 5
+    if     x = 5
+    if 
+   
+if a:
+    x = 5
+  f 
+   
+if a:
+    x = 5
+    if 
+   
+if a:
+    x = 5
+    if  
+if a:
+    x = 5
+    if 
+   
+if a:
+    x.5 
+   
+if a:
+    x = 5
+if a:
+    x = 1
+   
+if a:
+    x =if 
+   
+if a:
+ph
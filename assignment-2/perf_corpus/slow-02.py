@@ -0,0 +1,5 @@
+   :
+ y
+f
+ :
+  2
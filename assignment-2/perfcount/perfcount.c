@@ -0,0 +1,414 @@
+/*
+ * This file contains the implementation of per-phase hardware performance
+ * counters.
+ *
+ * All of the events are opened as one perf_event_open() group, counting user
+ * space only for this thread, so they're scheduled onto the PMU together.
+ * Every phase boundary takes a snapshot and charges the difference from the
+ * previous one to the phase on top of a small stack of active phases.
+ *
+ * Phase boundaries come around every token, so a snapshot mustn't cost a
+ * system call.  Each event's perf page is mapped, and while the group is on
+ * the PMU its counts are read with the rdpmc instruction, following the
+ * protocol described in linux/perf_event.h.  Only if the kernel doesn't allow
+ * that, or the group has been switched out, does a snapshot fall back to a
+ * read() of the whole group.  Time is read with rdtsc (or CLOCK_MONOTONIC,
+ * which needs no system call either, on other CPUs) and converted to
+ * nanoseconds with a rate measured over the counters' lifetime, so it's
+ * elapsed rather than CPU time.
+ *
+ * If the PMU can't fit the whole group at once, the kernel multiplexes it,
+ * and counts are scaled up by the fraction of the time the group was actually
+ * running.  Events the kernel refuses (no PMU in a VM, perf_event_paranoid,
+ * a seccomp filter in a container) are simply left out.
+ *
+ * Phase boundaries are also the phase_begin and phase_end tracepoints, which
+ * fire whether or not anything is being counted.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "perfcount.h"
+#include "../trace/trace.h"
+
+/*
+ * The deepest phases may be nested.
+ */
+#define MAX_DEPTH 8
+
+/*
+ * The number of phases whose start times are kept for the phase_end
+ * tracepoint, and those start times (0 if unknown).
+ */
+#define MAX_TRACED_PHASES 16
+static uint64_t _trace_start_ns[MAX_TRACED_PHASES];
+
+/*
+ * The events counted for each phase, in the order they're added to the
+ * group.  The first event that can be opened leads the group.
+ */
+enum {
+  EV_CYCLES,
+  EV_INSTRUCTIONS,
+  EV_BRANCH_MISSES,
+  EV_L1D_MISSES,
+  EV_LLC_MISSES,
+  NUM_EVENTS
+};
+
+#define CACHE_READ_MISSES(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) \
+    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} _events[NUM_EVENTS] = {
+  [EV_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  [EV_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  [EV_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  [EV_L1D_MISSES] = { PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_L1D) },
+  [EV_LLC_MISSES] = { PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_LL) },
+};
+
+/*
+ * This structure is used to hold one snapshot of the counters, or the totals
+ * charged to one phase.  `enabled` and `running` are the times the group was
+ * enabled and actually counting, used to scale for multiplexing.  `ticks` is
+ * the time in the units of _perfcount_ticks().  `calls` counts the times a
+ * phase was entered.
+ */
+struct reading {
+  uint64_t counts[NUM_EVENTS];
+  uint64_t enabled;
+  uint64_t running;
+  uint64_t ticks;
+  uint64_t calls;
+};
+
+/*
+ * This structure is used to represent the set of counters.  `slots` gives
+ * each event's position in a group read, or -1 if it couldn't be opened.
+ * `pages` are the events' mapped perf pages (NULL if they couldn't be
+ * mapped).  `start_ticks` and `start_ns` are used to convert ticks to
+ * nanoseconds.
+ */
+struct perfcount {
+  const char* const* names;
+  int num_phases;
+  int fds[NUM_EVENTS];
+  int slots[NUM_EVENTS];
+  struct perf_event_mmap_page* pages[NUM_EVENTS];
+  int num_open;
+  int open_error;
+  struct reading last;
+  int stack[MAX_DEPTH];
+  int depth;
+  struct reading* totals;
+  uint64_t start_ticks;
+  uint64_t start_ns;
+};
+
+/*
+ * Helper function to open one event, in the group led by `group_fd` (or as
+ * the leader of a new group if it's -1).
+ */
+int _perfcount_open(int event, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = _events[event].type;
+  attr.config = _events[event].config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+    | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * Helper function returning the current time in nanoseconds.
+ */
+uint64_t _perfcount_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Helper function returning the current time in ticks of the cheapest clock
+ * available, which may not be nanoseconds.
+ */
+uint64_t _perfcount_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return _perfcount_now_ns();
+#endif
+}
+
+struct perfcount* perfcount_create(const char* const* names, int num_phases) {
+  struct perfcount* counters = calloc(1, sizeof(struct perfcount));
+  assert(counters);
+  counters->names = names;
+  counters->num_phases = num_phases;
+  counters->totals = calloc(num_phases, sizeof(struct reading));
+  assert(counters->totals);
+
+  for (int i = 0; i < NUM_EVENTS; i++) {
+    counters->fds[i] = _perfcount_open(i, counters->num_open ? counters->fds[0] : -1);
+    counters->slots[i] = -1;
+    if (counters->fds[i] < 0) {
+      if (!counters->num_open) {
+        counters->open_error = errno;
+      }
+      continue;
+    }
+
+    /*
+     * Keep the leader's descriptor first, since the group is read through it.
+     */
+    if (!counters->num_open && i > 0) {
+      counters->fds[0] = counters->fds[i];
+      counters->fds[i] = -1;
+    }
+    counters->slots[i] = counters->num_open++;
+  }
+
+  /*
+   * Map each event's perf page, so its count can be read from user space.
+   */
+  long page_size = sysconf(_SC_PAGESIZE);
+  for (int i = 0; i < NUM_EVENTS; i++) {
+    if (counters->fds[i] >= 0) {
+      void* page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, counters->fds[i], 0);
+      counters->pages[i] = page == MAP_FAILED ? NULL : page;
+    }
+  }
+
+  counters->start_ns = _perfcount_now_ns();
+  counters->start_ticks = _perfcount_ticks();
+  return counters;
+}
+
+void perfcount_free(struct perfcount* counters) {
+  if (!counters) {
+    return;
+  }
+  long page_size = sysconf(_SC_PAGESIZE);
+  for (int i = 0; i < NUM_EVENTS; i++) {
+    if (counters->pages[i]) {
+      munmap(counters->pages[i], page_size);
+    }
+    if (counters->fds[i] >= 0) {
+      close(counters->fds[i]);
+    }
+  }
+  free(counters->totals);
+  free(counters);
+}
+
+/*
+ * Helper function to read one event's count from user space into `count`,
+ * and, if `enabled` isn't NULL, the group's enabled and running times.
+ * Returns 0 on success or -1 if the event isn't on the PMU right now or the
+ * kernel doesn't allow reading it this way.
+ */
+int _perfcount_read_page(volatile struct perf_event_mmap_page* page, uint64_t* count,
+    uint64_t* enabled, uint64_t* running) {
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t seq;
+  do {
+    seq = page->lock;
+    __sync_synchronize();
+
+    uint32_t index = page->index;
+    if (!page->cap_user_rdpmc || index == 0 || (enabled && !page->cap_user_time)) {
+      return -1;
+    }
+
+    /*
+     * The hardware counter is only pmc_width bits wide, so sign-extend it
+     * before adding it to the kernel's offset.
+     */
+    int64_t pmc = __rdpmc(index - 1);
+    pmc <<= 64 - page->pmc_width;
+    pmc >>= 64 - page->pmc_width;
+    *count = page->offset + pmc;
+
+    /*
+     * The times are as of the last time the kernel updated the page, so add
+     * the time since then, converted from TSC cycles.
+     */
+    if (enabled) {
+      uint64_t cycles = __rdtsc();
+      uint64_t quot = cycles >> page->time_shift;
+      uint64_t rem = cycles & (((uint64_t)1 << page->time_shift) - 1);
+      uint64_t delta = page->time_offset + quot * page->time_mult
+        + ((rem * page->time_mult) >> page->time_shift);
+      *enabled = page->time_enabled + delta;
+      *running = page->time_running + delta;
+    }
+
+    __sync_synchronize();
+  } while (page->lock != seq);
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/*
+ * Helper function to read all of the events, from user space if possible and
+ * with a read() of the whole group otherwise.
+ */
+void _perfcount_read(struct perfcount* counters, struct reading* now) {
+  int from_pages = 1;
+  for (int i = 0; i < NUM_EVENTS && from_pages; i++) {
+    if (counters->slots[i] >= 0) {
+      from_pages = counters->pages[i] && _perfcount_read_page(counters->pages[i], &now->counts[i],
+        counters->slots[i] == 0 ? &now->enabled : NULL, &now->running) == 0;
+    }
+  }
+
+  if (!from_pages) {
+    uint64_t buf[3 + NUM_EVENTS];
+    if (read(counters->fds[0], buf, sizeof(buf)) >= (ssize_t)((3 + counters->num_open) * sizeof(uint64_t))) {
+      now->enabled = buf[1];
+      now->running = buf[2];
+      for (int i = 0; i < NUM_EVENTS; i++) {
+        if (counters->slots[i] >= 0) {
+          now->counts[i] = buf[3 + counters->slots[i]];
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Helper function to take a snapshot of the counters and charge everything
+ * counted since the previous snapshot to the phase on top of the stack.
+ */
+void _perfcount_charge(struct perfcount* counters) {
+  struct reading now;
+  memset(&now, 0, sizeof(now));
+
+  if (counters->num_open) {
+    _perfcount_read(counters, &now);
+  }
+  now.ticks = _perfcount_ticks();
+
+  if (counters->depth > 0) {
+    struct reading* total = &counters->totals[counters->stack[counters->depth - 1]];
+    for (int i = 0; i < NUM_EVENTS; i++) {
+      total->counts[i] += now.counts[i] - counters->last.counts[i];
+    }
+    total->enabled += now.enabled - counters->last.enabled;
+    total->running += now.running - counters->last.running;
+    total->ticks += now.ticks - counters->last.ticks;
+  }
+  counters->last = now;
+}
+
+void perfcount_enter(struct perfcount* counters, int phase) {
+  TRACE1(phase_begin, phase);
+  if (TRACE_ENABLED(phase_end) && phase < MAX_TRACED_PHASES) {
+    _trace_start_ns[phase] = _perfcount_now_ns();
+  }
+  if (!counters) {
+    return;
+  }
+  assert(counters->depth < MAX_DEPTH && phase >= 0 && phase < counters->num_phases);
+  _perfcount_charge(counters);
+  counters->stack[counters->depth++] = phase;
+  counters->totals[phase].calls++;
+}
+
+void perfcount_leave(struct perfcount* counters, int phase) {
+  uint64_t ns = 0;
+  if (TRACE_ENABLED(phase_end) && phase < MAX_TRACED_PHASES && _trace_start_ns[phase]) {
+    ns = _perfcount_now_ns() - _trace_start_ns[phase];
+  }
+  TRACE2(phase_end, phase, ns);
+  if (!counters) {
+    return;
+  }
+  assert(counters->depth > 0 && counters->stack[counters->depth - 1] == phase);
+  _perfcount_charge(counters);
+  counters->depth--;
+}
+
+/*
+ * Helper function to return a phase's count of an event, scaled up for the
+ * time the group wasn't running, or -1 if the event wasn't counted.
+ */
+double _perfcount_scaled(struct perfcount* counters, struct reading* total, int event) {
+  if (counters->slots[event] < 0 || total->running == 0) {
+    return -1;
+  }
+  return (double)total->counts[event] * total->enabled / total->running;
+}
+
+/*
+ * Helper function to print a rate, or n/a if either side wasn't counted.
+ */
+void _perfcount_print_rate(FILE* stream, double n, double d, double scale) {
+  if (n < 0 || d <= 0) {
+    fprintf(stream, " %9s", "n/a");
+  } else {
+    fprintf(stream, " %9.2f", n * scale / d);
+  }
+}
+
+void perfcount_print(struct perfcount* counters, FILE* stream) {
+  if (counters->num_open) {
+    fprintf(stream, "Phase counters (user space only):\n");
+  } else {
+    fprintf(stream, "Phase counters unavailable (%s), time only:\n",
+      strerror(counters->open_error));
+  }
+  fprintf(stream, "  %-8s %10s %10s %14s %14s %9s %9s %9s %9s\n", "phase", "calls", "ms",
+    "cycles", "instructions", "IPC", "br-MPKI", "L1d-MPKI", "LLC-MPKI");
+
+  double ns_per_tick = 1;
+  uint64_t ticks = _perfcount_ticks() - counters->start_ticks;
+  if (ticks > 0) {
+    ns_per_tick = (double)(_perfcount_now_ns() - counters->start_ns) / ticks;
+  }
+
+  for (int p = 0; p < counters->num_phases; p++) {
+    struct reading* total = &counters->totals[p];
+    double cycles = _perfcount_scaled(counters, total, EV_CYCLES);
+    double instructions = _perfcount_scaled(counters, total, EV_INSTRUCTIONS);
+
+    fprintf(stream, "  %-8s %10llu %10.3f", counters->names[p],
+      (unsigned long long)total->calls, total->ticks * ns_per_tick / 1e6);
+    if (cycles < 0) {
+      fprintf(stream, " %14s", "n/a");
+    } else {
+      fprintf(stream, " %14.0f", cycles);
+    }
+    if (instructions < 0) {
+      fprintf(stream, " %14s", "n/a");
+    } else {
+      fprintf(stream, " %14.0f", instructions);
+    }
+    _perfcount_print_rate(stream, instructions, cycles, 1);
+    _perfcount_print_rate(stream, _perfcount_scaled(counters, total, EV_BRANCH_MISSES), instructions, 1000);
+    _perfcount_print_rate(stream, _perfcount_scaled(counters, total, EV_L1D_MISSES), instructions, 1000);
+    _perfcount_print_rate(stream, _perfcount_scaled(counters, total, EV_LLC_MISSES), instructions, 1000);
+    fprintf(stream, "\n");
+  }
+}
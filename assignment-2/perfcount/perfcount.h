@@ -0,0 +1,59 @@
+/*
+ * This file contains the declarations for per-phase hardware performance
+ * counters.  A program names its phases (scanning, parsing and so on) and
+ * brackets the work done in each with perfcount_enter() and perfcount_leave().
+ * Counter readings taken at each boundary are charged to the innermost phase,
+ * so a phase nested inside another (hash lookups made while parsing, say) is
+ * subtracted from the enclosing one.  Entering and leaving a phase also fire
+ * the phase_begin and phase_end tracepoints (see trace/trace.h).
+ *
+ * Counters are opened with perf_event_open() and read without system calls
+ * where the kernel allows it, since phases may be entered around every token.
+ * Where counters aren't available, as in many containers, or where the CPU
+ * lacks some of the events, only the missing readings are left out; the time
+ * spent in each phase is always reported.  See perfcount.c for implementation
+ * details.
+ */
+
+#ifndef __PERFCOUNT_H
+#define __PERFCOUNT_H
+
+#include <stdio.h>
+
+/*
+ * Structure used to represent a set of per-phase counters.
+ */
+struct perfcount;
+
+/*
+ * Create a new set of counters for `num_phases` phases, numbered from 0, with
+ * the given names.  `names` must outlive the counters.  Counting starts
+ * straight away.
+ */
+struct perfcount* perfcount_create(const char* const* names, int num_phases);
+
+/*
+ * Free the memory and counters associated with a set of counters.
+ */
+void perfcount_free(struct perfcount* counters);
+
+/*
+ * Marks the start of work in `phase`, which lasts until the matching call to
+ * perfcount_leave().  Does nothing if `counters` is NULL, so callers don't
+ * have to check whether counting is turned on.
+ */
+void perfcount_enter(struct perfcount* counters, int phase);
+
+/*
+ * Marks the end of `phase`, which must be the phase most recently entered.
+ * Does nothing if `counters` is NULL.
+ */
+void perfcount_leave(struct perfcount* counters, int phase);
+
+/*
+ * Writes a table of the number of times each phase was entered and its time,
+ * instructions per cycle and miss rates to `stream`.
+ */
+void perfcount_print(struct perfcount* counters, FILE* stream);
+
+#endif
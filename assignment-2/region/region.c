@@ -0,0 +1,388 @@
+/*
+ * This file contains the implementation of a simple list of generated code
+ * regions.  When a list's regions take up too much memory they can be moved
+ * to an unlinked temporary file, which is copied to the output with
+ * sendfile() when the list is written.  Every list counts the memory it uses
+ * in a total that may be shared with other lists, so the owner of a group of
+ * lists can tell when to spill them.
+ *
+ * A deferred region is stored as a NULL region, with its key in `keys`, an
+ * array parallel to `regions` that's only allocated once a list holds one.
+ * A list holding a deferred region can't be spilled, since the spill file can
+ * only hold text that's known.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+#include "region.h"
+
+/*
+ * The initial capacity of the region array.
+ */
+#define INITIAL_CAPACITY 8
+
+/*
+ * This structure is used to represent the region list itself.  Along with the
+ * regions, we keep the length of each one and the total length of all of them.
+ * The first `spilled` bytes of the list live in `spill` rather than in
+ * `regions`.  `accounted` is the number of bytes the list last added to
+ * `*memory`.
+ */
+struct region_list {
+  char** regions;
+  size_t* lengths;
+  uint32_t* keys;
+  int size;
+  int capacity;
+  size_t length;
+  FILE* spill;
+  size_t spilled;
+  int num_spilled;
+  size_t* memory;
+  size_t accounted;
+};
+
+
+/*
+ * Helper function to bring a list's share of its memory total up to date
+ * after the list has changed.
+ */
+void _region_list_account(struct region_list* list) {
+  size_t bytes = sizeof(struct region_list) + list->capacity * (sizeof(char*) + sizeof(size_t))
+    + (list->keys ? list->capacity * sizeof(uint32_t) : 0) + list->length - list->spilled;
+  if (list->memory) {
+    *list->memory = *list->memory - list->accounted + bytes;
+  }
+  list->accounted = bytes;
+}
+
+
+/*
+ * Helper function to make room for `size` regions in a list.
+ */
+void _region_list_reserve(struct region_list* list, int size) {
+  if (size > list->capacity) {
+    if (list->capacity == 0) {
+      list->capacity = INITIAL_CAPACITY;
+    }
+    while (size > list->capacity) {
+      list->capacity *= 2;
+    }
+    list->regions = realloc(list->regions, list->capacity * sizeof(char*));
+    list->lengths = realloc(list->lengths, list->capacity * sizeof(size_t));
+    assert(list->regions && list->lengths);
+    if (list->keys) {
+      list->keys = realloc(list->keys, list->capacity * sizeof(uint32_t));
+      assert(list->keys);
+    }
+  }
+}
+
+
+/*
+ * Helper function to allocate a list's array of keys, if it hasn't been yet.
+ */
+void _region_list_use_keys(struct region_list* list) {
+  if (!list->keys) {
+    list->keys = malloc((list->capacity ? list->capacity : 1) * sizeof(uint32_t));
+    assert(list->keys);
+  }
+}
+
+
+/*
+ * Create a new, empty region list.  Every statement gets a list of its own, so
+ * the region array isn't allocated until the first region is added.
+ */
+struct region_list* region_list_create(size_t* memory) {
+  struct region_list* list = malloc(sizeof(struct region_list));
+  assert(list);
+  list->regions = NULL;
+  list->lengths = NULL;
+  list->keys = NULL;
+  list->size = 0;
+  list->capacity = 0;
+  list->length = 0;
+  list->spill = NULL;
+  list->spilled = 0;
+  list->num_spilled = 0;
+  list->memory = memory;
+  list->accounted = 0;
+  _region_list_account(list);
+  return list;
+}
+
+
+/*
+ * Free the memory associated with a region list, including all of the
+ * regions stored in it.
+ */
+void region_list_free(struct region_list* list) {
+  assert(list);
+  for (int i = 0; i < list->size; i++) {
+    free(list->regions[i]);
+  }
+  free(list->regions);
+  free(list->lengths);
+  free(list->keys);
+  if (list->spill) {
+    fclose(list->spill);
+  }
+  if (list->memory) {
+    *list->memory -= list->accounted;
+  }
+  free(list);
+}
+
+
+/*
+ * Appends a region to the end of a list.  The list takes ownership of `text`.
+ * NULL regions (e.g. from statements that failed to parse) are ignored.
+ */
+void region_list_append(struct region_list* list, char* text) {
+  assert(list);
+  if (text == NULL) {
+    return;
+  }
+
+  _region_list_reserve(list, list->size + 1);
+  size_t l = strlen(text);
+  list->regions[list->size] = text;
+  list->lengths[list->size] = l;
+  list->size++;
+  list->length += l;
+  _region_list_account(list);
+}
+
+
+/*
+ * Appends a deferred region to the end of a list.
+ */
+void region_list_append_deferred(struct region_list* list, uint32_t key, size_t length) {
+  assert(list);
+  _region_list_reserve(list, list->size + 1);
+  _region_list_use_keys(list);
+  list->regions[list->size] = NULL;
+  list->lengths[list->size] = length;
+  list->keys[list->size] = key;
+  list->size++;
+  list->length += length;
+  _region_list_account(list);
+}
+
+
+/*
+ * Helper function to move the spilled text of `src` to the end of the spill
+ * file of `dst`.  If `dst` has nothing in it, it just takes over the spill
+ * file of `src`.
+ */
+int _region_list_move_spill(struct region_list* dst, struct region_list* src) {
+  char buf[65536];
+  if (dst->size == 0 && dst->spill == NULL) {
+    dst->spill = src->spill;
+  } else {
+    if (region_list_spill(dst) != 0 || fseeko(src->spill, 0, SEEK_SET) != 0) {
+      return -1;
+    }
+    for (size_t done = 0; done < src->spilled; ) {
+      size_t want = src->spilled - done < sizeof(buf) ? src->spilled - done : sizeof(buf);
+      size_t n = fread(buf, 1, want, src->spill);
+      if (n == 0 || fwrite(buf, 1, n, dst->spill) != n) {
+        return -1;
+      }
+      done += n;
+    }
+    if (fflush(dst->spill) != 0) {
+      return -1;
+    }
+    fclose(src->spill);
+  }
+
+  dst->spilled += src->spilled;
+  dst->num_spilled += src->num_spilled;
+  src->spill = NULL;
+  src->spilled = 0;
+  src->num_spilled = 0;
+  return 0;
+}
+
+
+/*
+ * Moves every region of `src` to the end of `dst`, leaving `src` empty.  Only
+ * the region pointers are copied, not their text.  Spilled text always comes
+ * before text in memory, so if `src` has spilled regions, everything in `dst`
+ * is spilled first and the spilled text of `src` is moved after it.
+ */
+int region_list_concat(struct region_list* dst, struct region_list* src) {
+  assert(dst && src);
+  if (src->spill && _region_list_move_spill(dst, src) != 0) {
+    return -1;
+  }
+
+  if (src->size > 0) {
+    _region_list_reserve(dst, dst->size + src->size);
+    memcpy(dst->regions + dst->size, src->regions, src->size * sizeof(char*));
+    memcpy(dst->lengths + dst->size, src->lengths, src->size * sizeof(size_t));
+    if (src->keys) {
+      _region_list_use_keys(dst);
+      memcpy(dst->keys + dst->size, src->keys, src->size * sizeof(uint32_t));
+    }
+    dst->size += src->size;
+  }
+  dst->length += src->length;
+
+  src->size = 0;
+  src->length = 0;
+  _region_list_account(dst);
+  _region_list_account(src);
+  return 0;
+}
+
+
+/*
+ * Returns the number of regions in a list.
+ */
+int region_list_size(struct region_list* list) {
+  assert(list);
+  return list->num_spilled + list->size;
+}
+
+
+/*
+ * Returns the total length in bytes of all regions in a list.
+ */
+size_t region_list_length(struct region_list* list) {
+  assert(list);
+  return list->length;
+}
+
+
+/*
+ * Returns the number of bytes of region text a list holds in memory.
+ */
+size_t region_list_memory(struct region_list* list) {
+  assert(list);
+  return list->length - list->spilled;
+}
+
+
+/*
+ * Moves a list's in-memory regions to its spill file.
+ */
+int region_list_spill(struct region_list* list) {
+  assert(list);
+  for (int i = 0; i < list->size; i++) {
+    if (list->regions[i] == NULL) {
+      return -1;
+    }
+  }
+  if (list->spill == NULL) {
+    list->spill = tmpfile();
+    if (list->spill == NULL) {
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < list->size; i++) {
+    if (fwrite(list->regions[i], 1, list->lengths[i], list->spill) != list->lengths[i]) {
+      return -1;
+    }
+  }
+  if (fflush(list->spill) != 0) {
+    return -1;
+  }
+
+  for (int i = 0; i < list->size; i++) {
+    list->spilled += list->lengths[i];
+    free(list->regions[i]);
+  }
+  list->num_spilled += list->size;
+  list->size = 0;
+  _region_list_account(list);
+  return 0;
+}
+
+
+/*
+ * Writes all regions in a list to a stream in order.
+ */
+int region_list_write(struct region_list* list, FILE* stream) {
+  assert(list);
+
+  if (list->spilled > 0) {
+    /*
+     * Splice the spill file straight into the output if the output is a real
+     * file descriptor, and copy it through a buffer otherwise (or if
+     * sendfile() can't handle this kind of output).
+     */
+    off_t offset = 0;
+    int out_fd = fileno(stream);
+    if (out_fd >= 0 && fflush(stream) == 0) {
+      while (offset < list->spilled) {
+        ssize_t n = sendfile(out_fd, fileno(list->spill), &offset, list->spilled - offset);
+        if (n <= 0) {
+          break;
+        }
+      }
+    }
+
+    if (offset < list->spilled) {
+      char buf[65536];
+      if (fseeko(list->spill, offset, SEEK_SET) != 0) {
+        return -1;
+      }
+      while (offset < list->spilled) {
+        size_t want = list->spilled - offset < sizeof(buf) ? list->spilled - offset : sizeof(buf);
+        size_t n = fread(buf, 1, want, list->spill);
+        if (n == 0) {
+          return -1;
+        }
+        fwrite(buf, 1, n, stream);
+        offset += n;
+      }
+    }
+  }
+
+  for (int i = 0; i < list->size; i++) {
+    assert(list->regions[i]);
+    fwrite(list->regions[i], 1, list->lengths[i], stream);
+  }
+  return 0;
+}
+
+
+/*
+ * Returns the total length of a span of a list's regions.
+ */
+size_t region_list_span_length(struct region_list* list, int first, int last) {
+  assert(list);
+  assert(list->spilled == 0 && 0 <= first && first <= last && last <= list->size);
+  size_t length = 0;
+  for (int i = first; i < last; i++) {
+    length += list->lengths[i];
+  }
+  return length;
+}
+
+
+/*
+ * Copies a span of a list's regions to `out`, filling in deferred regions.
+ */
+void region_list_render(struct region_list* list, int first, int last, char* out,
+    region_fill_fn fill, void* arg) {
+  assert(list);
+  assert(list->spilled == 0 && 0 <= first && first <= last && last <= list->size);
+  for (int i = first; i < last; i++) {
+    if (list->regions[i]) {
+      memcpy(out, list->regions[i], list->lengths[i]);
+    } else {
+      fill(arg, list->keys[i], out);
+    }
+    out += list->lengths[i];
+  }
+}
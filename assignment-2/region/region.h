@@ -0,0 +1,108 @@
+/*
+ * This file contains the declarations for a simple list of generated code
+ * regions.  Each region is a heap-allocated string holding a piece of the C
+ * code for a statement.  Regions are kept separate until they're written out,
+ * so building a block of statements doesn't repeatedly copy everything
+ * generated so far, and a block's regions can be spilled to disk before the
+ * block is complete.  See region.c for implementation details.
+ */
+
+#ifndef __REGION_H
+#define __REGION_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Structure used to represent a list of regions.
+ */
+struct region_list;
+
+/*
+ * The type of function that writes the text of a deferred region (see
+ * region_list_append_deferred()), given the key it was added with, to `out`.
+ * It must write exactly the length the region was added with.
+ */
+typedef void (*region_fill_fn)(void* arg, uint32_t key, char* out);
+
+/*
+ * Create a new, empty region list.  If `memory` isn't NULL, the number of
+ * bytes the list holds in memory is kept added to `*memory`, which can be
+ * shared between lists to track their total.
+ */
+struct region_list* region_list_create(size_t* memory);
+
+/*
+ * Free the memory associated with a region list, including all of the
+ * regions stored in it.
+ */
+void region_list_free(struct region_list* list);
+
+/*
+ * Appends a region to the end of a list.  The list takes ownership of `text`.
+ * NULL regions (e.g. from statements that failed to parse) are ignored.
+ */
+void region_list_append(struct region_list* list, char* text);
+
+/*
+ * Appends a deferred region to the end of a list: one whose `length` bytes of
+ * text aren't known yet, and are written by region_list_render() when the list
+ * is rendered, identified by `key`.  A list holding deferred regions can't be
+ * spilled or written with region_list_write().
+ */
+void region_list_append_deferred(struct region_list* list, uint32_t key, size_t length);
+
+/*
+ * Moves every region of `src` to the end of `dst`, in order, leaving `src`
+ * empty.  If `src` has spilled regions, `dst` is spilled too and the spilled
+ * text of `src` is moved to its spill file.  Returns 0 on success or -1 if the
+ * regions couldn't be written.
+ */
+int region_list_concat(struct region_list* dst, struct region_list* src);
+
+/*
+ * Returns the number of regions in a list.
+ */
+int region_list_size(struct region_list* list);
+
+/*
+ * Returns the total length in bytes of all regions in a list.
+ */
+size_t region_list_length(struct region_list* list);
+
+/*
+ * Returns the number of bytes of region text a list holds in memory, i.e. not
+ * counting regions that have been spilled.
+ */
+size_t region_list_memory(struct region_list* list);
+
+/*
+ * Moves every region a list holds in memory to the end of the list's spill
+ * file, an unlinked temporary file created on first use, and frees them.
+ * Returns 0 on success or -1 if the regions couldn't be written.
+ */
+int region_list_spill(struct region_list* list);
+
+/*
+ * Writes all regions in a list to a stream in order, copying any spilled
+ * regions from the spill file first.  Returns 0 on success or -1 if the spill
+ * file couldn't be read.
+ */
+int region_list_write(struct region_list* list, FILE* stream);
+
+/*
+ * Returns the total length in bytes of the regions from index `first` up to
+ * (but not including) `last` of a list that has never been spilled.
+ */
+size_t region_list_span_length(struct region_list* list, int first, int last);
+
+/*
+ * Copies the regions from index `first` up to `last` of a list that has never
+ * been spilled to `out`, in order, calling `fill` to write each deferred
+ * region.  `out` must have room for region_list_span_length() bytes.  Spans
+ * that don't overlap can be rendered by different threads at once.
+ */
+void region_list_render(struct region_list* list, int first, int last, char* out,
+    region_fill_fn fill, void* arg);
+
+#endif
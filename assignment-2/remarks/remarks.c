@@ -0,0 +1,167 @@
+/*
+ * This file contains the implementation of optimization remarks.
+ *
+ * Text remarks look like the translator's diagnostics.  YAML remarks are a
+ * stream of documents tagged !Passed, !Missed or !Analysis, with the keys
+ * LLVM's optimization records have (the message is the single String entry
+ * of Args), so existing tools for reading those can be used.  JSON remarks
+ * are the elements of a single array, which is closed when the stream is
+ * freed.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+#include "remarks.h"
+
+/*
+ * This structure is used to represent a stream of remarks.  `passes` holds
+ * the comma-separated pass names to report on, or is NULL for all of them.
+ */
+struct remarks {
+  FILE* stream;
+  enum remark_format format;
+  char* passes;
+  int count;
+};
+
+static const char* _kind_names[] = { "applied", "missed", "analysis" };
+static const char* _yaml_tags[] = { "Passed", "Missed", "Analysis" };
+
+/*
+ * The function YAML remarks are reported in.  All of the generated code is in
+ * main(), and LLVM's tools need every remark to name a function.
+ */
+#define YAML_FUNCTION "main"
+
+struct remarks* remarks_create(FILE* stream, enum remark_format format, const char* passes) {
+  struct remarks* remarks = calloc(1, sizeof(struct remarks));
+  assert(remarks);
+  remarks->stream = stream;
+  remarks->format = format;
+  remarks->passes = passes && strcmp(passes, "all") != 0 ? strdup(passes) : NULL;
+  if (format == REMARK_JSON) {
+    fprintf(stream, "[");
+  }
+  return remarks;
+}
+
+void remarks_free(struct remarks* remarks) {
+  if (!remarks) {
+    return;
+  }
+  if (remarks->format == REMARK_JSON) {
+    fprintf(remarks->stream, "%s]\n", remarks->count ? "\n" : "");
+  }
+  fflush(remarks->stream);
+  free(remarks->passes);
+  free(remarks);
+}
+
+int remarks_enabled(struct remarks* remarks, const char* pass) {
+  if (!remarks->passes) {
+    return 1;
+  }
+  size_t len = strlen(pass);
+  for (const char* p = remarks->passes; p; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+    if (strncmp(p, pass, len) == 0 && (p[len] == ',' || p[len] == '\0')) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Helper function to write a string as a single-quoted YAML scalar.
+ */
+void _yaml_string(FILE* stream, const char* str) {
+  fputc('\'', stream);
+  for (; *str; str++) {
+    if (*str == '\'') {
+      fputc('\'', stream);
+    }
+    fputc(*str, stream);
+  }
+  fputc('\'', stream);
+}
+
+/*
+ * Helper function to write a string as a JSON string.
+ */
+void _json_string(FILE* stream, const char* str) {
+  fputc('"', stream);
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\') {
+      fprintf(stream, "\\%c", *str);
+    } else if ((unsigned char)*str < 0x20) {
+      fprintf(stream, "\\u%04x", *str);
+    } else {
+      fputc(*str, stream);
+    }
+  }
+  fputc('"', stream);
+}
+
+void remarks_emit(struct remarks* remarks, const char* pass, enum remark_kind kind, const char* name,
+    const char* file, int line, int column, const char* fmt, ...) {
+  if (!REMARKS_ENABLED(remarks, pass)) {
+    return;
+  }
+
+  char* message;
+  va_list args;
+  va_start(args, fmt);
+  vasprintf(&message, fmt, args);
+  va_end(args);
+
+  FILE* stream = remarks->stream;
+  switch (remarks->format) {
+    case REMARK_TEXT:
+      if (file) {
+        fprintf(stream, "%s: ", file);
+      }
+      fprintf(stream, "Remark (%s, %s): %s on line %d, column %d\n", pass,
+        _kind_names[kind], message, line, column);
+      break;
+
+    case REMARK_YAML:
+      fprintf(stream, "--- !%s\nPass: %s\nName: %s\nDebugLoc: { File: ", _yaml_tags[kind], pass, name);
+      _yaml_string(stream, file ? file : "<stdin>");
+      fprintf(stream, ", Line: %d, Column: %d }\nFunction: %s\nArgs:\n  - String: ", line, column,
+        YAML_FUNCTION);
+      _yaml_string(stream, message);
+      fprintf(stream, "\n...\n");
+      break;
+
+    case REMARK_JSON:
+      fprintf(stream, "%s\n  {\"pass\": ", remarks->count ? "," : "");
+      _json_string(stream, pass);
+      fprintf(stream, ", \"kind\": \"%s\", \"name\": \"%s\", ", _kind_names[kind], name);
+      if (file) {
+        fprintf(stream, "\"file\": ");
+        _json_string(stream, file);
+        fprintf(stream, ", ");
+      }
+      fprintf(stream, "\"line\": %d, \"column\": %d, \"message\": ", line, column);
+      _json_string(stream, message);
+      fprintf(stream, "}");
+      break;
+  }
+
+  remarks->count++;
+  free(message);
+}
+
+int remarks_parse_format(const char* name, enum remark_format* format) {
+  static const char* names[] = { "text", "yaml", "json" };
+  for (int i = 0; i < 3; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *format = i;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,78 @@
+/*
+ * This file contains the declarations for optimization remarks.  Each pass
+ * that transforms the translation reports what it did (and what it could have
+ * done but didn't, and why) along with the Python source location involved.
+ * Remarks are written as they're reported, as human-readable text, as a YAML
+ * stream in the style of LLVM's optimization records, or as a JSON array, and
+ * can be limited to particular passes.  See remarks.c for implementation
+ * details.
+ *
+ * Passes should check REMARKS_ENABLED() before doing any work to build a
+ * remark, so they cost nothing when remarks are turned off.
+ */
+
+#ifndef __REMARKS_H
+#define __REMARKS_H
+
+#include <stdio.h>
+
+/*
+ * What a remark is about: a transformation that was applied, one that was
+ * considered but not applied, or a fact discovered along the way.
+ */
+enum remark_kind {
+  REMARK_APPLIED,
+  REMARK_MISSED,
+  REMARK_ANALYSIS
+};
+
+/*
+ * The output formats.
+ */
+enum remark_format {
+  REMARK_TEXT,
+  REMARK_YAML,
+  REMARK_JSON
+};
+
+/*
+ * Structure used to represent a stream of remarks.
+ */
+struct remarks;
+
+/*
+ * Create a new stream of remarks written to `stream` in the given format.
+ * `passes` is a comma-separated list of the passes to report on, or "all"
+ * (or NULL) for every pass.
+ */
+struct remarks* remarks_create(FILE* stream, enum remark_format format, const char* passes);
+
+/*
+ * Finishes the output of a stream of remarks and frees it.  The underlying
+ * stream isn't closed.
+ */
+void remarks_free(struct remarks* remarks);
+
+/*
+ * Returns 1 if remarks from `pass` are being reported or 0 otherwise.
+ */
+int remarks_enabled(struct remarks* remarks, const char* pass);
+
+#define REMARKS_ENABLED(remarks, pass) ((remarks) != NULL && remarks_enabled((remarks), (pass)))
+
+/*
+ * Reports a remark from `pass` about the given source location.  `name` is a
+ * CamelCase identifier for what the remark is about, unique within the pass,
+ * like the remark names LLVM's passes use.  `file` may be NULL if the source
+ * didn't come from a named file.  The message is formatted as by printf().
+ */
+void remarks_emit(struct remarks* remarks, const char* pass, enum remark_kind kind, const char* name,
+    const char* file, int line, int column, const char* fmt, ...);
+
+/*
+ * Parses the name of an output format.  Returns 0 and sets `format` on
+ * success, or returns -1 if `name` isn't a format.
+ */
+int remarks_parse_format(const char* name, enum remark_format* format);
+
+#endif
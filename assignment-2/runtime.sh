@@ -0,0 +1,176 @@
+#!/bin/bash
+
+#
+# Measures how much faster translated programs run than the same programs
+# under CPython.  Every program in the benchmark corpus (bench/programs/ by
+# default, or the files given as arguments) is run with the local python3,
+# and is also translated, compiled at each of -O0 and -O2, and run.  The
+# final values of the program's variables must match between Python and each
+# binary.  For each program the report gives the run times, the speedup over
+# Python, the translate and compile times, and the total time to a result
+# (translate + compile + run) compared with just running Python.  A report is
+# written as JSON to output_files/runtime.json.
+#
+# The exit status is 1 if any program fails to translate or compile, or
+# gives different values from Python.
+#
+
+output_dir="output_files"
+work_dir="$output_dir/runtime"
+report="$output_dir/runtime.json"
+RUNS=${RUNS:-3}
+OPT_LEVELS=${OPT_LEVELS:-"-O0 -O2"}
+
+if [[ $# -gt 0 ]]; then
+    programs="$@"
+else
+    programs=$(ls bench/programs/*.py)
+fi
+
+mkdir -p $work_dir
+
+echo "Compiling Parser..."
+make parse runstat || exit 1
+
+#
+# Prints the median wall-clock seconds of running command $2... with file $1
+# on stdin.
+#
+measure() {
+    local input=$1
+    shift
+    for ((r = 0; r < RUNS; r++)); do
+        ./runstat "$input" "$@"
+    done | sort -n | awk -v runs=$RUNS 'NR == int(runs / 2) + 1 { print $1 }'
+}
+
+#
+# Prints the seconds taken to run command $@ once.
+#
+time_once() {
+    local start=$(date +%s.%N)
+    "$@" || return 1
+    awk -v s=$start -v e=$(date +%s.%N) 'BEGIN { printf "%.6f\n", e - s }'
+}
+
+#
+# Prints the final values of the variables of Python program $1 in the same
+# "name: value" form as the translated program's output.
+#
+python_values() {
+    python3 -c '
+import sys
+names = {}
+exec(compile(open(sys.argv[1]).read(), sys.argv[1], "exec"), names)
+for name, value in names.items():
+    if not name.startswith("__") and isinstance(value, (int, float)):
+        print("%s: %f" % (name, value))
+' "$1"
+}
+
+#
+# Compares variable values printed by Python ($1) and by a translated program
+# ($2).  Every variable Python ends up with must be printed by the translated
+# program with the same value, to within the six decimal places printed (or
+# one part in 10^12 for large values).  Prints the differences, if any.
+#
+compare_values() {
+    awk -F': ' '
+        NR == FNR { expected[$1] = $2; next }
+        { actual[$1] = $2 }
+        END {
+            for (name in expected) {
+                if (!(name in actual)) {
+                    printf "    %s: %s in Python, missing\n", name, expected[name]
+                    continue
+                }
+                diff = expected[name] - actual[name]
+                if (diff < 0) diff = -diff
+                scale = expected[name] < 0 ? -expected[name] : expected[name]
+                if (diff > 1e-6 && diff > scale * 1e-12)
+                    printf "    %s: %s in Python, %s translated\n", name, expected[name], actual[name]
+            }
+        }' "$1" "$2"
+}
+
+status=0
+echo "[" > $report
+first=1
+
+printf "\n%-14s %10s" "Program" "Python s"
+for opt in $OPT_LEVELS; do
+    printf " %10s %9s" "$opt run s" "speedup"
+done
+printf " %12s" "translate s"
+for opt in $OPT_LEVELS; do
+    printf " %10s %13s" "$opt cc s" "$opt result s"
+done
+printf "\n"
+
+for program in $programs; do
+    name=$(basename $program .py)
+    python_values $program > $work_dir/$name.expected
+    python_time=$(measure $program $(command -v python3) -)
+
+    translate_time=$(measure $program ./parse)
+    if ! ./parse < $program > $work_dir/$name.c; then
+        printf "%-14s FAIL (could not translate)\n" $name
+        status=1
+        continue
+    fi
+
+    runs=""
+    compiles=""
+    matched=true
+    for opt in $OPT_LEVELS; do
+        binary=$work_dir/$name$opt
+        compile_time=$(time_once gcc $opt -w $work_dir/$name.c -o $binary)
+        if [[ $? -ne 0 ]]; then
+            printf "%-14s FAIL (could not compile at %s)\n" $name $opt
+            status=1
+            continue 2
+        fi
+        run_time=$(measure /dev/null $binary)
+        $binary > $work_dir/$name$opt.out
+
+        differences=$(compare_values $work_dir/$name.expected $work_dir/$name$opt.out)
+        if [[ -n $differences ]]; then
+            mismatch="$mismatch$name at $opt:\n$differences\n"
+            matched=false
+            status=1
+        fi
+        runs="$runs $run_time"
+        compiles="$compiles $compile_time"
+    done
+
+    printf "%-14s %10.4f" $name $python_time
+    for run_time in $runs; do
+        printf " %10.4f %8.1fx" $run_time $(awk -v p=$python_time -v r=$run_time 'BEGIN { print p / r }')
+    done
+    printf " %12.4f" $translate_time
+    set -- $runs
+    for compile_time in $compiles; do
+        result=$(awk -v t=$translate_time -v c=$compile_time -v r=$1 'BEGIN { printf "%.4f", t + c + r }')
+        printf " %10.4f %13.4f" $compile_time $result
+        shift
+    done
+    [[ $matched == true ]] || printf "   MISMATCH"
+    printf "\n"
+
+    [[ $first -eq 1 ]] || echo "," >> $report
+    first=0
+    printf '  {"program": "%s", "python_seconds": %s, "translate_seconds": %s, "opt_levels": ["%s"], "run_seconds": [%s], "compile_seconds": [%s], "values_match": %s}' \
+        $name $python_time $translate_time "$(echo $OPT_LEVELS | sed 's/ /", "/g')" \
+        "$(echo $runs | tr ' ' ',')" "$(echo $compiles | tr ' ' ',')" $matched >> $report
+done
+
+printf "\n]\n" >> $report
+
+if [[ -n $mismatch ]]; then
+    echo
+    echo "Final values differ from Python:"
+    printf "$mismatch"
+fi
+echo
+echo "Report written to $report"
+exit $status
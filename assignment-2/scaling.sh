@@ -0,0 +1,171 @@
+#!/bin/bash
+
+#
+# Checks that the translator's running time and memory use grow no faster
+# than roughly linearly with its input.  Inputs of doubling size are
+# generated along several axes, each one is translated, and a growth exponent
+# is fitted (by least squares on a log-log scale) to the time and peak memory
+# measured above those of a one-statement input (the smallest program the
+# translator accepts).  The test fails if any exponent is over MAX_EXPONENT,
+# or if any run crashes or exits with a nonzero status (an axis with a failed
+# run isn't fitted).  A report is written as JSON to output_files/scaling.json.
+#
+# The scanner from assignment-1 is checked too if it has been built.
+#
+
+output_dir="output_files"
+work_dir="$output_dir/scaling"
+report="$output_dir/scaling.json"
+MAX_EXPONENT=${MAX_EXPONENT:-1.3}
+RUNS=${RUNS:-3}
+
+mkdir -p $work_dir
+
+echo "Compiling Parser..."
+make parse runstat || exit 1
+
+tools="./parse"
+if [[ -x ../assignment-1/scan ]]; then
+    tools="$tools ../assignment-1/scan"
+fi
+
+#
+# Input generators.  Each one writes an input of size $1 along its axis.
+#
+gen_statements() {
+    awk -v n=$1 'BEGIN { print "x = 1"; for (i = 0; i < n; i++) print "x = x + 1" }'
+}
+
+gen_expression_length() {
+    awk -v n=$1 'BEGIN {
+        for (l = 0; l < 10; l++) {
+            s = "y = 1"
+            for (i = 1; i < n; i++) s = s (i % 2 ? " + " : " * ") (i % 7)
+            print s
+        }
+    }'
+}
+
+gen_nesting_depth() {
+    awk -v n=$1 'BEGIN {
+        lp = ""; rp = ""
+        for (i = 0; i < n; i++) { lp = lp "("; rp = rp ")" }
+        for (l = 0; l < 50; l++) print "z = " lp "1 + " l rp
+    }'
+}
+
+gen_identifiers() {
+    awk -v n=$1 'BEGIN { for (i = 0; i < n; i++) print "v" i " = " i }'
+}
+
+gen_comments() {
+    awk -v n=$1 'BEGIN {
+        for (i = 0; i < n; i++) {
+            if (i % 100 == 0) print "c = " i "  # trailing comment on a statement"
+            else print "# a whole-line comment that the scanner has to skip over"
+        }
+    }'
+}
+
+axes="statements:10000 expression_length:2000 nesting_depth:250 identifiers:10000 comments:20000"
+steps=5
+
+#
+# Prints the median time and peak memory of running $1 on input file $2.  The
+# status is 1 if any run fails, since runstat still prints a time for it.
+#
+measure() {
+    : > $work_dir/runs
+    for ((r = 0; r < RUNS; r++)); do
+        ./runstat "$2" $1 >> $work_dir/runs || return 1
+    done
+    sort -n $work_dir/runs | awk -v runs=$RUNS 'NR == int(runs / 2) + 1 { print }'
+}
+
+#
+# Prints the least-squares slope of log(y - base) against log(x) for the
+# whitespace-separated lists of sizes $1 and values $2, above baseline $3.
+# Points that aren't above the baseline are within its noise and have no
+# logarithm, so they're left out of the fit.  If fewer than two points are
+# left, nothing measurable grew and the exponent is 0.
+#
+fit_exponent() {
+    awk -v xs="$1" -v ys="$2" -v base=$3 'BEGIN {
+        split(xs, x, " "); count = split(ys, y, " ")
+        for (i = 1; i <= count; i++) {
+            v = y[i] - base
+            if (v <= 0) continue
+            lx = log(x[i]); ly = log(v)
+            n++; sx += lx; sy += ly; sxx += lx * lx; sxy += lx * ly
+        }
+        printf "%.3f", n < 2 ? 0 : (n * sxy - sx * sy) / (n * sxx - sx * sx)
+    }'
+}
+
+status=0
+echo "[" > $report
+first=1
+
+printf "\n%-12s %-18s %10s %10s\n" "Tool" "Axis" "Time exp" "Mem exp"
+for tool in $tools; do
+    echo "x = 1" > $work_dir/base.py
+    if ! result=$(measure $tool $work_dir/base.py); then
+        echo "$(basename $tool) fails on a one-statement input"
+        exit 1
+    fi
+    read base_time base_mem <<< "$result"
+
+    for axis in $axes; do
+        name=${axis%%:*}
+        size=${axis##*:}
+        sizes=""
+        times=""
+        mems=""
+        failed_size=""
+        for ((s = 0; s < steps; s++)); do
+            input=$work_dir/${name}_$size.py
+            gen_$name $size > $input
+            if ! result=$(measure $tool $input); then
+                failed_size=$size
+                break
+            fi
+            read t m <<< "$result"
+            sizes="$sizes $size"
+            times="$times $t"
+            mems="$mems $m"
+            size=$((size * 2))
+        done
+
+        if [[ -n $failed_size ]]; then
+            time_exp=null
+            mem_exp=null
+            pass=false
+        else
+            time_exp=$(fit_exponent "$sizes" "$times" $base_time)
+            mem_exp=$(fit_exponent "$sizes" "$mems" $base_mem)
+            pass=$(awk -v t=$time_exp -v m=$mem_exp -v max=$MAX_EXPONENT \
+                'BEGIN { print (t <= max && m <= max) ? "true" : "false" }')
+        fi
+
+        printf "%-12s %-18s %10s %10s" $(basename $tool) $name ${time_exp/null/-} ${mem_exp/null/-}
+        if [[ -n $failed_size ]]; then
+            printf "   FAIL (failed at size %d)" $failed_size
+            status=1
+        elif [[ $pass == "false" ]]; then
+            printf "   FAIL (over %s)" $MAX_EXPONENT
+            status=1
+        fi
+        printf "\n"
+
+        [[ $first -eq 1 ]] || echo "," >> $report
+        first=0
+        printf '  {"tool": "%s", "axis": "%s", "sizes": [%s], "seconds": [%s], "max_rss_kb": [%s], "time_exponent": %s, "memory_exponent": %s, "pass": %s}' \
+            $(basename $tool) $name "$(echo $sizes | tr ' ' ',')" "$(echo $times | tr ' ' ',')" \
+            "$(echo $mems | tr ' ' ',')" $time_exp $mem_exp $pass >> $report
+    done
+done
+
+printf "\n]\n" >> $report
+echo
+echo "Report written to $report"
+exit $status
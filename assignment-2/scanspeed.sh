@@ -0,0 +1,65 @@
+#!/bin/bash
+
+#
+# Compares the scanner's throughput with that of an earlier revision of the
+# translator (BASE_REV, HEAD by default, so uncommitted changes are measured).
+# The earlier revision is exported with git archive and built alongside this
+# one.  Two inputs are generated: one made mostly of comments and blank lines,
+# which are only scanned, and one of long statements, so both skipping text
+# and matching tokens are covered.  Each is translated RUNS times by each
+# build, and the report gives the median throughput in MB/s and the change.
+#
+# Usage: BASE_REV=<revision> ./scanspeed.sh
+#
+
+output_dir="output_files"
+work_dir="$output_dir/scanspeed"
+BASE_REV=${BASE_REV:-HEAD}
+RUNS=${RUNS:-7}
+LINES=${LINES:-200000}
+
+rm -rf $work_dir
+mkdir -p $work_dir/base
+
+echo "Compiling Parser..."
+make parse runstat || exit 1
+
+echo "Compiling Parser at $BASE_REV..."
+(cd .. && git archive $BASE_REV assignment-2) | tar -x -C $work_dir/base || exit 1
+make -C $work_dir/base/assignment-2 parse > /dev/null || exit 1
+
+awk -v n=$LINES 'BEGIN {
+    print "x = 1"
+    for (i = 0; i < n; i++) {
+        if (i % 10 == 0) print "x = x + 1  # a comment after a statement"
+        else if (i % 10 < 8) print "# a whole-line comment the scanner only has to skip over"
+        else print ""
+    }
+}' > $work_dir/comments.py
+
+awk -v n=$LINES 'BEGIN {
+    print "total = 0"
+    print "count = 1"
+    for (i = 0; i < n; i++)
+        print "total = total + count * " i " - (count + 2.5) / 3 + total * count"
+}' > $work_dir/statements.py
+
+#
+# Prints the median wall-clock seconds of translating file $1 with command $2.
+#
+measure() {
+    for ((r = 0; r < RUNS; r++)); do
+        ./runstat $1 $2
+    done | sort -n | awk -v runs=$RUNS 'NR == int(runs / 2) + 1 { print $1 }'
+}
+
+printf "\n%-16s %12s %12s %10s\n" "Input" "base MB/s" "new MB/s" "change"
+for input in comments statements; do
+    file=$work_dir/$input.py
+    bytes=$(wc -c < $file)
+    base=$(measure $file $work_dir/base/assignment-2/parse)
+    new=$(measure $file ./parse)
+    awk -v name=$input -v bytes=$bytes -v b=$base -v n=$new 'BEGIN {
+        printf "%-16s %12.1f %12.1f %+9.1f%%\n", name, bytes / b / 1e6, bytes / n / 1e6, 100 * (b / n - 1)
+    }'
+done
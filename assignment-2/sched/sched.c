@@ -0,0 +1,148 @@
+/*
+ * This file contains the implementation of a work-stealing task scheduler.
+ * Each thread starts with an equal, contiguous range of the tasks, which it
+ * works through from the front.  A thread whose range is empty steals the
+ * back half of the remaining range of the next thread that has any, so
+ * threads whose tasks turn out to be cheap take over the work of the others
+ * rather than sitting idle, and neighbouring tasks (which usually share data)
+ * mostly stay on the same thread.  Tasks never create tasks, so once every
+ * range is empty there's nothing left to start and each thread can exit.
+ *
+ * Each range has its own lock, which its owner takes once per task and a
+ * thief only takes while stealing.  Tasks are expected to be coarse enough
+ * for that to cost nothing noticeable.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "sched.h"
+
+/*
+ * The size of a cache line, which each worker is aligned to so that threads
+ * taking tasks from their own ranges don't contend for the same line.
+ */
+#define CACHE_LINE 64
+
+struct sched;
+
+/*
+ * The state of one thread of a run: the tasks from `next` up to `end` are
+ * still to be started.
+ */
+struct sched_worker {
+  pthread_mutex_t lock;
+  int next;
+  int end;
+  int index;
+  struct sched* sched;
+  pthread_t thread;
+} __attribute__((aligned(CACHE_LINE)));
+
+/*
+ * The state of a run.
+ */
+struct sched {
+  struct sched_worker* workers;
+  int num_workers;
+  sched_task_fn fn;
+  void* arg;
+};
+
+
+/*
+ * Helper function to take the next task from the front of a worker's own
+ * range.  Returns the task's number, or -1 if the range is empty.
+ */
+int _sched_take(struct sched_worker* worker) {
+  pthread_mutex_lock(&worker->lock);
+  int task = worker->next < worker->end ? worker->next++ : -1;
+  pthread_mutex_unlock(&worker->lock);
+  return task;
+}
+
+
+/*
+ * Helper function to steal the back half of the first non-empty range of the
+ * other workers, looking at them in turn starting after `thief`.  The first
+ * stolen task is returned to be run at once and the rest become the thief's
+ * range.  Returns -1 if every other range is empty.
+ */
+int _sched_steal(struct sched* sched, struct sched_worker* thief) {
+  for (int i = 1; i < sched->num_workers; i++) {
+    struct sched_worker* victim = &sched->workers[(thief->index + i) % sched->num_workers];
+    pthread_mutex_lock(&victim->lock);
+    int remaining = victim->end - victim->next;
+    if (remaining > 0) {
+      int start = victim->end - (remaining + 1) / 2;
+      int end = victim->end;
+      victim->end = start;
+      pthread_mutex_unlock(&victim->lock);
+
+      pthread_mutex_lock(&thief->lock);
+      thief->next = start + 1;
+      thief->end = end;
+      pthread_mutex_unlock(&thief->lock);
+      return start;
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return -1;
+}
+
+
+/*
+ * Helper function run by each thread of a run.
+ */
+void* _sched_work(void* arg) {
+  struct sched_worker* worker = arg;
+  struct sched* sched = worker->sched;
+  int task;
+  while ((task = _sched_take(worker)) >= 0 || (task = _sched_steal(sched, worker)) >= 0) {
+    sched->fn(sched->arg, task, worker->index);
+  }
+  return NULL;
+}
+
+
+/*
+ * Runs every task on up to `jobs` threads.  Worker 0 is the calling thread.
+ */
+void sched_run(int jobs, int num_tasks, sched_task_fn fn, void* arg) {
+  assert(fn);
+  int num_workers = jobs < num_tasks ? jobs : num_tasks;
+  if (num_workers <= 1) {
+    for (int task = 0; task < num_tasks; task++) {
+      fn(arg, task, 0);
+    }
+    return;
+  }
+
+  struct sched sched = { NULL, num_workers, fn, arg };
+  int error = posix_memalign((void**)&sched.workers, CACHE_LINE,
+      num_workers * sizeof(struct sched_worker));
+  assert(!error);
+  for (int i = 0; i < num_workers; i++) {
+    struct sched_worker* worker = &sched.workers[i];
+    pthread_mutex_init(&worker->lock, NULL);
+    worker->next = (long)num_tasks * i / num_workers;
+    worker->end = (long)num_tasks * (i + 1) / num_workers;
+    worker->index = i;
+    worker->sched = &sched;
+  }
+
+  for (int i = 1; i < num_workers; i++) {
+    pthread_create(&sched.workers[i].thread, NULL, _sched_work, &sched.workers[i]);
+  }
+  _sched_work(&sched.workers[0]);
+  for (int i = 1; i < num_workers; i++) {
+    pthread_join(sched.workers[i].thread, NULL);
+  }
+
+  for (int i = 0; i < num_workers; i++) {
+    pthread_mutex_destroy(&sched.workers[i].lock);
+  }
+  free(sched.workers);
+}
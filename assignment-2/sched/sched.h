@@ -0,0 +1,27 @@
+/*
+ * This file contains the declarations for a work-stealing task scheduler.  A
+ * run is a fixed number of independent tasks, numbered from 0, spread over a
+ * number of threads; a thread that runs out of tasks takes some from another
+ * thread that still has some.  See sched.c for implementation details.
+ */
+
+#ifndef __SCHED_H
+#define __SCHED_H
+
+/*
+ * The type of function that runs one task.  `task` is the task's number and
+ * `worker` the number (from 0 to jobs - 1) of the thread running it, which
+ * tasks can use to index per-thread state.
+ */
+typedef void (*sched_task_fn)(void* arg, int task, int worker);
+
+/*
+ * Runs `fn` for every task from 0 to `num_tasks` - 1 on up to `jobs` threads,
+ * one of which is the calling thread, and returns once they have all
+ * finished.  Tasks may run in any order, so each should write its results
+ * somewhere of its own, indexed by its number, for the caller to combine in
+ * order.
+ */
+void sched_run(int jobs, int num_tasks, sched_task_fn fn, void* arg);
+
+#endif
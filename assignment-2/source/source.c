@@ -0,0 +1,195 @@
+/*
+ * This file contains the implementation of a source buffer.  The index of
+ * line start offsets is only built the first time a line or column number is
+ * asked for, so translating a program that has no errors never pays for it.
+ * It's only extended as far as the offset asked about, so text after that is
+ * never read: the scanner scans the text in place, and while it does, the
+ * byte after the current token may be temporarily overwritten.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "source.h"
+
+/*
+ * The initial capacity of a source buffer's text, and the number of spare
+ * bytes always allocated after it: one for the terminating NUL and one more
+ * so the text can be scanned in place (see source_scan_text()).
+ */
+#define INITIAL_CAPACITY 65536
+#define SPARE_BYTES 2
+
+/*
+ * This structure is used to represent a source buffer.  `line_starts` holds
+ * the offset of the first byte of each line starting in the first `indexed`
+ * bytes of the text.
+ */
+struct source {
+  char* text;
+  size_t length;
+  size_t capacity;
+  uint32_t* line_starts;
+  int num_lines;
+  int lines_capacity;
+  size_t indexed;
+};
+
+
+/*
+ * Create a new source buffer holding a copy of the first `len` bytes of
+ * `text`.
+ */
+struct source* source_create(const char* text, size_t len) {
+  struct source* source = malloc(sizeof(struct source));
+  assert(source);
+  source->capacity = len > INITIAL_CAPACITY ? len : INITIAL_CAPACITY;
+  source->text = malloc(source->capacity + SPARE_BYTES);
+  assert(source->text);
+  memcpy(source->text, text, len);
+  source->text[len] = '\0';
+  source->length = len;
+  source->line_starts = NULL;
+  source->num_lines = 0;
+  source->lines_capacity = 0;
+  source->indexed = 0;
+  return source;
+}
+
+
+/*
+ * Appends a copy of the first `len` bytes of `text` to a source buffer.  Any
+ * line index already built still covers the text it did before.
+ */
+void source_append(struct source* source, const char* text, size_t len) {
+  assert(source);
+  if (source->length + len > source->capacity) {
+    while (source->length + len > source->capacity) {
+      source->capacity *= 2;
+    }
+    source->text = realloc(source->text, source->capacity + SPARE_BYTES);
+    assert(source->text);
+  }
+
+  memcpy(source->text + source->length, text, len);
+  source->length += len;
+  source->text[source->length] = '\0';
+}
+
+
+/*
+ * Free the memory associated with a source buffer.
+ */
+void source_free(struct source* source) {
+  assert(source);
+  free(source->text);
+  free(source->line_starts);
+  free(source);
+}
+
+
+/*
+ * Returns the text of a source buffer.
+ */
+const char* source_text(struct source* source) {
+  assert(source);
+  return source->text;
+}
+
+
+/*
+ * Returns the text of a source buffer for scanning in place.
+ */
+char* source_scan_text(struct source* source) {
+  assert(source);
+  return source->text;
+}
+
+
+/*
+ * Returns the length in bytes of the text of a source buffer.
+ */
+size_t source_length(struct source* source) {
+  assert(source);
+  return source->length;
+}
+
+
+/*
+ * Helper function to extend the index of line start offsets to cover the
+ * first `upto` bytes of the text.  memchr() is used to find each newline,
+ * since the C library's version scans many bytes at a time with vector
+ * instructions.
+ */
+void _source_index_lines(struct source* source, size_t upto) {
+  if (source->line_starts == NULL) {
+    source->lines_capacity = 1024;
+    source->line_starts = malloc(source->lines_capacity * sizeof(uint32_t));
+    assert(source->line_starts);
+    source->line_starts[0] = 0;
+    source->num_lines = 1;
+  }
+  if (upto <= source->indexed) {
+    return;
+  }
+
+  const char* cur = source->text + source->indexed;
+  const char* end = source->text + upto;
+  while ((cur = memchr(cur, '\n', end - cur)) != NULL) {
+    cur++;
+    if (source->num_lines == source->lines_capacity) {
+      source->lines_capacity *= 2;
+      source->line_starts = realloc(source->line_starts,
+        source->lines_capacity * sizeof(uint32_t));
+      assert(source->line_starts);
+    }
+    source->line_starts[source->num_lines++] = cur - source->text;
+  }
+  source->indexed = upto;
+}
+
+
+/*
+ * Returns the 1-based line number containing a given byte offset, using a
+ * binary search over the line start offsets.
+ */
+int source_line(struct source* source, uint32_t offset) {
+  assert(source);
+  _source_index_lines(source, offset);
+
+  int lo = 0, hi = source->num_lines - 1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo + 1) / 2;
+    if (source->line_starts[mid] <= offset) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo + 1;
+}
+
+
+/*
+ * Returns the 1-based column number of a given byte offset within its line.
+ */
+int source_column(struct source* source, uint32_t offset) {
+  int line = source_line(source, offset);
+  return offset - source->line_starts[line - 1] + 1;
+}
+
+
+/*
+ * Returns the number of lines in a source buffer, not counting an empty line
+ * after a trailing newline.
+ */
+int source_line_count(struct source* source) {
+  assert(source);
+  _source_index_lines(source, source->length);
+  int lines = source->num_lines;
+  if (lines > 1 && source->line_starts[lines - 1] == source->length) {
+    lines--;
+  }
+  return lines;
+}
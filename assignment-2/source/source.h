@@ -0,0 +1,70 @@
+/*
+ * This file contains the declarations for a source buffer holding the whole
+ * text of a program.  Tokens only record their byte offset into the source;
+ * line and column numbers are worked out from the offset on demand, when a
+ * diagnostic needs them.  See source.c for implementation details.
+ */
+
+#ifndef __SOURCE_H
+#define __SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Structure used to represent a source buffer.
+ */
+struct source;
+
+/*
+ * Create a new source buffer holding a copy of the first `len` bytes of
+ * `text`.
+ */
+struct source* source_create(const char* text, size_t len);
+
+/*
+ * Appends a copy of the first `len` bytes of `text` to a source buffer.  This
+ * may move the buffer's text, so pointers previously returned by
+ * source_text() are invalid afterwards.
+ */
+void source_append(struct source* source, const char* text, size_t len);
+
+/*
+ * Free the memory associated with a source buffer.
+ */
+void source_free(struct source* source);
+
+/*
+ * Returns the text of a source buffer.  The text is NUL-terminated.
+ */
+const char* source_text(struct source* source);
+
+/*
+ * Returns the text of a source buffer for scanning in place.  There are
+ * always two writable bytes after the text, so a scanner can end any prefix
+ * of it with the two NULs flex's yy_scan_buffer() needs.  The caller must put
+ * back any bytes it overwrites before the source is used again.
+ */
+char* source_scan_text(struct source* source);
+
+/*
+ * Returns the length in bytes of the text of a source buffer.
+ */
+size_t source_length(struct source* source);
+
+/*
+ * Returns the 1-based line number containing a given byte offset.
+ */
+int source_line(struct source* source, uint32_t offset);
+
+/*
+ * Returns the 1-based column number of a given byte offset within its line.
+ */
+int source_column(struct source* source, uint32_t offset);
+
+/*
+ * Returns the number of lines in a source buffer.
+ */
+int source_line_count(struct source* source);
+
+#endif
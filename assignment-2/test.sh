@@ -15,6 +15,16 @@ fi
 echo "Compiling Parser..."
 make
 
+#
+# Translate and compile every file in one run, with the compiles in parallel.
+# Failed files are left without outputs.  The build's diagnostics are kept in
+# a log, and each failed file's are shown in its own section below.
+#
+echo
+echo "Building $test_dir..."
+./parse --build -j"$(nproc)" --cache-dir "$output_dir/cache" -o "$output_dir" "$test_dir"/*.py \
+    2> "$output_dir/build.log"
+
 echo
 echo "-------------------------------"
 echo
@@ -28,8 +38,8 @@ for file in "$test_dir"/*; do
 
         base=$(basename $file .py)
 
-        ./parse < "$file"
-        if [[ $? -ne 0 ]]; then
+        if [[ ! -x "$output_dir/$base" ]]; then
+            ./parse < "$file"
             echo
             echo "Compiler Errors. Continuing..."
             echo
@@ -38,13 +48,12 @@ for file in "$test_dir"/*; do
             continue
         fi
 
-        ./parse < "$file" > "$output_dir/${base}.c"
+        cat "$output_dir/$base.c"
 
         echo
         echo "Output From Running C File:"
         echo
 
-        gcc $output_dir/$base.c -o $output_dir/$base
         ./$output_dir/$base
 
         echo
@@ -0,0 +1,106 @@
+/*
+ * This file contains statically defined tracepoints for the translator, so a
+ * running translator can be traced with bpftrace, perf or SystemTap without
+ * being rebuilt, e.g.:
+ *
+ *   bpftrace -e 'usdt:./parse:py2c:hash_resize { printf("%d -> %d\n", arg0, arg1); }'
+ *
+ * Each tracepoint is a single nop instruction, described by an ELF note in
+ * the same format as <sys/sdt.h> (the .note.stapsdt section), so no headers
+ * or libraries from SystemTap are needed to build.  A tracer that attaches to
+ * a tracepoint replaces the nop with a breakpoint.  Arguments are passed as
+ * 64-bit signed values in whatever registers or memory they're already in.
+ *
+ * Each tracepoint also has a semaphore, which tracers increment while they're
+ * attached.  Arguments that cost something to compute (durations, say) should
+ * only be computed when TRACE_ENABLED() says someone is listening.
+ *
+ * The tracepoints, all in the py2c provider, are:
+ *
+ *   phase_begin(phase)                    a translation phase starts
+ *   phase_end(phase, ns)                  it ends, after `ns` nanoseconds
+ *   hash_resize(old_capacity, new_capacity, num_elems)
+ *   indent_push(depth, width)             the indentation stack grows
+ *   parse_error(line, message)            a diagnostic is reported
+ *   cache_hit(path, us)                   a cached translation is reused
+ *   cache_miss(path, us)                  a file has to be translated
+ *
+ * Define NO_TRACE to compile them all out.  They're also compiled out on
+ * architectures other than x86-64 and AArch64.
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#if !defined(NO_TRACE) && (defined(__x86_64__) || defined(__aarch64__))
+
+/*
+ * Declares the semaphore of tracepoint `name`.  The definitions are weak, so
+ * every file including this header can have one and the linker keeps one.
+ */
+#define TRACE_SEMAPHORE(name)                                                 \
+    extern volatile unsigned short py2c_##name##_semaphore;                   \
+    volatile unsigned short py2c_##name##_semaphore                           \
+        __attribute__((weak, used, section(".probes"), visibility("hidden")))
+
+TRACE_SEMAPHORE(phase_begin);
+TRACE_SEMAPHORE(phase_end);
+TRACE_SEMAPHORE(hash_resize);
+TRACE_SEMAPHORE(indent_push);
+TRACE_SEMAPHORE(parse_error);
+TRACE_SEMAPHORE(cache_hit);
+TRACE_SEMAPHORE(cache_miss);
+
+#define TRACE_ENABLED(name) __builtin_expect(py2c_##name##_semaphore != 0, 0)
+
+/*
+ * The nop, and the note describing it: its address, the address of the
+ * .stapsdt.base section (so tools can work out where the binary was loaded),
+ * the semaphore's address, the provider and tracepoint names, and where to
+ * find each argument.
+ */
+#define _TRACE(name, args, ...)                                               \
+    __asm__ __volatile__ (                                                    \
+        "990: nop\n"                                                          \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                         \
+        ".balign 4\n"                                                         \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                    \
+        "991: .asciz \"stapsdt\"\n"                                           \
+        "992: .balign 4\n"                                                    \
+        "993: .8byte 990b\n"                                                  \
+        ".8byte _.stapsdt.base\n"                                             \
+        ".8byte py2c_" #name "_semaphore\n"                                   \
+        ".asciz \"py2c\"\n"                                                   \
+        ".asciz \"" #name "\"\n"                                              \
+        ".asciz \"" args "\"\n"                                               \
+        "994: .balign 4\n"                                                    \
+        ".popsection\n"                                                       \
+        ".ifndef _.stapsdt.base\n"                                            \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n"                                              \
+        ".hidden _.stapsdt.base\n"                                            \
+        "_.stapsdt.base: .space 1\n"                                          \
+        ".size _.stapsdt.base, 1\n"                                           \
+        ".popsection\n"                                                       \
+        ".endif\n"                                                            \
+        :: __VA_ARGS__)
+
+#define _TRACE_ARG(a) "nor"((long long)(a))
+
+#define TRACE1(name, a1)                                                      \
+    _TRACE(name, "-8@%0", _TRACE_ARG(a1))
+#define TRACE2(name, a1, a2)                                                  \
+    _TRACE(name, "-8@%0 -8@%1", _TRACE_ARG(a1), _TRACE_ARG(a2))
+#define TRACE3(name, a1, a2, a3)                                              \
+    _TRACE(name, "-8@%0 -8@%1 -8@%2", _TRACE_ARG(a1), _TRACE_ARG(a2), _TRACE_ARG(a3))
+
+#else
+
+#define TRACE_ENABLED(name) 0
+#define TRACE1(name, a1) do { } while (0)
+#define TRACE2(name, a1, a2) do { } while (0)
+#define TRACE3(name, a1, a2, a3) do { } while (0)
+
+#endif
+
+#endif
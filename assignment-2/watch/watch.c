@@ -0,0 +1,262 @@
+/*
+ * This file contains the implementation of watch mode.  The directory is
+ * monitored with inotify.  For each .py file, an incremental translation (see
+ * py2c_incremental_translate()) keeps the last source text and the
+ * translation of each of its top-level statements, and the last generated C
+ * code is kept too.  A save that doesn't change the source costs nothing, a
+ * save that does only has the statements it changed parsed again, and the .c
+ * file is only rewritten when the generated code actually changes.
+ * Translations run in the same warm process, sharing one interner, which is
+ * reclaimed between translations once it grows past INTERN_RECLAIM_BYTES, so
+ * a long-running watch doesn't accumulate every name it has ever seen.  Every
+ * file's kept statements hold interned names, so they're forgotten when it is.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+#include "../parser.h"
+#include "../fileio/fileio.h"
+#include "../trace/trace.h"
+
+/*
+ * The last known state of a watched .py file.
+ */
+struct watched_file {
+  struct py2c_incremental* translation;
+  char* output;
+  size_t output_len;
+};
+
+
+/*
+ * Helper function to free a watched file's translation and buffers.  The
+ * structure itself is freed by the hash table that owns it.
+ */
+void _watched_file_clear(struct watched_file* file) {
+  py2c_incremental_free(file->translation);
+  free(file->output);
+  file->translation = NULL;
+  file->output = NULL;
+  file->output_len = 0;
+}
+
+
+/*
+ * Helper function to make every watched file's next translation start from
+ * scratch, once the interner their kept statements use has been reset.
+ */
+void _forget_translations(struct hash* files) {
+  struct hash_iter* iter = hash_iter_create(files);
+  while (hash_iter_has_next(iter)) {
+    struct watched_file* file = hash_iter_next(iter, NULL);
+    py2c_incremental_forget(file->translation);
+  }
+  hash_iter_free(iter);
+}
+
+
+/*
+ * Helper function to write a buffer to a file, replacing it atomically so an
+ * editor or compiler never sees a half-written file.
+ */
+int _write_file(const char* path, const char* data, size_t len) {
+  char* tmp_path;
+  asprintf(&tmp_path, "%s.tmp", path);
+
+  FILE* f = fopen(tmp_path, "wb");
+  int ok = f && fwrite(data, 1, len, f) == len;
+  if (f && fclose(f) != 0) {
+    ok = 0;
+  }
+  if (ok) {
+    ok = rename(tmp_path, path) == 0;
+  } else {
+    unlink(tmp_path);
+  }
+
+  free(tmp_path);
+  return ok ? 0 : -1;
+}
+
+
+/*
+ * Helper function returning the time elapsed since `start` in milliseconds.
+ */
+double _elapsed_ms(struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+
+/*
+ * Helper function to bring the .c file for one .py file up to date.
+ */
+void _update_file(const char* dir, const char* name, struct hash* files,
+    struct interner* names) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  char* py_path;
+  asprintf(&py_path, "%s/%s", dir, name);
+
+  size_t source_len;
+  char* source = fileio_read_file(py_path, &source_len);
+  if (!source) {
+    fprintf(stderr, "Error: Could not read %s\n", py_path);
+    free(py_path);
+    return;
+  }
+
+  struct watched_file* file = hash_get(files, (char*)name);
+  if (!file) {
+    file = calloc(1, sizeof(struct watched_file));
+    file->translation = py2c_incremental_create(names);
+    hash_insert(files, (char*)name, file);
+  }
+
+  /*
+   * If the source hasn't changed since it was last translated, there's
+   * nothing to do.
+   */
+  size_t last_len;
+  const char* last_source = py2c_incremental_source(file->translation, &last_len);
+  if (last_source && last_len == source_len && !memcmp(last_source, source, source_len)) {
+    TRACE2(cache_hit, py_path, TRACE_ENABLED(cache_hit) ? _elapsed_ms(&start) * 1e3 : 0);
+    free(source);
+    free(py_path);
+    return;
+  }
+
+  /*
+   * Translate the new source in memory.  The translation takes over the
+   * source.
+   */
+  char* output = NULL;
+  size_t output_len = 0;
+  FILE* out = open_memstream(&output, &output_len);
+  int status = py2c_incremental_translate(file->translation, source, source_len, out);
+  if (intern_reclaim(names, INTERN_RECLAIM_BYTES)) {
+    _forget_translations(files);
+  }
+  fclose(out);
+  TRACE2(cache_miss, py_path, TRACE_ENABLED(cache_miss) ? _elapsed_ms(&start) * 1e3 : 0);
+
+  if (status) {
+    fprintf(stderr, "%s: translation failed\n", py_path);
+    free(output);
+    free(py_path);
+    return;
+  }
+
+  /*
+   * Only rewrite the .c file if the generated code is different.
+   */
+  char* c_path;
+  asprintf(&c_path, "%s/%.*s.c", dir, (int)(strlen(name) - 3), name);
+  if (file->output && file->output_len == output_len
+      && !memcmp(file->output, output, output_len)) {
+    free(output);
+    fprintf(stderr, "%s: unchanged (%.2f ms)\n", c_path, _elapsed_ms(&start));
+  } else if (_write_file(c_path, output, output_len) == 0) {
+    free(file->output);
+    file->output = output;
+    file->output_len = output_len;
+    fprintf(stderr, "%s: updated (%.2f ms)\n", c_path, _elapsed_ms(&start));
+  } else {
+    free(output);
+    fprintf(stderr, "Error: Could not write %s\n", c_path);
+  }
+
+  free(c_path);
+  free(py_path);
+}
+
+
+/*
+ * Helper function returning 1 if a file name ends in .py or 0 otherwise.
+ */
+int _is_python_file(const char* name) {
+  size_t l = strlen(name);
+  return l > 3 && strcmp(name + l - 3, ".py") == 0;
+}
+
+
+/*
+ * Translates every .py file in `dir`, then watches the directory and
+ * retranslates each .py file whenever it's written.
+ */
+int watch_directory(const char* dir, struct interner* names) {
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    perror("Error: Could not watch directory");
+    if (fd >= 0) {
+      close(fd);
+    }
+    return 1;
+  }
+
+  /*
+   * Start by bringing every existing file up to date.
+   */
+  DIR* d = opendir(dir);
+  if (!d) {
+    perror("Error: Could not open directory");
+    close(fd);
+    return 1;
+  }
+  struct hash* files = hash_create();
+  struct dirent* entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (_is_python_file(entry->d_name)) {
+      _update_file(dir, entry->d_name, files, names);
+    }
+  }
+  closedir(d);
+
+  fprintf(stderr, "Watching %s for changes...\n", dir);
+
+  /*
+   * Then handle events as they arrive.  Editors either write files in place
+   * (IN_CLOSE_WRITE) or write a temporary file and rename it over the
+   * original (IN_MOVED_TO).
+   */
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (1) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      perror("Error: Could not read inotify events");
+      break;
+    }
+
+    for (char* p = buf; p < buf + n; ) {
+      struct inotify_event* event = (struct inotify_event*)p;
+      if (event->len > 0 && _is_python_file(event->name)) {
+        _update_file(dir, event->name, files, names);
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  /*
+   * Free each watched file's translation and buffers.  hash_free() frees the
+   * structures.
+   */
+  struct hash_iter* iter = hash_iter_create(files);
+  while (hash_iter_has_next(iter)) {
+    _watched_file_clear(hash_iter_next(iter, NULL));
+  }
+  hash_iter_free(iter);
+  hash_free(files);
+  close(fd);
+
+  return 1;
+}
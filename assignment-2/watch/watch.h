@@ -0,0 +1,20 @@
+/*
+ * This file contains the declarations for watch mode, which keeps the
+ * translator running and retranslates Python files in a directory as soon as
+ * they're saved.  See watch.c for implementation details.
+ */
+
+#ifndef __WATCH_H
+#define __WATCH_H
+
+struct interner;
+
+/*
+ * Translates every .py file in `dir` to a .c file next to it, then watches
+ * the directory and retranslates each .py file whenever it's written.  Names
+ * are interned in `names`.  Only returns if watching fails, with a nonzero
+ * status.
+ */
+int watch_directory(const char* dir, struct interner* names);
+
+#endif
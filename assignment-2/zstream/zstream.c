@@ -0,0 +1,309 @@
+/*
+ * This file contains the implementation of compressed streams.
+ *
+ * A reader's decompression thread fills a small ring of chunk buffers with
+ * gzread() and the consumer takes them in order.  The consumer holds on to
+ * one chunk at a time, until it asks for the next, so at most NUM_CHUNKS - 1
+ * chunks are decompressed ahead of the scanner.  gzread() passes data that
+ * isn't gzip-compressed through unchanged; for such input there's nothing to
+ * overlap, so no thread is started and chunks are read as they're asked for,
+ * keeping startup cheap for small uncompressed inputs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "zstream.h"
+
+#define NUM_CHUNKS 4
+#define CHUNK_SIZE 65536
+
+/*
+ * This structure is used to represent a stream being decompressed.
+ * `produced` and `consumed` count chunks filled by the thread and released by
+ * the consumer; chunk `n` lives in `bufs[n % NUM_CHUNKS]`.
+ */
+struct zstream_reader {
+  gzFile gz;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  char* bufs[NUM_CHUNKS];
+  size_t lens[NUM_CHUNKS];
+  unsigned produced;
+  unsigned consumed;
+  int holding;
+  int eof;
+  int stopping;
+  int direct;
+  char* error;
+};
+
+
+/*
+ * The function run by a reader's decompression thread.
+ */
+void* _decompress(void* arg) {
+  struct zstream_reader* r = arg;
+
+  pthread_mutex_lock(&r->lock);
+  while (!r->eof) {
+    while (r->produced - r->consumed == NUM_CHUNKS && !r->stopping) {
+      pthread_cond_wait(&r->not_full, &r->lock);
+    }
+    if (r->stopping) {
+      break;
+    }
+    unsigned slot = r->produced % NUM_CHUNKS;
+    pthread_mutex_unlock(&r->lock);
+
+    int n = gzread(r->gz, r->bufs[slot], CHUNK_SIZE);
+
+    pthread_mutex_lock(&r->lock);
+    if (n > 0) {
+      r->lens[slot] = n;
+      r->produced++;
+    } else {
+      int errnum;
+      const char* msg = gzerror(r->gz, &errnum);
+      if (n < 0 || errnum != Z_OK) {
+        r->error = strdup(msg);
+      }
+      r->eof = 1;
+    }
+    pthread_cond_signal(&r->not_empty);
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  return NULL;
+}
+
+
+/*
+ * Starts decompressing descriptor `fd` in the background.
+ */
+struct zstream_reader* zstream_reader_open(int fd) {
+  int dup_fd = dup(fd);
+  gzFile gz = dup_fd < 0 ? NULL : gzdopen(dup_fd, "rb");
+  if (!gz) {
+    if (dup_fd >= 0) {
+      close(dup_fd);
+    }
+    return NULL;
+  }
+  gzbuffer(gz, CHUNK_SIZE);
+
+  struct zstream_reader* r = calloc(1, sizeof(struct zstream_reader));
+  assert(r);
+  r->gz = gz;
+  r->direct = gzdirect(gz);
+  for (int i = 0; i < (r->direct ? 1 : NUM_CHUNKS); i++) {
+    r->bufs[i] = malloc(CHUNK_SIZE);
+    assert(r->bufs[i]);
+  }
+  if (r->direct) {
+    return r;
+  }
+
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->not_empty, NULL);
+  pthread_cond_init(&r->not_full, NULL);
+  pthread_create(&r->thread, NULL, _decompress, r);
+
+  return r;
+}
+
+
+/*
+ * Returns the next chunk of decompressed data, releasing the previous one.
+ */
+const char* zstream_reader_next(struct zstream_reader* r, size_t* len) {
+  assert(r);
+  if (r->direct) {
+    int n = r->eof ? 0 : gzread(r->gz, r->bufs[0], CHUNK_SIZE);
+    if (n > 0) {
+      *len = n;
+      return r->bufs[0];
+    }
+    if (n < 0 && !r->error) {
+      int errnum;
+      r->error = strdup(gzerror(r->gz, &errnum));
+    }
+    r->eof = 1;
+    return NULL;
+  }
+
+  pthread_mutex_lock(&r->lock);
+
+  if (r->holding) {
+    r->consumed++;
+    r->holding = 0;
+    pthread_cond_signal(&r->not_full);
+  }
+  while (r->produced == r->consumed && !r->eof) {
+    pthread_cond_wait(&r->not_empty, &r->lock);
+  }
+
+  const char* chunk = NULL;
+  if (r->produced != r->consumed) {
+    unsigned slot = r->consumed % NUM_CHUNKS;
+    chunk = r->bufs[slot];
+    *len = r->lens[slot];
+    r->holding = 1;
+  }
+
+  pthread_mutex_unlock(&r->lock);
+  return chunk;
+}
+
+
+/*
+ * Returns the error that ended a stream, if any.  Only meaningful once
+ * zstream_reader_next() has returned NULL.
+ */
+const char* zstream_reader_error(struct zstream_reader* r) {
+  assert(r);
+  return r->error;
+}
+
+
+/*
+ * Stops decompression and frees a stream.
+ */
+void zstream_reader_close(struct zstream_reader* r) {
+  assert(r);
+
+  if (!r->direct) {
+    pthread_mutex_lock(&r->lock);
+    r->stopping = 1;
+    pthread_cond_signal(&r->not_full);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->not_empty);
+    pthread_cond_destroy(&r->not_full);
+  }
+
+  gzclose(r->gz);
+  for (int i = 0; i < NUM_CHUNKS; i++) {
+    free(r->bufs[i]);
+  }
+  free(r->error);
+  free(r);
+}
+
+
+/*
+ * Helper functions connecting a compressing gzFile to a stdio stream.
+ */
+ssize_t _gz_cookie_write(void* cookie, const char* buf, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  int n = gzwrite((gzFile)cookie, buf, size);
+  return n > 0 ? n : -1;
+}
+
+int _gz_cookie_close(void* cookie) {
+  return gzclose((gzFile)cookie) == Z_OK ? 0 : EOF;
+}
+
+
+/*
+ * Returns a stream that gzip-compresses onto descriptor `fd`.
+ */
+FILE* zstream_writer_open(int fd) {
+  gzFile gz = gzdopen(fd, "wb");
+  if (!gz) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+
+  cookie_io_functions_t funcs = {
+    .read = NULL,
+    .write = _gz_cookie_write,
+    .seek = NULL,
+    .close = _gz_cookie_close
+  };
+  FILE* stream = fopencookie(gz, "w", funcs);
+  if (!stream) {
+    gzclose(gz);
+    return NULL;
+  }
+  setvbuf(stream, NULL, _IOFBF, CHUNK_SIZE);
+  __fsetlocking(stream, FSETLOCKING_BYCALLER);
+  return stream;
+}
+
+
+/*
+ * Decompresses gzip data held in memory a chunk at a time.
+ */
+int zstream_inflate(const char* data, size_t len,
+    int (*fn)(void* arg, const char* chunk, size_t len), void* arg) {
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, 15 + 16) != Z_OK) {
+    return -1;
+  }
+
+  char* chunk = malloc(CHUNK_SIZE);
+  assert(chunk);
+  z.next_in = (Bytef*)data;
+  z.avail_in = len;
+
+  int ret;
+  do {
+    z.next_out = (Bytef*)chunk;
+    z.avail_out = CHUNK_SIZE;
+    ret = inflate(&z, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      break;
+    }
+    size_t n = CHUNK_SIZE - z.avail_out;
+    if (n > 0 && fn(arg, chunk, n) != 0) {
+      ret = Z_STREAM_END;
+      break;
+    }
+  } while (ret != Z_STREAM_END);
+
+  free(chunk);
+  inflateEnd(&z);
+  return ret == Z_STREAM_END ? 0 : -1;
+}
+
+
+/*
+ * Returns a gzip-compressed copy of `data`.
+ */
+char* zstream_deflate(const char* data, size_t len, size_t* out_len) {
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  int ret = deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  assert(ret == Z_OK);
+
+  size_t capacity = deflateBound(&z, len);
+  char* out = malloc(capacity);
+  assert(out);
+  z.next_in = (Bytef*)data;
+  z.avail_in = len;
+  z.next_out = (Bytef*)out;
+  z.avail_out = capacity;
+
+  ret = deflate(&z, Z_FINISH);
+  assert(ret == Z_STREAM_END);
+  *out_len = z.total_out;
+  deflateEnd(&z);
+
+  return out;
+}
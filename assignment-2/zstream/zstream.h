@@ -0,0 +1,70 @@
+/*
+ * This file contains the declarations for compressed input and output
+ * streams.  Input is decompressed with zlib on a separate thread in fixed-size
+ * chunks, so the scanner can start on the first chunk while the rest of the
+ * input is still being decompressed.  Output is compressed as it's written.
+ * Data that isn't gzip-compressed is read as-is.  See zstream.c for
+ * implementation details.
+ */
+
+#ifndef __ZSTREAM_H
+#define __ZSTREAM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Structure used to represent a stream being decompressed.
+ */
+struct zstream_reader;
+
+/*
+ * Starts decompressing the file open on descriptor `fd` in the background.
+ * If the file turns out not to be compressed, it's read on demand instead.
+ * The descriptor itself is left open.  Returns NULL if the stream can't be
+ * set up.
+ */
+struct zstream_reader* zstream_reader_open(int fd);
+
+/*
+ * Returns the next chunk of decompressed data and stores its length in `len`,
+ * waiting for it to be decompressed if necessary.  The chunk stays valid
+ * until the next call.  Returns NULL at the end of the stream or on error.
+ */
+const char* zstream_reader_next(struct zstream_reader* r, size_t* len);
+
+/*
+ * Returns a message describing why the stream ended early, or NULL if it
+ * hasn't.
+ */
+const char* zstream_reader_error(struct zstream_reader* r);
+
+/*
+ * Stops decompression and frees a stream.
+ */
+void zstream_reader_close(struct zstream_reader* r);
+
+/*
+ * Returns a stream that gzip-compresses everything written to it onto
+ * descriptor `fd`.  Closing the stream finishes the compressed data and
+ * closes `fd`.  The stream doesn't lock itself, so it must only be used by
+ * one thread.  Returns NULL, having closed `fd`, if the stream can't be set
+ * up.
+ */
+FILE* zstream_writer_open(int fd);
+
+/*
+ * Decompresses `len` bytes of gzip data held in memory, calling `fn` with
+ * each chunk of decompressed data in turn.  Decompression stops early if `fn`
+ * returns nonzero.  Returns 0 on success or -1 if the data is corrupt.
+ */
+int zstream_inflate(const char* data, size_t len,
+    int (*fn)(void* arg, const char* chunk, size_t len), void* arg);
+
+/*
+ * Returns a newly-allocated gzip-compressed copy of `len` bytes of `data`,
+ * storing its length in `out_len`.
+ */
+char* zstream_deflate(const char* data, size_t len, size_t* out_len);
+
+#endif